@@ -0,0 +1,246 @@
+/*
+ * ickBenchClient.c
+ *
+ * Synthetic ickStream controller used when benchmarking the daemons. It
+ * sends JSON-RPC requests over ickP2p to a device at a controlled rate and
+ * measures the time until the matching response arrives.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include "ickP2p.h"
+#include "ickBenchLatency.h"
+
+// Requests are matched to responses by their id modulo this
+#define CLIENT_SLOTS 65536
+
+struct _request {
+	int id;
+	long long sent;
+};
+
+char* targetDeviceId = NULL;
+// Requests per second, 0 sends a new request as soon as one is answered
+int rate = 0;
+int duration = 10;
+// Requests waiting for a response when rate is 0
+int outstandingLimit = 1;
+int discoveryTimeout = 30;
+char* method = "getServiceInformation";
+char* params = "{}";
+
+pthread_mutex_t clientMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t clientCondition = PTHREAD_COND_INITIALIZER;
+int discovered = 0;
+int outstanding = 0;
+struct _request requests[CLIENT_SLOTS];
+latencyRecorder_t* g_latency = NULL;
+
+void messageCb(ickP2pContext_t *ictx, const char *szSourceDeviceId, ickP2pServicetype_t sourceService, ickP2pServicetype_t targetService, const char* message, size_t messageLength, ickP2pMessageFlag_t mFlags)
+{
+	long long received = latencyNow();
+	char* copy = malloc(messageLength+1);
+	memcpy(copy, message, messageLength);
+	copy[messageLength] = '\0';
+	const char* idMember = strstr(copy, "\"id\"");
+	if(idMember == NULL) {
+		free(copy);
+		return;
+	}
+	idMember += 4;
+	while(*idMember == ' ' || *idMember == ':' || *idMember == '"') {
+		idMember++;
+	}
+	int id = atoi(idMember);
+	int failed = strstr(copy, "\"error\"") != NULL;
+	free(copy);
+
+	pthread_mutex_lock(&clientMutex);
+	struct _request* request = &requests[id%CLIENT_SLOTS];
+	if(request->id == id && request->sent > 0) {
+		if(failed) {
+			latencyError(g_latency);
+		}else {
+			latencyAdd(g_latency, received-request->sent);
+		}
+		request->sent = 0;
+		outstanding--;
+		pthread_cond_broadcast(&clientCondition);
+	}
+	pthread_mutex_unlock(&clientMutex);
+}
+
+void discoveryCb(ickP2pContext_t *ictx, const char *szDeviceId, ickP2pDeviceState_t change, ickP2pServicetype_t service)
+{
+	if(strcmp(szDeviceId, targetDeviceId) == 0 && (change == ICKP2P_NEW || change == ICKP2P_CONNECTED)) {
+		pthread_mutex_lock(&clientMutex);
+		discovered = 1;
+		pthread_cond_broadcast(&clientCondition);
+		pthread_mutex_unlock(&clientMutex);
+	}
+}
+
+static void deadline(struct timespec* time, long long micros)
+{
+	clock_gettime(CLOCK_REALTIME, time);
+	time->tv_sec += micros/1000000;
+	time->tv_nsec += (micros%1000000)*1000;
+	if(time->tv_nsec >= 1000000000) {
+		time->tv_sec++;
+		time->tv_nsec -= 1000000000;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int option;
+	while((option = getopt(argc, argv, "r:t:o:w:m:p:")) != -1) {
+		switch(option) {
+			case 'r':
+				rate = atoi(optarg);
+				break;
+			case 't':
+				duration = atoi(optarg);
+				break;
+			case 'o':
+				outstandingLimit = atoi(optarg);
+				break;
+			case 'w':
+				discoveryTimeout = atoi(optarg);
+				break;
+			case 'm':
+				method = optarg;
+				break;
+			case 'p':
+				params = optarg;
+				break;
+			default:
+				break;
+		}
+	}
+	if(argc-optind != 2 || outstandingLimit < 1 || outstandingLimit > CLIENT_SLOTS) {
+		printf("Usage: %s [-r requestsPerSecond | -o outstandingRequests] [-t seconds] [-w discoveryTimeout] [-m method] [-p params] IP-address targetDeviceId\n",argv[0]);
+		return 0;
+	}
+	char* networkAddress = argv[optind];
+	targetDeviceId = argv[optind+1];
+
+	char deviceId[64];
+	sprintf(deviceId, "ickBenchClient-%d", (int)getpid());
+	ickErrcode_t error;
+	ickP2pContext_t* context = ickP2pCreate("ickBenchClient",deviceId,NULL,0,0,ICKP2P_SERVICE_CONTROLLER,&error);
+	if(error == ICKERR_SUCCESS) {
+		error = ickP2pRegisterMessageCallback(context, &messageCb);
+	}
+	if(error == ICKERR_SUCCESS) {
+		error = ickP2pRegisterDiscoveryCallback(context, &discoveryCb);
+	}
+	if(error == ICKERR_SUCCESS) {
+		error = ickP2pAddInterface(context, networkAddress, NULL);
+	}
+	if(error == ICKERR_SUCCESS) {
+		error = ickP2pResume(context);
+	}
+	if(error != ICKERR_SUCCESS) {
+		printf("Unable to initialize ickP2p: %d\n",(int)error);
+		return 1;
+	}
+
+	struct timespec until;
+	deadline(&until, discoveryTimeout*1000000LL);
+	pthread_mutex_lock(&clientMutex);
+	while(!discovered) {
+		if(pthread_cond_timedwait(&clientCondition, &clientMutex, &until) == ETIMEDOUT) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&clientMutex);
+	if(!discovered) {
+		printf("Device %s not discovered within %d seconds\n", targetDeviceId, discoveryTimeout);
+		ickP2pEnd(context,NULL);
+		return 1;
+	}
+
+	g_latency = latencyCreate();
+	char* message = malloc(strlen(method)+strlen(params)+128);
+	long long started = latencyNow();
+	long long stopTime = started+duration*1000000LL;
+	long long interval = rate > 0 ? 1000000LL/rate : 0;
+	long long next = started;
+	int id = 0;
+	while(latencyNow() < stopTime) {
+		if(interval > 0) {
+			long long now = latencyNow();
+			if(next > now) {
+				usleep(next-now);
+			}
+			next += interval;
+		}else {
+			// Closed loop, wait until one of the outstanding requests has been answered
+			pthread_mutex_lock(&clientMutex);
+			while(outstanding >= outstandingLimit && latencyNow() < stopTime) {
+				deadline(&until, 100000);
+				pthread_cond_timedwait(&clientCondition, &clientMutex, &until);
+			}
+			pthread_mutex_unlock(&clientMutex);
+			if(latencyNow() >= stopTime) {
+				break;
+			}
+		}
+		int length = sprintf(message, "{\"jsonrpc\":\"2.0\",\"id\":%d,\"method\":\"%s\",\"params\":%s}", id, method, params);
+
+		pthread_mutex_lock(&clientMutex);
+		struct _request* request = &requests[id%CLIENT_SLOTS];
+		if(request->sent > 0) {
+			// Never answered, the slot is reused
+			outstanding--;
+			latencyError(g_latency);
+		}
+		request->id = id;
+		request->sent = latencyNow();
+		outstanding++;
+		pthread_mutex_unlock(&clientMutex);
+
+		if(ickP2pSendMsg(context,targetDeviceId,ICKP2P_SERVICE_SERVER_GENERIC,ICKP2P_SERVICE_CONTROLLER,message,length) != ICKERR_SUCCESS) {
+			pthread_mutex_lock(&clientMutex);
+			if(request->id == id && request->sent > 0) {
+				request->sent = 0;
+				outstanding--;
+				latencyError(g_latency);
+			}
+			pthread_mutex_unlock(&clientMutex);
+		}
+		id++;
+	}
+	long long elapsed = latencyNow()-started;
+
+	// Give the last requests a chance to be answered, whatever is still missing afterwards failed
+	deadline(&until, 5000000);
+	pthread_mutex_lock(&clientMutex);
+	while(outstanding > 0) {
+		if(pthread_cond_timedwait(&clientCondition, &clientMutex, &until) == ETIMEDOUT) {
+			break;
+		}
+	}
+	int missing = outstanding;
+	memset(requests, 0, sizeof(requests));
+	outstanding = 0;
+	pthread_mutex_unlock(&clientMutex);
+	while(missing-- > 0) {
+		latencyError(g_latency);
+	}
+	latencyReport(g_latency, method, elapsed, stdout);
+
+	ickP2pEnd(context,NULL);
+	latencyDestroy(g_latency);
+	free(message);
+	return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * ickBenchFlood.c
+ *
+ * Load generator for the HTTP interface of ickHttpSqueezeboxPlayerDaemon,
+ * it starts a number of players and floods /sendMessage on their behalf.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "ickBenchLatency.h"
+
+int daemonPort = 0;
+int connections = 4;
+// Messages per second over all connections, 0 sends as fast as possible
+int rate = 0;
+int duration = 10;
+int bodySize = 256;
+int players = 1;
+char* method = "playerStatusChanged";
+char* body = NULL;
+
+latencyRecorder_t* g_latency = NULL;
+long long g_stopTime = 0;
+
+// Send one request on a new connection and read the answer until the daemon closes it, returns the HTTP status
+static int post(const char* path, const char* playerId, const char* data)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(fd < 0) {
+		return -1;
+	}
+	int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(daemonPort);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	size_t dataLength = strlen(data);
+	char* request = malloc(dataLength+512);
+	int length = sprintf(request, "POST %s HTTP/1.1\r\nHost: 127.0.0.1:%d\r\nAuthorization: %s bench\r\nContent-Type: application/json\r\nContent-Length: %lu\r\n\r\n%s",
+			path, daemonPort, playerId, (unsigned long)dataLength, data);
+	int sent = 0;
+	while(sent < length) {
+		ssize_t n = send(fd, request+sent, length-sent, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			break;
+		}
+		sent += n;
+	}
+	free(request);
+	if(sent < length) {
+		close(fd);
+		return -1;
+	}
+
+	// Only the status line is of interest, the rest is discarded
+	char response[64];
+	char discard[1024];
+	size_t received = 0;
+	while(1) {
+		ssize_t n;
+		if(received < sizeof(response)-1) {
+			n = recv(fd, response+received, sizeof(response)-1-received, 0);
+		}else {
+			n = recv(fd, discard, sizeof(discard), 0);
+		}
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			break;
+		}
+		if(received < sizeof(response)-1) {
+			received += n;
+		}
+	}
+	close(fd);
+	response[received] = '\0';
+	int status = -1;
+	if(sscanf(response, "HTTP/1.%*d %d", &status) != 1) {
+		return -1;
+	}
+	return status;
+}
+
+static void* floodThread(void* arg)
+{
+	int index = (int)(long)arg;
+	char playerId[64];
+	sprintf(playerId, "bench-player-%d", index%players);
+
+	// Every connection sends its share of the rate, evenly spaced
+	long long interval = rate > 0 ? 1000000LL*connections/rate : 0;
+	long long next = latencyNow()+(interval > 0 ? interval*index/connections : 0);
+	while(1) {
+		long long now = latencyNow();
+		if(now >= g_stopTime) {
+			break;
+		}
+		if(interval > 0) {
+			if(next > now) {
+				usleep(next-now);
+			}
+			next += interval;
+		}
+		long long started = latencyNow();
+		int status = post("/sendMessage", playerId, body);
+		if(status == 200) {
+			latencyAdd(g_latency, latencyNow()-started);
+		}else {
+			latencyError(g_latency);
+		}
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	int option;
+	while((option = getopt(argc, argv, "c:r:t:s:p:m:")) != -1) {
+		switch(option) {
+			case 'c':
+				connections = atoi(optarg);
+				break;
+			case 'r':
+				rate = atoi(optarg);
+				break;
+			case 't':
+				duration = atoi(optarg);
+				break;
+			case 's':
+				bodySize = atoi(optarg);
+				break;
+			case 'p':
+				players = atoi(optarg);
+				break;
+			case 'm':
+				method = optarg;
+				break;
+			default:
+				break;
+		}
+	}
+	if(argc-optind != 1 || connections < 1 || players < 1 || bodySize < 0) {
+		printf("Usage: %s [-c connections] [-r messagesPerSecond] [-t seconds] [-s bodyBytes] [-p players] [-m method] daemonPort\n",argv[0]);
+		return 0;
+	}
+	daemonPort = atoi(argv[optind]);
+
+	body = malloc(bodySize+256);
+	char* padding = malloc(bodySize+1);
+	memset(padding, 'x', bodySize);
+	padding[bodySize] = '\0';
+	sprintf(body, "{\"jsonrpc\":\"2.0\",\"method\":\"%s\",\"params\":{\"padding\":\"%s\"}}", method, padding);
+	free(padding);
+
+	int i;
+	for(i=0;i<players;i++) {
+		char playerId[64];
+		char playerName[64];
+		sprintf(playerId, "bench-player-%d", i);
+		sprintf(playerName, "Benchmark Player %d", i);
+		int status = post("/start", playerId, playerName);
+		if(status != 200) {
+			printf("Unable to start %s: %d\n", playerId, status);
+			return 1;
+		}
+	}
+
+	g_latency = latencyCreate();
+	pthread_t* threads = malloc(sizeof(pthread_t)*connections);
+	long long started = latencyNow();
+	g_stopTime = started+duration*1000000LL;
+	for(i=0;i<connections;i++) {
+		pthread_create(&threads[i], NULL, floodThread, (void*)(long)i);
+	}
+	for(i=0;i<connections;i++) {
+		pthread_join(threads[i], NULL);
+	}
+	latencyReport(g_latency, "sendMessage", latencyNow()-started, stdout);
+
+	for(i=0;i<players;i++) {
+		char playerId[64];
+		sprintf(playerId, "bench-player-%d", i);
+		post("/stop", playerId, "");
+	}
+	latencyDestroy(g_latency);
+	free(threads);
+	free(body);
+	return 0;
+}
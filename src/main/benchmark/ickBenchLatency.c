@@ -0,0 +1,108 @@
+/*
+ * ickBenchLatency.c
+ *
+ * Latency samples collected by the benchmark tools, reported as
+ * throughput and percentiles when a run is finished.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "ickBenchLatency.h"
+
+struct _latencyRecorder {
+	long long* samples;
+	size_t count;
+	size_t size;
+	unsigned long errors;
+	pthread_mutex_t mutex;
+};
+
+latencyRecorder_t* latencyCreate(void)
+{
+	latencyRecorder_t* recorder = malloc(sizeof(latencyRecorder_t));
+	if(recorder == NULL) {
+		return NULL;
+	}
+	memset(recorder, 0, sizeof(latencyRecorder_t));
+	pthread_mutex_init(&recorder->mutex, NULL);
+	return recorder;
+}
+
+void latencyDestroy(latencyRecorder_t* recorder)
+{
+	if(recorder == NULL) {
+		return;
+	}
+	pthread_mutex_destroy(&recorder->mutex);
+	free(recorder->samples);
+	free(recorder);
+}
+
+long long latencyNow(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec*1000000+now.tv_nsec/1000;
+}
+
+void latencyAdd(latencyRecorder_t* recorder, long long micros)
+{
+	pthread_mutex_lock(&recorder->mutex);
+	if(recorder->count == recorder->size) {
+		size_t size = recorder->size > 0 ? recorder->size*2 : 4096;
+		long long* samples = realloc(recorder->samples, sizeof(long long)*size);
+		if(samples == NULL) {
+			recorder->errors++;
+			pthread_mutex_unlock(&recorder->mutex);
+			return;
+		}
+		recorder->samples = samples;
+		recorder->size = size;
+	}
+	recorder->samples[recorder->count++] = micros;
+	pthread_mutex_unlock(&recorder->mutex);
+}
+
+void latencyError(latencyRecorder_t* recorder)
+{
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->errors++;
+	pthread_mutex_unlock(&recorder->mutex);
+}
+
+static int compareSamples(const void* a, const void* b)
+{
+	long long first = *(const long long*)a;
+	long long second = *(const long long*)b;
+	return first < second ? -1 : (first > second ? 1 : 0);
+}
+
+static long long percentile(const long long* samples, size_t count, int percent)
+{
+	if(count == 0) {
+		return 0;
+	}
+	size_t index = (count*percent+99)/100;
+	return samples[index > 0 ? index-1 : 0];
+}
+
+void latencyReport(latencyRecorder_t* recorder, const char* name, long long elapsedMicros, FILE* out)
+{
+	pthread_mutex_lock(&recorder->mutex);
+	if(recorder->count > 0) {
+		qsort(recorder->samples, recorder->count, sizeof(long long), compareSamples);
+	}
+	double seconds = elapsedMicros > 0 ? elapsedMicros/1000000.0 : 1;
+	fprintf(out, "RESULT %s requests=%lu errors=%lu throughput=%.1f/s p50=%lldus p99=%lldus max=%lldus\n",
+			name, (unsigned long)recorder->count, recorder->errors, recorder->count/seconds,
+			percentile(recorder->samples, recorder->count, 50), percentile(recorder->samples, recorder->count, 99),
+			recorder->count > 0 ? recorder->samples[recorder->count-1] : 0);
+	fflush(out);
+	pthread_mutex_unlock(&recorder->mutex);
+}
@@ -0,0 +1,34 @@
+/*
+ * ickBenchLatency.h
+ *
+ * Latency samples collected by the benchmark tools, reported as
+ * throughput and percentiles when a run is finished.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#ifndef __ICKBENCHLATENCY_H
+#define __ICKBENCHLATENCY_H
+
+#include <stdio.h>
+
+struct _latencyRecorder;
+typedef struct _latencyRecorder latencyRecorder_t;
+
+latencyRecorder_t* latencyCreate(void);
+void latencyDestroy(latencyRecorder_t* recorder);
+
+// Monotonic time in microseconds
+long long latencyNow(void);
+
+// Record the latency of one successful operation, thread safe
+void latencyAdd(latencyRecorder_t* recorder, long long micros);
+
+// Count a failed operation, thread safe
+void latencyError(latencyRecorder_t* recorder);
+
+// Print a single RESULT line with throughput and percentiles for a run which took the given time
+void latencyReport(latencyRecorder_t* recorder, const char* name, long long elapsedMicros, FILE* out);
+
+#endif
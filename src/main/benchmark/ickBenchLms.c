@@ -0,0 +1,276 @@
+/*
+ * ickBenchLms.c
+ *
+ * Stand-in for the IckStreamPlugin inside LMS used when benchmarking the
+ * daemons. It answers the JSON-RPC and discovery endpoints of the plugin
+ * with a configurable latency and response size.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "ickHttpParser.h"
+
+#define PLUGIN_PATH "/plugins/IckStreamPlugin/"
+
+// Time spent on each request before it is answered
+int latency = 0;
+// Approximate size of a JSON-RPC response body
+int responseSize = 256;
+// LMS handles one request at a time
+int concurrency = 1;
+char* padding = NULL;
+
+pthread_mutex_t slotMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t slotCondition = PTHREAD_COND_INITIALIZER;
+int busy = 0;
+
+pthread_mutex_t counterMutex = PTHREAD_MUTEX_INITIALIZER;
+unsigned long requests = 0;
+unsigned long discoveries = 0;
+
+volatile sig_atomic_t bExit = 0;
+
+static void acquireSlot(void)
+{
+	pthread_mutex_lock(&slotMutex);
+	while(busy >= concurrency) {
+		pthread_cond_wait(&slotCondition, &slotMutex);
+	}
+	busy++;
+	pthread_mutex_unlock(&slotMutex);
+}
+
+static void releaseSlot(void)
+{
+	pthread_mutex_lock(&slotMutex);
+	busy--;
+	pthread_cond_signal(&slotCondition);
+	pthread_mutex_unlock(&slotMutex);
+}
+
+static int writeAll(int fd, const char* data, size_t length)
+{
+	size_t written = 0;
+	while(written < length) {
+		ssize_t n = send(fd, data+written, length-written, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			return -1;
+		}
+		written += n;
+	}
+	return 0;
+}
+
+static int writeResponse(int fd, const char* status, const char* body, size_t bodyLength)
+{
+	char header[256];
+	int headerLength = snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nServer: ickBenchLms\r\nConnection: keep-alive\r\nContent-Type: application/json\r\nContent-Length: %lu\r\n\r\n", status, (unsigned long)bodyLength);
+	if(writeAll(fd, header, headerLength) != 0) {
+		return -1;
+	}
+	return bodyLength > 0 ? writeAll(fd, body, bodyLength) : 0;
+}
+
+// Copy the raw value of the top level "id" member, returns 0 if the request is a notification
+static int requestId(const char* body, char* id, size_t size)
+{
+	const char* p = body != NULL ? strstr(body, "\"id\"") : NULL;
+	if(p == NULL) {
+		return 0;
+	}
+	p += 4;
+	while(*p == ' ' || *p == ':' || *p == '\t' || *p == '\r' || *p == '\n') {
+		p++;
+	}
+	size_t length = 0;
+	if(*p == '"') {
+		const char* end = strchr(p+1, '"');
+		length = end != NULL ? (size_t)(end-p+1) : 0;
+	}else {
+		length = strcspn(p, ",} \t\r\n");
+	}
+	if(length == 0 || length >= size || strncmp(p, "null", 4) == 0) {
+		return 0;
+	}
+	memcpy(id, p, length);
+	id[length] = '\0';
+	return 1;
+}
+
+static int handleJsonRpc(int fd, httpParser_t* request)
+{
+	char id[64];
+	if(!requestId(request->body, id, sizeof(id))) {
+		return writeResponse(fd, "200 OK", NULL, 0);
+	}
+	char* response = malloc(responseSize+256);
+	int length;
+	if(strstr(request->body, "\"getLastScannedTime\"") != NULL) {
+		length = sprintf(response, "{\"jsonrpc\":\"2.0\",\"id\":%s,\"result\":{\"lastChanged\":1}}", id);
+	}else {
+		length = sprintf(response, "{\"jsonrpc\":\"2.0\",\"id\":%s,\"result\":{\"padding\":\"%s\"}}", id, padding);
+	}
+	int rc = writeResponse(fd, "200 OK", response, length);
+	free(response);
+	return rc;
+}
+
+static int handleRequest(int fd, httpParser_t* request)
+{
+	if(strcmp(request->method, "POST") != 0 || strncmp(request->path, PLUGIN_PATH, strlen(PLUGIN_PATH)) != 0) {
+		return writeResponse(fd, "404 Not Found", NULL, 0);
+	}
+	const char* resource = request->path+strlen(PLUGIN_PATH);
+	size_t resourceLength = strcspn(resource, "?");
+	int rc;
+	acquireSlot();
+	if(latency > 0) {
+		usleep(latency*1000);
+	}
+	if(resourceLength >= 7 && strncmp(resource+resourceLength-7, "jsonrpc", 7) == 0) {
+		pthread_mutex_lock(&counterMutex);
+		requests++;
+		pthread_mutex_unlock(&counterMutex);
+		rc = handleJsonRpc(fd, request);
+	}else if(resourceLength == 9 && strncmp(resource, "discovery", 9) == 0) {
+		pthread_mutex_lock(&counterMutex);
+		discoveries++;
+		pthread_mutex_unlock(&counterMutex);
+		rc = writeResponse(fd, "200 OK", NULL, 0);
+	}else {
+		rc = writeResponse(fd, "404 Not Found", NULL, 0);
+	}
+	releaseSlot();
+	return rc;
+}
+
+// Serve requests on a keep-alive connection until the client closes it
+static void* connectionThread(void* arg)
+{
+	int fd = (int)(long)arg;
+	httpParser_t request;
+	httpParserInit(&request);
+	while(!bExit) {
+		size_t available = 0;
+		char* buffer = httpParserBuffer(&request, &available);
+		if(buffer == NULL) {
+			break;
+		}
+		ssize_t n = recv(fd, buffer, available, 0);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			break;
+		}
+		httpParserState_t state = httpParserConsume(&request, n);
+		if(state == HTTP_PARSER_ERROR) {
+			writeResponse(fd, request.error, NULL, 0);
+			break;
+		}
+		if(state == HTTP_PARSER_DONE) {
+			if(handleRequest(fd, &request) != 0) {
+				break;
+			}
+			httpParserFree(&request);
+			httpParserInit(&request);
+		}
+	}
+	httpParserFree(&request);
+	close(fd);
+	return NULL;
+}
+
+void sigHandler(int sig)
+{
+	bExit = 1;
+}
+
+int main(int argc, char *argv[])
+{
+	int option;
+	while((option = getopt(argc, argv, "l:s:c:")) != -1) {
+		switch(option) {
+			case 'l':
+				latency = atoi(optarg);
+				break;
+			case 's':
+				responseSize = atoi(optarg);
+				break;
+			case 'c':
+				concurrency = atoi(optarg);
+				break;
+			default:
+				break;
+		}
+	}
+	if(argc-optind != 1 || responseSize < 0 || concurrency < 1) {
+		printf("Usage: %s [-l latencyMs] [-s responseBytes] [-c concurrentRequests] port\n",argv[0]);
+		return 0;
+	}
+	int port = atoi(argv[optind]);
+
+	padding = malloc(responseSize+1);
+	memset(padding, 'x', responseSize);
+	padding[responseSize] = '\0';
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = sigHandler;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	int listenfd = socket(AF_INET, SOCK_STREAM, 0);
+	int on = 1;
+	setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(bind(listenfd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listenfd, 128) != 0) {
+		printf("Unable to listen on port %d: %s\n", port, strerror(errno));
+		return 1;
+	}
+	printf("Listening on 127.0.0.1:%d, latency=%dms, responseSize=%d, concurrency=%d\n", port, latency, responseSize, concurrency);
+	fflush(stdout);
+
+	while(!bExit) {
+		int fd = accept(listenfd, NULL, NULL);
+		if(fd < 0) {
+			continue;
+		}
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		pthread_t thread;
+		pthread_attr_t attributes;
+		pthread_attr_init(&attributes);
+		pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+		if(pthread_create(&thread, &attributes, connectionThread, (void*)(long)fd) != 0) {
+			close(fd);
+		}
+		pthread_attr_destroy(&attributes);
+	}
+	close(listenfd);
+	pthread_mutex_lock(&counterMutex);
+	printf("Served %lu JSON-RPC requests and %lu discovery events\n", requests, discoveries);
+	pthread_mutex_unlock(&counterMutex);
+	fflush(stdout);
+	free(padding);
+	return 0;
+}
@@ -0,0 +1,108 @@
+#!/bin/bash
+#
+# runBenchmark.sh
+#
+# Benchmarks ickHttpWrapperDaemon and ickHttpSqueezeboxPlayerDaemon against
+# ickBenchLms on the loopback interface, nothing leaves the host. For each
+# daemon a RESULT line with throughput and p50/p99 latency is printed,
+# followed by the resident memory of the daemon and its own statistics.
+#
+# All parameters can be overridden from the environment, e.g.
+#   LATENCY=20 RESPONSESIZE=8192 ./runBenchmark.sh
+#
+# ickP2p discovers devices with multicast, the loopback interface must allow it:
+#   ip link set lo multicast on && ip route add 239.0.0.0/8 dev lo
+#
+# Copyright (c) 2013 ickStream GmbH.
+# All rights reserved.
+
+IP=${IP:-127.0.0.1}
+LMSPORT=${LMSPORT:-19000}
+DAEMONPORT=${DAEMONPORT:-19001}
+DURATION=${DURATION:-10}
+
+# Stand-in LMS: latency in ms, JSON-RPC response size in bytes and concurrent requests
+LATENCY=${LATENCY:-0}
+RESPONSESIZE=${RESPONSESIZE:-256}
+LMSCONCURRENCY=${LMSCONCURRENCY:-1}
+
+# ickP2p client: requests per second, or outstanding requests when RATE is 0
+RATE=${RATE:-0}
+OUTSTANDING=${OUTSTANDING:-8}
+METHOD=${METHOD:-getServiceInformation}
+# Response cache of the wrapper daemon in KB, 0 disables it
+CACHESIZE=${CACHESIZE:-0}
+
+# /sendMessage flood: connections, messages per second (0 is unlimited), body size and players
+CONNECTIONS=${CONNECTIONS:-8}
+FLOODRATE=${FLOODRATE:-0}
+BODYSIZE=${BODYSIZE:-256}
+PLAYERS=${PLAYERS:-1}
+
+cd "$(dirname "$0")"
+WRAPPERDAEMON=../daemon/ickHttpWrapperDaemon
+PLAYERDAEMON=../playerdaemon/ickHttpSqueezeboxPlayerDaemon
+LMSURL=http://$IP:$LMSPORT/plugins/IckStreamPlugin
+PIDS=""
+
+cleanup() {
+	for PID in $PIDS; do
+		kill $PID 2>/dev/null
+		wait $PID 2>/dev/null
+	done
+}
+trap cleanup EXIT
+
+# Print the current and peak resident memory of a process
+memory() {
+	echo "MEMORY $1 $(grep -E '^Vm(RSS|HWM)' /proc/$2/status | tr -s ' \t' ' ' | tr '\n' ' ')"
+}
+
+# Wait until something listens on a TCP port
+waitForPort() {
+	for i in $(seq 1 50); do
+		(echo > /dev/tcp/$IP/$1) 2>/dev/null && return 0
+		sleep 0.1
+	done
+	echo "Nothing listening on port $1"
+	exit 1
+}
+
+./ickBenchLms -l $LATENCY -s $RESPONSESIZE -c $LMSCONCURRENCY $LMSPORT > bench-lms.log 2>&1 &
+PIDS="$PIDS $!"
+waitForPort $LMSPORT
+
+echo "*************************************************************"
+echo "ickHttpWrapperDaemon: $METHOD, latency=${LATENCY}ms, responseSize=$RESPONSESIZE"
+CACHEOPTIONS=""
+if [ "$CACHESIZE" -gt 0 ]; then
+	CACHEOPTIONS="-K $CACHESIZE"
+fi
+$WRAPPERDAEMON $CACHEOPTIONS $IP bench-server "Benchmark Server" $LMSURL/ContentAccessService/jsonrpc bench-wrapper.log &
+WRAPPERPID=$!
+PIDS="$PIDS $WRAPPERPID"
+if [ "$RATE" -gt 0 ]; then
+	./ickBenchClient -r $RATE -t $DURATION -m $METHOD $IP bench-server
+else
+	./ickBenchClient -o $OUTSTANDING -t $DURATION -m $METHOD $IP bench-server
+fi
+memory ickHttpWrapperDaemon $WRAPPERPID
+# The daemon writes its statistics to the log on SIGUSR1
+kill -USR1 $WRAPPERPID
+sleep 1.5
+grep -o 'STATS .*' bench-wrapper.log | tail -1
+kill $WRAPPERPID
+wait $WRAPPERPID 2>/dev/null
+
+echo "*************************************************************"
+echo "ickHttpSqueezeboxPlayerDaemon: sendMessage, connections=$CONNECTIONS, bodySize=$BODYSIZE"
+$PLAYERDAEMON $IP $DAEMONPORT $LMSURL/PlayerService/jsonrpc /plugins/IckStreamPlugin/discovery bench-player.log &
+PLAYERPID=$!
+PIDS="$PIDS $PLAYERPID"
+waitForPort $DAEMONPORT
+./ickBenchFlood -c $CONNECTIONS -r $FLOODRATE -t $DURATION -s $BODYSIZE -p $PLAYERS $DAEMONPORT
+memory ickHttpSqueezeboxPlayerDaemon $PLAYERPID
+exec 3<>/dev/tcp/$IP/$DAEMONPORT
+printf "GET /stats HTTP/1.1\r\nHost: $IP\r\n\r\n" >&3
+echo "STATS $(sed -n '/^{/p' <&3)"
+exec 3<&-
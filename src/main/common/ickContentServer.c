@@ -0,0 +1,212 @@
+/*
+ * ickContentServer.c
+ *
+ * ickP2p context of the content server which forwards all received
+ * requests to the ContentAccessService of the IckStreamPlugin. Used by the
+ * wrapper daemon and by the player daemon when it also hosts the content
+ * server.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ickContentServer.h"
+#include "ickStats.h"
+#include "ickLogger.h"
+
+// Seconds between checks if the library has been rescanned
+#define CONTENT_SERVER_CACHE_VALIDATION_INTERVAL 10
+
+static char* contentServerPath = NULL;
+static httpConnectionPool_t* contentServerHttpPool = NULL;
+static workerPool_t* contentServerWorkerPool = NULL;
+static responseCache_t* contentServerResponseCache = NULL;
+
+struct _messageJob {
+	ickP2pContext_t* context;
+	char* sourceDeviceId;
+	ickP2pServicetype_t sourceService;
+	char* message;
+	size_t messageLength;
+	long long received;
+};
+
+// Cached responses are only valid as long as the library hasn't been rescanned
+static void validateResponseCache(void)
+{
+	static const char request[] = "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"getLastScannedTime\"}";
+
+	if(!responseCacheValidationDue(contentServerResponseCache, CONTENT_SERVER_CACHE_VALIDATION_INTERVAL)) {
+		return;
+	}
+	char* state = NULL;
+	httpResponse_t response;
+	if(httpPoolPost(contentServerHttpPool, contentServerPath, request, sizeof(request)-1, &response) == 0) {
+		if(response.status == 200) {
+			state = responseCacheResult(response.body, response.bodyLength);
+		}
+		httpResponseFree(&response);
+	}
+	responseCacheValidate(contentServerResponseCache, state, state != NULL ? strlen(state) : 0);
+	free(state);
+}
+
+// Playlists can be edited without a rescan, so requests for playlists, their items or playlist
+// tracks are never answered from the cache
+static int isPlaylistRequest(const char* message, size_t messageLength)
+{
+	return memmem(message, messageLength, "\"playlist\"", 10) != NULL ||
+			memmem(message, messageLength, "\"playlistId\"", 12) != NULL ||
+			memmem(message, messageLength, ":playlist:", 10) != NULL;
+}
+
+// Returns STATS_FAILED if the response couldn't be sent
+static int sendResponse(ickP2pContext_t *ictx, const char *szSourceDeviceId, ickP2pServicetype_t sourceService, const char* response, size_t responseLength)
+{
+	long long started = statsNow();
+	ickErrcode_t error = ickP2pSendMsg(ictx,szSourceDeviceId, sourceService,ICKP2P_SERVICE_SERVER_GENERIC,response, responseLength);
+	statsRecordStage(STATS_STAGE_P2P_SEND, statsNow()-started);
+	if(error != ICKERR_SUCCESS) {
+		loggerPrintf(LOGGER_ERROR, "Failed to send response=%d",(int)error);
+		return STATS_FAILED;
+	}
+	return 0;
+}
+
+static void handleMessage(ickP2pContext_t *ictx, const char *szSourceDeviceId, ickP2pServicetype_t sourceService, const char* message, size_t messageLength, long long received)
+{
+	statsRecordStage(STATS_STAGE_RECEIVE, statsNow()-received);
+
+	unsigned int generation = 0;
+	int cacheable = contentServerResponseCache != NULL && !isPlaylistRequest(message, messageLength);
+	if(cacheable) {
+		validateResponseCache();
+		size_t cachedLength;
+		char* cached = responseCacheLookup(contentServerResponseCache, message, messageLength, &cachedLength, &generation);
+		if(cached != NULL) {
+			loggerPayload(LOGGER_DEBUG, "To (cached)", szSourceDeviceId, cached, cachedLength);
+			int flags = STATS_CACHED | sendResponse(ictx, szSourceDeviceId, sourceService, cached, cachedLength);
+			long long total = statsNow()-received;
+			statsRecordStage(STATS_STAGE_TOTAL, total);
+			statsRecord(message, messageLength, szSourceDeviceId, messageLength, cachedLength, total, flags);
+			free(cached);
+			statsInFlight(-1);
+			return;
+		}
+	}
+
+	httpResponse_t response;
+	size_t responseLength = 0;
+	int flags = STATS_FAILED;
+    if( httpPoolPost(contentServerHttpPool, contentServerPath, message, messageLength, &response) == 0 ) {
+        statsRecordHttp(&response);
+        loggerPayload(LOGGER_DEBUG, "To", szSourceDeviceId, response.body, response.bodyLength);
+        // The body is sent straight out of the receive buffer
+        flags = sendResponse(ictx, szSourceDeviceId, sourceService, response.body, response.bodyLength);
+        if(response.status != 200) {
+        	flags = STATS_FAILED;
+        }
+        if(cacheable && response.status == 200) {
+        	responseCacheStore(contentServerResponseCache, message, messageLength, response.body, response.bodyLength, generation);
+        }
+        responseLength = response.bodyLength;
+		httpResponseFree(&response);
+    }
+	long long total = statsNow()-received;
+	statsRecordStage(STATS_STAGE_TOTAL, total);
+	statsRecord(message, messageLength, szSourceDeviceId, messageLength, responseLength, total, flags);
+	statsInFlight(-1);
+}
+
+static void messageJob(void* data)
+{
+	struct _messageJob* job = (struct _messageJob*)data;
+	handleMessage(job->context, job->sourceDeviceId, job->sourceService, job->message, job->messageLength, job->received);
+	free(job->sourceDeviceId);
+	free(job->message);
+	free(job);
+}
+
+static void contentServerMessageCb(ickP2pContext_t *ictx, const char *szSourceDeviceId, ickP2pServicetype_t sourceService, ickP2pServicetype_t targetService, const char* message, size_t messageLength, ickP2pMessageFlag_t mFlags )
+{
+	if(messageLength == 0) {
+		messageLength = strlen(message);
+	}
+	long long received = statsNow();
+	loggerPayload(LOGGER_DEBUG, "From", szSourceDeviceId, message, messageLength);
+	statsInFlight(1);
+
+	if(contentServerWorkerPool != NULL) {
+		// Requests from the same device are queued behind each other, other devices are served in parallel.
+		// The message only lives for the duration of the callback so the job needs its own copy.
+		struct _messageJob* job = malloc(sizeof(struct _messageJob));
+		job->context = ictx;
+		job->sourceDeviceId = strdup(szSourceDeviceId);
+		job->sourceService = sourceService;
+		job->message = malloc(messageLength);
+		memcpy(job->message,message,messageLength);
+		job->messageLength = messageLength;
+		job->received = received;
+		if(workerPoolSubmit(contentServerWorkerPool, szSourceDeviceId, &messageJob, job) == 0) {
+			return;
+		}
+		loggerPrintf(LOGGER_WARNING, "Unable to queue message from %s, handling it directly",szSourceDeviceId);
+		free(job->sourceDeviceId);
+		free(job->message);
+		free(job);
+	}
+	handleMessage(ictx, szSourceDeviceId, sourceService, message, messageLength, received);
+}
+
+static void contentServerDiscoveryCb(ickP2pContext_t *ictx, const char *szDeviceId, ickP2pDeviceState_t change, ickP2pServicetype_t type)
+{
+    loggerPrintf(LOGGER_INFO, "DISCOVERY %s type=%d services=%d)",szDeviceId,(int)change,(int)type);
+}
+
+ickP2pContext_t* contentServerStart(const char* networkAddress, const char* deviceId, const char* deviceName, const char* path, httpConnectionPool_t* httpPool, workerPool_t* workerPool, responseCache_t* responseCache)
+{
+	free(contentServerPath);
+	contentServerPath = strdup(path);
+	contentServerHttpPool = httpPool;
+	contentServerWorkerPool = workerPool;
+	contentServerResponseCache = responseCache;
+
+	ickErrcode_t error;
+    loggerPrintf(LOGGER_DEBUG, "create(\"%s\",\"%s\",NULL,0,0,%d,%p)",deviceName,deviceId,ICKP2P_SERVICE_SERVER_GENERIC,&error);
+	ickP2pContext_t* context = ickP2pCreate(deviceName,deviceId,NULL,0,0,ICKP2P_SERVICE_SERVER_GENERIC,&error);
+	if(error == ICKERR_SUCCESS) {
+    	error = ickP2pRegisterMessageCallback(context, &contentServerMessageCb);
+    	if(error != ICKERR_SUCCESS) {
+    		loggerPrintf(LOGGER_ERROR, "ickP2pRegisterMessageCallback failed=%d",(int)error);
+    	}
+    	error = ickP2pRegisterDiscoveryCallback(context, &contentServerDiscoveryCb);
+    	if(error != ICKERR_SUCCESS) {
+    		loggerPrintf(LOGGER_ERROR, "ickP2pRegisterDiscoveryCallback failed=%d",(int)error);
+    	}
+#ifdef ICK_DEBUG
+	    ickP2pSetHttpDebugging(context,1);
+#endif
+		error = ickP2pAddInterface(context, networkAddress, NULL);
+    	if(error != ICKERR_SUCCESS) {
+    		loggerPrintf(LOGGER_ERROR, "ickP2pAddInterface failed=%d",(int)error);
+    	}
+    	error = ickP2pResume(context);
+    	if(error != ICKERR_SUCCESS) {
+    		loggerPrintf(LOGGER_ERROR, "ickP2pResume failed=%d",(int)error);
+    	}
+	}else {
+   		loggerPrintf(LOGGER_ERROR, "ickP2pCreate failed=%d",(int)error);
+        context = NULL;
+	}
+	return context;
+}
+
+void contentServerStop(ickP2pContext_t* context)
+{
+	if(context != NULL) {
+		ickP2pEnd(context,NULL);
+	}
+}
@@ -0,0 +1,32 @@
+/*
+ * ickContentServer.h
+ *
+ * ickP2p context of the content server which forwards all received
+ * requests to the ContentAccessService of the IckStreamPlugin. Used by the
+ * wrapper daemon and by the player daemon when it also hosts the content
+ * server.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#ifndef __ICKCONTENTSERVER_H
+#define __ICKCONTENTSERVER_H
+
+#include "ickP2p.h"
+#include "ickHttpClient.h"
+#include "ickWorkerPool.h"
+#include "ickResponseCache.h"
+
+// Read-only ContentAccess methods whose responses are cached by default, playlist requests are never cached
+#define CONTENT_SERVER_CACHED_METHODS "getServiceInformation,getProtocolVersions,getManagementProtocolDescription,getProtocolDescription,getProtocolDescription2,getPreferredMenus,getItem,findItems"
+
+// Create and resume the content server context, requests are posted to path (without leading slash) using httpPool.
+// If workerPool is NULL requests are handled directly in the ickP2p thread. Responses of cacheable methods are answered
+// from responseCache if it isn't NULL. Only one content server per process.
+ickP2pContext_t* contentServerStart(const char* networkAddress, const char* deviceId, const char* deviceName, const char* path, httpConnectionPool_t* httpPool, workerPool_t* workerPool, responseCache_t* responseCache);
+
+// Shut down the context, the pools and the cache are not touched and must outlive it
+void contentServerStop(ickP2pContext_t* context);
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ * ickDiscoveryQueue.c
+ *
+ * Forwards discovery events of the player contexts to the IckStreamPlugin
+ * from a separate thread. Pending events for the same player and device are
+ * collapsed and all pending events are posted in one request.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "ickDiscoveryQueue.h"
+#include "ickLogger.h"
+
+struct _discoveryEvent;
+struct _discoveryEvent {
+	char* playerId;
+	char* deviceId;
+	int services;
+	const char* status;
+	struct _discoveryEvent* next;
+};
+
+struct _discoveryQueue {
+	httpConnectionPool_t* pool;
+	char* path;
+	int delayMs;
+	// Pending events in the order of their first occurrence
+	struct _discoveryEvent* head;
+	struct _discoveryEvent* tail;
+	int shutdown;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static void freeEvent(struct _discoveryEvent* event)
+{
+	free(event->playerId);
+	free(event->deviceId);
+	free(event);
+}
+
+// Length of value as JSON string content
+static size_t jsonStringLength(const char* value)
+{
+	size_t length = 0;
+	for(;*value;value++) {
+		length += (*value == '"' || *value == '\\') ? 2 : (((unsigned char)*value < 0x20) ? 6 : 1);
+	}
+	return length;
+}
+
+static char* appendJsonString(char* p, const char* value)
+{
+	*p++ = '"';
+	for(;*value;value++) {
+		if(*value == '"' || *value == '\\') {
+			*p++ = '\\';
+			*p++ = *value;
+		}else if((unsigned char)*value < 0x20) {
+			p += sprintf(p, "\\u%04x", (unsigned char)*value);
+		}else {
+			*p++ = *value;
+		}
+	}
+	*p++ = '"';
+	return p;
+}
+
+// Serialize the events as JSON array of {"fromDeviceId","fromService","toDeviceId","status"} objects
+static char* createBatch(struct _discoveryEvent* events, size_t* length)
+{
+	size_t size = 3;
+	struct _discoveryEvent* event;
+	for(event=events;event!=NULL;event=event->next) {
+		size += 96+jsonStringLength(event->deviceId)+jsonStringLength(event->playerId)+strlen(event->status);
+	}
+	char* batch = malloc(size);
+	if(batch == NULL) {
+		return NULL;
+	}
+	char* p = batch;
+	*p++ = '[';
+	for(event=events;event!=NULL;event=event->next) {
+		if(event != events) {
+			*p++ = ',';
+		}
+		p += sprintf(p, "{\"fromDeviceId\":");
+		p = appendJsonString(p, event->deviceId);
+		p += sprintf(p, ",\"fromService\":%d,\"toDeviceId\":", event->services);
+		p = appendJsonString(p, event->playerId);
+		p += sprintf(p, ",\"status\":\"%s\"}", event->status);
+	}
+	*p++ = ']';
+	*p = '\0';
+	*length = p-batch;
+	return batch;
+}
+
+static void postEvents(discoveryQueue_t* queue, struct _discoveryEvent* events)
+{
+	size_t length = 0;
+	char* batch = createBatch(events, &length);
+	if(batch != NULL) {
+		loggerPayload(LOGGER_DEBUG, "Forwarding discovery events to", queue->path, batch, length);
+		httpResponse_t response;
+		if(httpPoolPost(queue->pool, queue->path, batch, length, &response) == 0) {
+			if(response.status != 200) {
+				loggerPrintf(LOGGER_WARNING, "Discovery events rejected with status %d",response.status);
+			}
+			httpResponseFree(&response);
+		}
+		free(batch);
+	}
+	while(events != NULL) {
+		struct _discoveryEvent* next = events->next;
+		freeEvent(events);
+		events = next;
+	}
+}
+
+static void* discoveryQueueThread(void* arg)
+{
+	discoveryQueue_t* queue = (discoveryQueue_t*)arg;
+
+	pthread_mutex_lock(&queue->mutex);
+	while(1) {
+		if(queue->head == NULL) {
+			if(queue->shutdown) {
+				break;
+			}
+			pthread_cond_wait(&queue->cond, &queue->mutex);
+			continue;
+		}
+		if(!queue->shutdown && queue->delayMs > 0) {
+			// Give a flapping device the chance to settle so only its final state is posted
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += queue->delayMs/1000;
+			deadline.tv_nsec += (long)(queue->delayMs%1000)*1000000;
+			if(deadline.tv_nsec >= 1000000000) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000;
+			}
+			while(!queue->shutdown && pthread_cond_timedwait(&queue->cond, &queue->mutex, &deadline) == 0) {
+			}
+		}
+		struct _discoveryEvent* events = queue->head;
+		queue->head = NULL;
+		queue->tail = NULL;
+		pthread_mutex_unlock(&queue->mutex);
+
+		postEvents(queue, events);
+
+		pthread_mutex_lock(&queue->mutex);
+	}
+	pthread_mutex_unlock(&queue->mutex);
+	return NULL;
+}
+
+discoveryQueue_t* discoveryQueueCreate(httpConnectionPool_t* pool, const char* path, int delayMs)
+{
+	discoveryQueue_t* queue = malloc(sizeof(discoveryQueue_t));
+	if(queue == NULL) {
+		return NULL;
+	}
+	memset(queue, 0, sizeof(discoveryQueue_t));
+	queue->pool = pool;
+	queue->path = strdup(path);
+	queue->delayMs = delayMs;
+	pthread_mutex_init(&queue->mutex, NULL);
+	pthread_cond_init(&queue->cond, NULL);
+	if(pthread_create(&queue->thread, NULL, discoveryQueueThread, queue) != 0) {
+		loggerPrintf(LOGGER_ERROR, "Unable to create discovery thread");
+		pthread_cond_destroy(&queue->cond);
+		pthread_mutex_destroy(&queue->mutex);
+		free(queue->path);
+		free(queue);
+		return NULL;
+	}
+	return queue;
+}
+
+void discoveryQueueDestroy(discoveryQueue_t* queue)
+{
+	if(queue == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&queue->mutex);
+	queue->shutdown = 1;
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->mutex);
+	pthread_join(queue->thread, NULL);
+
+	pthread_cond_destroy(&queue->cond);
+	pthread_mutex_destroy(&queue->mutex);
+	free(queue->path);
+	free(queue);
+}
+
+int discoveryQueuePush(discoveryQueue_t* queue, const char* playerId, const char* deviceId, int services, const char* status)
+{
+	pthread_mutex_lock(&queue->mutex);
+	struct _discoveryEvent* event;
+	for(event=queue->head;event!=NULL;event=event->next) {
+		if(strcmp(event->deviceId, deviceId) == 0 && strcmp(event->playerId, playerId) == 0) {
+			// Only the latest transition matters, the event keeps its position in the queue
+			event->services = services;
+			event->status = status;
+			pthread_mutex_unlock(&queue->mutex);
+			return 0;
+		}
+	}
+	event = malloc(sizeof(struct _discoveryEvent));
+	if(event == NULL) {
+		pthread_mutex_unlock(&queue->mutex);
+		return -1;
+	}
+	event->playerId = strdup(playerId);
+	event->deviceId = strdup(deviceId);
+	event->services = services;
+	event->status = status;
+	event->next = NULL;
+	if(queue->tail != NULL) {
+		queue->tail->next = event;
+	}else {
+		queue->head = event;
+	}
+	queue->tail = event;
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->mutex);
+	return 0;
+}
@@ -0,0 +1,31 @@
+/*
+ * ickDiscoveryQueue.h
+ *
+ * Forwards discovery events of the player contexts to the IckStreamPlugin
+ * from a separate thread. Pending events for the same player and device are
+ * collapsed and all pending events are posted in one request.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#ifndef __ICKDISCOVERYQUEUE_H
+#define __ICKDISCOVERYQUEUE_H
+
+#include "ickHttpClient.h"
+
+struct _discoveryQueue;
+typedef struct _discoveryQueue discoveryQueue_t;
+
+// Create the queue and its sender thread, events are posted to path (without leading slash) after
+// waiting delayMs for further events
+discoveryQueue_t* discoveryQueueCreate(httpConnectionPool_t* pool, const char* path, int delayMs);
+
+// Post the pending events and free the queue
+void discoveryQueueDestroy(discoveryQueue_t* queue);
+
+// Queue a state change of deviceId as seen by playerId, never blocks on the network.
+// A pending event for the same player and device is replaced, status must be a constant string.
+int discoveryQueuePush(discoveryQueue_t* queue, const char* playerId, const char* deviceId, int services, const char* status);
+
+#endif
@@ -0,0 +1,583 @@
+/*
+ * ickHttpClient.c
+ *
+ * Pool of persistent HTTP/1.1 connections used by the daemons to forward
+ * requests to the IckStreamPlugin inside LMS.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "ickHttpClient.h"
+#include "ickLogger.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define HTTP_READ_SIZE 4096
+
+// Result of reading a response from a connection
+#define HTTP_RESPONSE_OK 1
+#define HTTP_RESPONSE_ERROR -1
+#define HTTP_RESPONSE_STALE -2		// Connection was dropped by the server before it received the request
+
+struct _httpConnection;
+struct _httpConnection {
+	int fd;
+	struct _httpConnection* next;
+};
+
+struct _httpConnectionPool {
+	char* ip;
+	int port;
+	char* authorization;
+	char* userAgent;
+	int maxIdle;
+	int idleCount;
+	struct _httpConnection* idle;
+	pthread_mutex_t mutex;
+};
+
+typedef struct {
+	int fd;
+	char* data;
+	size_t size;
+	size_t pos;
+	size_t len;
+	size_t total;
+	// The server closed the connection
+	int closed;
+} httpReader_t;
+
+static long long monotonicTime(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec*1000000+now.tv_nsec/1000;
+}
+
+httpConnectionPool_t* httpPoolCreate(const char* ip, int port, const char* authorization, const char* userAgent, int maxIdle)
+{
+	httpConnectionPool_t* pool = malloc(sizeof(httpConnectionPool_t));
+	if(pool == NULL) {
+		return NULL;
+	}
+	memset(pool, 0, sizeof(httpConnectionPool_t));
+	pool->ip = strdup(ip);
+	pool->port = port;
+	pool->authorization = authorization != NULL ? strdup(authorization) : NULL;
+	pool->userAgent = strdup(userAgent);
+	pool->maxIdle = maxIdle > 0 ? maxIdle : 1;
+	pthread_mutex_init(&pool->mutex, NULL);
+	return pool;
+}
+
+void httpPoolDestroy(httpConnectionPool_t* pool)
+{
+	if(pool == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&pool->mutex);
+	while(pool->idle != NULL) {
+		struct _httpConnection* conn = pool->idle;
+		pool->idle = conn->next;
+		close(conn->fd);
+		free(conn);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->ip);
+	if(pool->authorization) {
+		free(pool->authorization);
+	}
+	free(pool->userAgent);
+	free(pool);
+}
+
+static int httpConnect(httpConnectionPool_t* pool)
+{
+	struct sockaddr_in server_addr;
+	int server_socket = socket(AF_INET, SOCK_STREAM, 0);
+	if(server_socket < 0) {
+		loggerPrintf(LOGGER_ERROR, "Unable to open socket: %d",server_socket);
+		return -1;
+	}
+
+	memset(&server_addr, 0, sizeof(server_addr));
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_port = htons(pool->port);
+	if(inet_pton(AF_INET,pool->ip,(void *)(&(server_addr.sin_addr.s_addr))) <= 0) {
+		loggerPrintf(LOGGER_ERROR, "Unable to convert string IP to byte IP using inet_pton");
+		close(server_socket);
+		return -1;
+	}
+
+	struct timeval tv;
+	tv.tv_sec = 30;  // 30 Secs Timeout
+	tv.tv_usec = 0;  // Not init'ing this can cause strange errors
+	setsockopt(server_socket,SOL_SOCKET,SO_RCVTIMEO,(char *)&tv,sizeof(struct timeval));
+	int on = 1;
+	setsockopt(server_socket,IPPROTO_TCP,TCP_NODELAY,(char *)&on,sizeof(on));
+#ifdef SO_NOSIGPIPE
+	setsockopt(server_socket,SOL_SOCKET,SO_NOSIGPIPE,(char *)&on,sizeof(on));
+#endif
+
+	if(connect(server_socket, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) {
+		loggerPrintf(LOGGER_ERROR, "Fail to connect to socket: %d",errno);
+		close(server_socket);
+		return -1;
+	}
+	return server_socket;
+}
+
+// Check that the server hasn't closed an idle connection while it was parked in the pool
+static int isConnectionAlive(int fd)
+{
+	char c;
+	int n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	if(n == 0) {
+		return 0;
+	}
+	if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		return 0;
+	}
+	// Data on an idle connection means we are out of sync with the server
+	return n < 0;
+}
+
+static struct _httpConnection* acquireConnection(httpConnectionPool_t* pool, int* reused)
+{
+	struct _httpConnection* conn = NULL;
+
+	pthread_mutex_lock(&pool->mutex);
+	while(pool->idle != NULL && conn == NULL) {
+		conn = pool->idle;
+		pool->idle = conn->next;
+		pool->idleCount--;
+		if(!isConnectionAlive(conn->fd)) {
+			close(conn->fd);
+			free(conn);
+			conn = NULL;
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	if(conn != NULL) {
+		*reused = 1;
+		return conn;
+	}
+
+	*reused = 0;
+	int fd = httpConnect(pool);
+	if(fd < 0) {
+		return NULL;
+	}
+	conn = malloc(sizeof(struct _httpConnection));
+	if(conn == NULL) {
+		loggerPrintf(LOGGER_ERROR, "Error allocating memory for connection via HTTP");
+		close(fd);
+		return NULL;
+	}
+	conn->fd = fd;
+	conn->next = NULL;
+	return conn;
+}
+
+static void releaseConnection(httpConnectionPool_t* pool, struct _httpConnection* conn, int keepAlive)
+{
+	if(keepAlive) {
+		pthread_mutex_lock(&pool->mutex);
+		if(pool->idleCount < pool->maxIdle) {
+			conn->next = pool->idle;
+			pool->idle = conn;
+			pool->idleCount++;
+			conn = NULL;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+	}
+	if(conn != NULL) {
+		close(conn->fd);
+		free(conn);
+	}
+}
+
+static int sendAll(int fd, struct iovec* iov, int iovcnt)
+{
+	while(iovcnt > 0) {
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+		int bytes_sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if(bytes_sent < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		while(iovcnt > 0 && (size_t)bytes_sent >= iov->iov_len) {
+			bytes_sent -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if(iovcnt > 0) {
+			iov->iov_base = (char*)iov->iov_base+bytes_sent;
+			iov->iov_len -= bytes_sent;
+		}
+	}
+	return 0;
+}
+
+static int readerFill(httpReader_t* reader)
+{
+	if(reader->pos == reader->len) {
+		reader->pos = 0;
+		reader->len = 0;
+	}
+	if(reader->len == reader->size) {
+		if(reader->pos > 0) {
+			memmove(reader->data, reader->data+reader->pos, reader->len-reader->pos);
+			reader->len -= reader->pos;
+			reader->pos = 0;
+		}else {
+			size_t size = reader->size > 0 ? reader->size*2 : HTTP_READ_SIZE;
+			char* data = realloc(reader->data, size+1);
+			if(data == NULL) {
+				loggerPrintf(LOGGER_ERROR, "Error allocating memory for response via HTTP");
+				return -1;
+			}
+			reader->data = data;
+			reader->size = size;
+		}
+	}
+	int n;
+	do {
+		n = recv(reader->fd, reader->data+reader->len, reader->size-reader->len, 0);
+	}while(n < 0 && errno == EINTR);
+	if(n > 0) {
+		reader->len += n;
+		reader->total += n;
+	}else if(n == 0) {
+		reader->closed = 1;
+	}
+	return n;
+}
+
+// Returns the next CRLF terminated line as a zero terminated string, only valid until the next read
+static char* readerLine(httpReader_t* reader)
+{
+	size_t searched = 0;
+	while(1) {
+		size_t available = reader->len-reader->pos;
+		char* line = reader->data+reader->pos;
+		char* end = NULL;
+		if(available > searched) {
+			end = memchr(line+searched, '\n', available-searched);
+		}
+		if(end != NULL) {
+			reader->pos = end+1-reader->data;
+			if(end > line && *(end-1) == '\r') {
+				end--;
+			}
+			*end = '\0';
+			return line;
+		}
+		searched = available;
+		if(readerFill(reader) <= 0) {
+			return NULL;
+		}
+	}
+}
+
+// Read exactly length bytes into destination, bytes already buffered are used first
+static int readerRead(httpReader_t* reader, char* destination, size_t length)
+{
+	size_t buffered = reader->len-reader->pos;
+	if(buffered > length) {
+		buffered = length;
+	}
+	if(buffered > 0) {
+		memcpy(destination, reader->data+reader->pos, buffered);
+		reader->pos += buffered;
+	}
+	size_t received = buffered;
+	while(received < length) {
+		int n = recv(reader->fd, destination+received, length-received, 0);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			return -1;
+		}
+		received += n;
+		reader->total += n;
+	}
+	return 0;
+}
+
+// True if the server has acknowledged everything sent on the connection, so it has received the request
+// even if it closed the connection afterwards. Without TCP_INFO this can't be told and true is returned.
+static int isRequestAcknowledged(int fd)
+{
+#if defined(TCP_INFO) && defined(__linux__)
+	struct tcp_info info;
+	socklen_t length = sizeof(info);
+	if(getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &length) == 0) {
+		return info.tcpi_unacked == 0;
+	}
+#endif
+	return 1;
+}
+
+// firstByte is set to the time the status line was received
+static int readResponse(int fd, httpResponse_t* response, int* keepAlive, long long* firstByte)
+{
+	httpReader_t reader;
+	memset(&reader, 0, sizeof(reader));
+	reader.fd = fd;
+	char* body = NULL;
+	size_t bodyLength = 0;
+	long contentLength = -1;
+	int chunked = 0;
+	int result = HTTP_RESPONSE_ERROR;
+
+	*keepAlive = 0;
+	char* line = readerLine(&reader);
+	if(line == NULL) {
+		// The request may only be sent again if the server can't have processed it: it reset the connection,
+		// or closed it without acknowledging the request. A timeout means the server is still busy with it.
+		if(reader.total == 0 && (reader.closed ? !isRequestAcknowledged(fd) : errno == ECONNRESET)) {
+			result = HTTP_RESPONSE_STALE;
+		}else if(!reader.closed) {
+			loggerPrintf(LOGGER_ERROR, "Error reading response via HTTP: %d",errno);
+		}
+		goto readResponse_end;
+	}
+	*firstByte = monotonicTime();
+	if(strncmp(line, "HTTP/1.", 7) != 0) {
+		loggerPrintf(LOGGER_ERROR, "Invalid HTTP response: %s",line);
+		goto readResponse_end;
+	}
+	*keepAlive = line[7] == '1';
+	response->status = atoi(line+8);
+
+	while((line = readerLine(&reader)) != NULL && *line != '\0') {
+		if(strncasecmp(line, "Content-Length:", 15) == 0) {
+			contentLength = strtol(line+15, NULL, 10);
+		}else if(strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+			chunked = strcasestr(line+18, "chunked") != NULL;
+		}else if(strncasecmp(line, "Connection:", 11) == 0) {
+			if(strcasestr(line+11, "close") != NULL) {
+				*keepAlive = 0;
+			}else if(strcasestr(line+11, "keep-alive") != NULL) {
+				*keepAlive = 1;
+			}
+		}
+	}
+	if(line == NULL) {
+		loggerPrintf(LOGGER_ERROR, "Error reading response headers via HTTP: %d",errno);
+		goto readResponse_end;
+	}
+
+	if(chunked) {
+		// Chunks are collected in a separate buffer, LMS normally announces a Content-Length
+		while(1) {
+			line = readerLine(&reader);
+			if(line == NULL) {
+				goto readResponse_end;
+			}
+			size_t chunkSize = strtoul(line, NULL, 16);
+			if(chunkSize == 0) {
+				// Skip trailers
+				while((line = readerLine(&reader)) != NULL && *line != '\0');
+				if(line == NULL) {
+					goto readResponse_end;
+				}
+				break;
+			}
+			char* newBody = realloc(body, bodyLength+chunkSize+1);
+			if(newBody == NULL) {
+				loggerPrintf(LOGGER_ERROR, "Error allocating memory for response via HTTP");
+				goto readResponse_end;
+			}
+			body = newBody;
+			if(readerRead(&reader, body+bodyLength, chunkSize) < 0) {
+				goto readResponse_end;
+			}
+			bodyLength += chunkSize;
+			if(readerLine(&reader) == NULL) {
+				goto readResponse_end;
+			}
+		}
+		if(body == NULL) {
+			body = malloc(1);
+			if(body == NULL) {
+				loggerPrintf(LOGGER_ERROR, "Error allocating memory for response via HTTP");
+				goto readResponse_end;
+			}
+		}
+		body[bodyLength] = '\0';
+		response->buffer = body;
+		response->body = body;
+		response->bodyLength = bodyLength;
+		body = NULL;
+	}else {
+		if(contentLength >= 0) {
+			// Grow the receive buffer once so the body is read directly behind the headers
+			size_t required = reader.pos+contentLength;
+			if(required > reader.size) {
+				char* data = realloc(reader.data, required+1);
+				if(data == NULL) {
+					loggerPrintf(LOGGER_ERROR, "Error allocating memory for response via HTTP");
+					goto readResponse_end;
+				}
+				reader.data = data;
+				reader.size = required;
+			}
+			while(reader.len < required) {
+				int n = recv(fd, reader.data+reader.len, required-reader.len, 0);
+				if(n < 0 && errno == EINTR) {
+					continue;
+				}
+				if(n <= 0) {
+					loggerPrintf(LOGGER_ERROR, "Error reading response via HTTP: %d",errno);
+					goto readResponse_end;
+				}
+				reader.len += n;
+			}
+			// Anything left in the buffer means the server is out of sync with us
+			if(reader.len != required) {
+				*keepAlive = 0;
+			}
+			bodyLength = contentLength;
+		}else {
+			// No framing information, the body ends when the server closes the connection
+			*keepAlive = 0;
+			int n;
+			while((n = readerFill(&reader)) > 0);
+			if(n < 0) {
+				loggerPrintf(LOGGER_ERROR, "Error reading response via HTTP: %d",errno);
+			}
+			bodyLength = reader.len-reader.pos;
+		}
+		reader.data[reader.pos+bodyLength] = '\0';
+		response->buffer = reader.data;
+		response->body = reader.data+reader.pos;
+		response->bodyLength = bodyLength;
+		reader.data = NULL;
+	}
+	result = HTTP_RESPONSE_OK;
+
+readResponse_end:
+	if(result != HTTP_RESPONSE_OK) {
+		*keepAlive = 0;
+	}
+	if(body != NULL) {
+		free(body);
+	}
+	if(reader.data != NULL) {
+		free(reader.data);
+	}
+	return result;
+}
+
+int httpPoolPost(httpConnectionPool_t* pool, const char* path, const char* requestData, size_t requestLength, httpResponse_t* response)
+{
+	memset(response, 0, sizeof(httpResponse_t));
+
+	size_t headerSize = strlen(path)+strlen(pool->ip)+strlen(pool->userAgent)+200;
+	if(pool->authorization != NULL) {
+		headerSize += strlen(pool->authorization);
+	}
+	char* header = malloc(headerSize);
+	if(header == NULL) {
+		loggerPrintf(LOGGER_ERROR, "Error allocating memory for request via HTTP");
+		return -1;
+	}
+	int headerLength;
+	if(pool->authorization != NULL) {
+		headerLength = snprintf(header,headerSize,"POST /%s HTTP/1.1\r\nHost: %s\r\nAuthorization: Basic %s\r\nX-Scanner: 1\r\nUser-Agent: %s\r\nConnection: keep-alive\r\nContent-Type: application/json\r\nContent-Length: %lu\r\n\r\n",
+				path,pool->ip,pool->authorization,pool->userAgent,(unsigned long)requestLength);
+	}else {
+		headerLength = snprintf(header,headerSize,"POST /%s HTTP/1.1\r\nHost: %s\r\nUser-Agent: %s\r\nConnection: keep-alive\r\nContent-Type: application/json\r\nContent-Length: %lu\r\n\r\n",
+				path,pool->ip,pool->userAgent,(unsigned long)requestLength);
+	}
+
+	int result = -1;
+	int attempt;
+	for(attempt=0;attempt<2 && result < 0;attempt++) {
+		int reused = 0;
+		long long started = monotonicTime();
+		struct _httpConnection* conn = acquireConnection(pool, &reused);
+		long long connected = monotonicTime();
+		if(!reused) {
+			response->connectTime += connected-started;
+		}
+		if(conn == NULL) {
+			break;
+		}
+		// Headers and body are sent straight from where they are, the body is never copied
+		struct iovec iov[2];
+		iov[0].iov_base = header;
+		iov[0].iov_len = headerLength;
+		iov[1].iov_base = (void*)requestData;
+		iov[1].iov_len = requestLength;
+		if(sendAll(conn->fd, iov, 2) < 0) {
+			int error = errno;
+			loggerPrintf(LOGGER_ERROR, "Error when forwarding request data: %d",error);
+			releaseConnection(pool, conn, 0);
+			// Only a connection the server had already closed is retried
+			if(reused && (error == EPIPE || error == ECONNRESET)) {
+				continue;
+			}
+			break;
+		}
+
+		long long sent = monotonicTime();
+		response->sendTime += sent-connected;
+
+		int keepAlive = 0;
+		long long firstByte = 0;
+		int rc = readResponse(conn->fd, response, &keepAlive, &firstByte);
+		if(firstByte > 0) {
+			response->firstByteTime += firstByte-sent;
+			response->readTime += monotonicTime()-firstByte;
+		}else {
+			response->firstByteTime += monotonicTime()-sent;
+		}
+		releaseConnection(pool, conn, keepAlive);
+		if(rc == HTTP_RESPONSE_STALE && reused) {
+			// The server dropped the keep-alive connection before it got the request, retry on a new one
+			continue;
+		}
+		if(rc != HTTP_RESPONSE_OK) {
+			break;
+		}
+		result = 0;
+	}
+	free(header);
+	return result;
+}
+
+void httpResponseFree(httpResponse_t* response)
+{
+	if(response->buffer != NULL) {
+		free(response->buffer);
+	}
+	memset(response, 0, sizeof(httpResponse_t));
+}
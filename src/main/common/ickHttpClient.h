@@ -0,0 +1,45 @@
+/*
+ * ickHttpClient.h
+ *
+ * Pool of persistent HTTP/1.1 connections used by the daemons to forward
+ * requests to the IckStreamPlugin inside LMS.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#ifndef __ICKHTTPCLIENT_H
+#define __ICKHTTPCLIENT_H
+
+#include <stddef.h>
+
+struct _httpConnectionPool;
+typedef struct _httpConnectionPool httpConnectionPool_t;
+
+// Create a pool for the given server, at most maxIdle connections are kept open between requests
+httpConnectionPool_t* httpPoolCreate(const char* ip, int port, const char* authorization, const char* userAgent, int maxIdle);
+
+// Close all idle connections and free the pool
+void httpPoolDestroy(httpConnectionPool_t* pool);
+
+typedef struct {
+	int status;
+	// Zero terminated body, points into buffer
+	const char* body;
+	size_t bodyLength;
+	char* buffer;
+	// Microseconds spent in each stage of the request, connectTime is 0 when a pooled connection was used
+	long long connectTime;
+	long long sendTime;
+	long long firstByteTime;
+	long long readTime;
+} httpResponse_t;
+
+// POST requestData to path (without leading slash), returns 0 and fills response on success which must be
+// released with httpResponseFree. A keep-alive connection the server dropped before receiving the request is
+// reopened transparently, a request the server may have received is never sent twice.
+int httpPoolPost(httpConnectionPool_t* pool, const char* path, const char* requestData, size_t requestLength, httpResponse_t* response);
+
+void httpResponseFree(httpResponse_t* response);
+
+#endif
@@ -0,0 +1,220 @@
+/*
+ * ickHttpParser.c
+ *
+ * Incremental parser for HTTP/1.1 requests received by the daemons. The
+ * request is kept in a single buffer and headers are parsed in place.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "ickHttpParser.h"
+
+#define HTTP_PARSER_INITIAL_SIZE 4096
+#define HTTP_PARSER_MIN_READ 1024
+
+void httpParserInit(httpParser_t* parser)
+{
+	memset(parser, 0, sizeof(httpParser_t));
+	parser->state = HTTP_PARSER_HEADERS;
+}
+
+void httpParserFree(httpParser_t* parser)
+{
+	if(parser->buffer != NULL) {
+		free(parser->buffer);
+	}
+	httpParserInit(parser);
+}
+
+static int httpParserResize(httpParser_t* parser, size_t size)
+{
+	// One extra byte so the content can always be zero terminated
+	char* buffer = realloc(parser->buffer, size+1);
+	if(buffer == NULL) {
+		parser->state = HTTP_PARSER_ERROR;
+		parser->error = "500 Internal Server Error";
+		return -1;
+	}
+	parser->buffer = buffer;
+	parser->size = size;
+	return 0;
+}
+
+char* httpParserBuffer(httpParser_t* parser, size_t* available)
+{
+	if(parser->state == HTTP_PARSER_HEADERS && parser->size-parser->length < HTTP_PARSER_MIN_READ) {
+		httpParserResize(parser, parser->size > 0 ? parser->size*2 : HTTP_PARSER_INITIAL_SIZE);
+	}
+	if(parser->state != HTTP_PARSER_HEADERS && parser->state != HTTP_PARSER_BODY) {
+		*available = 0;
+		return NULL;
+	}
+	*available = parser->size-parser->length;
+	return parser->buffer+parser->length;
+}
+
+static char* skipSpaces(char* p)
+{
+	while(*p == ' ' || *p == '\t') {
+		p++;
+	}
+	return p;
+}
+
+// Split the header block in place, end is the offset of the empty line terminating the headers
+static int parseHeaderBlock(httpParser_t* parser, size_t end)
+{
+	char* buffer = parser->buffer;
+	buffer[end] = '\0';
+
+	char* line = buffer;
+	char* next = strchr(line, '\n');
+	if(next != NULL) {
+		*next++ = '\0';
+	}
+
+	// Request line: METHOD SP PATH SP PROTOCOL
+	char* p = line;
+	parser->methodOffset = p-buffer;
+	p = strchr(p, ' ');
+	if(p == NULL) {
+		return -1;
+	}
+	*p++ = '\0';
+	p = skipSpaces(p);
+	parser->pathOffset = p-buffer;
+	p = strchr(p, ' ');
+	if(p != NULL) {
+		*p++ = '\0';
+		p = skipSpaces(p);
+		parser->protocolOffset = p-buffer;
+		p[strcspn(p, "\r ")] = '\0';
+	}else {
+		// Request line without protocol, let it point to the end of the path
+		char* path = buffer+parser->pathOffset;
+		path[strcspn(path, "\r")] = '\0';
+		parser->protocolOffset = parser->pathOffset+strlen(path);
+	}
+
+	parser->headerCount = 0;
+	while(next != NULL) {
+		line = next;
+		next = strchr(line, '\n');
+		if(next != NULL) {
+			*next++ = '\0';
+		}
+		char* colon = strchr(line, ':');
+		if(colon == NULL) {
+			continue;
+		}
+		if(parser->headerCount == HTTP_PARSER_MAX_HEADERS) {
+			return -1;
+		}
+		*colon = '\0';
+		char* value = skipSpaces(colon+1);
+		char* valueEnd = value+strlen(value);
+		while(valueEnd > value && (*(valueEnd-1) == '\r' || *(valueEnd-1) == ' ' || *(valueEnd-1) == '\t')) {
+			valueEnd--;
+		}
+		*valueEnd = '\0';
+		parser->headerOffsets[parser->headerCount].name = line-buffer;
+		parser->headerOffsets[parser->headerCount].value = value-buffer;
+		parser->headerCount++;
+	}
+	return 0;
+}
+
+static const char* headerValue(httpParser_t* parser, const char* name)
+{
+	int i;
+	for(i=0;i<parser->headerCount;i++) {
+		if(strcasecmp(parser->buffer+parser->headerOffsets[i].name, name) == 0) {
+			return parser->buffer+parser->headerOffsets[i].value;
+		}
+	}
+	return NULL;
+}
+
+static httpParserState_t httpParserError(httpParser_t* parser, const char* error)
+{
+	parser->state = HTTP_PARSER_ERROR;
+	parser->error = error;
+	return parser->state;
+}
+
+httpParserState_t httpParserConsume(httpParser_t* parser, size_t length)
+{
+	if(parser->state != HTTP_PARSER_HEADERS && parser->state != HTTP_PARSER_BODY) {
+		return parser->state;
+	}
+	parser->length += length;
+	parser->buffer[parser->length] = '\0';
+
+	if(parser->state == HTTP_PARSER_HEADERS) {
+		// Only scan what hasn't been scanned before, the terminator might span two reads
+		size_t start = parser->scanned > 3 ? parser->scanned-3 : 0;
+		char* end = strstr(parser->buffer+start, "\r\n\r\n");
+		if(end == NULL) {
+			parser->scanned = parser->length;
+			if(parser->length > HTTP_PARSER_MAX_HEADER_SIZE) {
+				return httpParserError(parser, "431 Request Header Fields Too Large");
+			}
+			return parser->state;
+		}
+		size_t headerEnd = end-parser->buffer;
+		parser->bodyOffset = headerEnd+4;
+		if(parseHeaderBlock(parser, headerEnd) < 0) {
+			return httpParserError(parser, "400 Bad Request");
+		}
+
+		const char* transferEncoding = headerValue(parser, "Transfer-Encoding");
+		if(transferEncoding != NULL && strcasecmp(transferEncoding, "identity") != 0) {
+			return httpParserError(parser, "411 Length Required");
+		}
+		const char* contentLength = headerValue(parser, "Content-Length");
+		if(contentLength != NULL) {
+			char* contentLengthEnd = NULL;
+			long value = strtol(contentLength, &contentLengthEnd, 10);
+			if(contentLengthEnd == contentLength || value < 0) {
+				return httpParserError(parser, "400 Bad Request");
+			}
+			if(value > HTTP_PARSER_MAX_BODY_SIZE) {
+				return httpParserError(parser, "413 Request Entity Too Large");
+			}
+			parser->contentLength = value;
+		}
+
+		// Size the buffer for the complete body so it's received without further copying
+		if(parser->bodyOffset+parser->contentLength > parser->size) {
+			if(httpParserResize(parser, parser->bodyOffset+parser->contentLength) < 0) {
+				return parser->state;
+			}
+		}
+		parser->state = HTTP_PARSER_BODY;
+	}
+
+	if(parser->state == HTTP_PARSER_BODY && parser->length >= parser->bodyOffset+parser->contentLength) {
+		// Anything after the announced body is ignored, connections are not reused
+		parser->length = parser->bodyOffset+parser->contentLength;
+		parser->buffer[parser->length] = '\0';
+		parser->method = parser->buffer+parser->methodOffset;
+		parser->path = parser->buffer+parser->pathOffset;
+		parser->protocol = parser->buffer+parser->protocolOffset;
+		parser->body = parser->buffer+parser->bodyOffset;
+		parser->state = HTTP_PARSER_DONE;
+	}
+	return parser->state;
+}
+
+const char* httpParserHeader(httpParser_t* parser, const char* name)
+{
+	if(parser->state != HTTP_PARSER_DONE) {
+		return NULL;
+	}
+	return headerValue(parser, name);
+}
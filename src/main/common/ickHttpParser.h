@@ -0,0 +1,70 @@
+/*
+ * ickHttpParser.h
+ *
+ * Incremental parser for HTTP/1.1 requests received by the daemons. The
+ * request is kept in a single buffer and headers are parsed in place.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#ifndef __ICKHTTPPARSER_H
+#define __ICKHTTPPARSER_H
+
+#include <stddef.h>
+
+#define HTTP_PARSER_MAX_HEADERS 32
+#define HTTP_PARSER_MAX_HEADER_SIZE 65536
+#define HTTP_PARSER_MAX_BODY_SIZE (64*1024*1024)
+
+typedef enum {
+	HTTP_PARSER_HEADERS,
+	HTTP_PARSER_BODY,
+	HTTP_PARSER_DONE,
+	HTTP_PARSER_ERROR
+} httpParserState_t;
+
+typedef struct {
+	size_t name;
+	size_t value;
+} httpParserHeader_t;
+
+typedef struct {
+	httpParserState_t state;
+	// HTTP status to answer with when state is HTTP_PARSER_ERROR
+	const char* error;
+
+	char* buffer;
+	size_t size;
+	size_t length;
+	size_t scanned;
+
+	// Offsets into buffer, resolved to the pointers below when the request is complete
+	size_t methodOffset;
+	size_t pathOffset;
+	size_t protocolOffset;
+	httpParserHeader_t headerOffsets[HTTP_PARSER_MAX_HEADERS];
+	int headerCount;
+	size_t bodyOffset;
+	size_t contentLength;
+
+	// Only valid when state is HTTP_PARSER_DONE, they point into buffer and are zero terminated
+	char* method;
+	char* path;
+	char* protocol;
+	char* body;
+} httpParser_t;
+
+void httpParserInit(httpParser_t* parser);
+void httpParserFree(httpParser_t* parser);
+
+// Returns where the next received data should be written, available is set to the free space
+char* httpParserBuffer(httpParser_t* parser, size_t* available);
+
+// Account for length bytes written to the buffer returned by httpParserBuffer and parse them
+httpParserState_t httpParserConsume(httpParser_t* parser, size_t length);
+
+// Returns the value of a header in a complete request or NULL, the name is matched case insensitive
+const char* httpParserHeader(httpParser_t* parser, const char* name);
+
+#endif
@@ -0,0 +1,401 @@
+/*
+ * ickLogger.c
+ *
+ * Asynchronous log of the daemons. Lines are formatted by the calling thread
+ * into a lock-free ring buffer and written to the log file by a background
+ * thread, which also rotates the file when it grows too large.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include "ickLogger.h"
+
+// Number of lines buffered, must be a power of two
+#define LOGGER_SLOTS 512
+// Lines up to this length are stored in the slot, longer ones are allocated
+#define LOGGER_LINE 384
+// Lines are collected into one write of at most this size
+#define LOGGER_BATCH 65536
+// Time the writer sleeps when the buffer is empty, in microseconds
+#define LOGGER_IDLE_INTERVAL 20000
+
+struct _loggerSlot {
+	// Bounded queue of Dmitry Vyukov: the slot is free for position p when sequence is p and filled when it is p+1
+	unsigned long sequence;
+	size_t length;
+	// Set when the line didn't fit into text
+	char* data;
+	char text[LOGGER_LINE];
+};
+
+static const char* levelNames[] = { "ERROR", "WARN ", "INFO ", "DEBUG" };
+static const char* levelOptions[] = { "error", "warning", "info", "debug" };
+
+static loggerOptions_t options = { LOGGER_INFO, 512, 1, 200, 1024*1024 };
+static char* logPath = NULL;
+static int running = 0;
+static int stopping = 0;
+static pthread_t writer;
+static struct _loggerSlot slots[LOGGER_SLOTS];
+static unsigned long enqueuePosition = 0;
+static unsigned long dequeuePosition = 0;
+static unsigned long payloadCounter = 0;
+static long rateSecond = 0;
+static unsigned long rateCount = 0;
+static unsigned long suppressed = 0;
+static unsigned long dropped = 0;
+
+void loggerDefaultOptions(loggerOptions_t* defaults)
+{
+	defaults->level = LOGGER_INFO;
+	defaults->payloadLimit = 512;
+	defaults->payloadSampling = 1;
+	defaults->rateLimit = 200;
+	defaults->rotateSize = 1024*1024;
+}
+
+int loggerParseOption(loggerOptions_t* parsed, int option, const char* value)
+{
+	switch(option) {
+		case 'L': {
+			int level;
+			for(level=LOGGER_ERROR;level<=LOGGER_DEBUG;level++) {
+				if(strcasecmp(value, levelOptions[level]) == 0) {
+					parsed->level = level;
+					return 1;
+				}
+			}
+			level = atoi(value);
+			parsed->level = level < LOGGER_ERROR ? LOGGER_ERROR : (level > LOGGER_DEBUG ? LOGGER_DEBUG : level);
+			return 1;
+		}
+		case 'T':
+			parsed->payloadLimit = atoi(value) > 0 ? atoi(value) : 0;
+			return 1;
+		case 'S':
+			parsed->payloadSampling = atoi(value) > 1 ? atoi(value) : 1;
+			return 1;
+		case 'R':
+			parsed->rateLimit = atoi(value) > 0 ? atoi(value) : 0;
+			return 1;
+		case 'Z':
+			parsed->rotateSize = atoi(value) > 0 ? (size_t)atoi(value)*1024 : 0;
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+int loggerEnabled(loggerLevel_t level)
+{
+	return level <= options.level;
+}
+
+// Errors and warnings are never dropped, everything else is limited to rateLimit lines per second
+static int rateLimited(loggerLevel_t level)
+{
+	if(options.rateLimit <= 0 || level <= LOGGER_WARNING) {
+		return 0;
+	}
+	long now = (long)time(NULL);
+	long second = __atomic_load_n(&rateSecond, __ATOMIC_RELAXED);
+	if(now != second && __atomic_compare_exchange_n(&rateSecond, &second, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&rateCount, 0, __ATOMIC_RELAXED);
+	}
+	if(__atomic_add_fetch(&rateCount, 1, __ATOMIC_RELAXED) > (unsigned long)options.rateLimit) {
+		__atomic_add_fetch(&suppressed, 1, __ATOMIC_RELAXED);
+		return 1;
+	}
+	return 0;
+}
+
+// Format a complete line including timestamp, level and newline, returns its length like snprintf
+static size_t formatLine(char* buffer, size_t size, loggerLevel_t level, const char* format, va_list args)
+{
+	// The timestamp only changes once a second, formatting it is cached per thread
+	static __thread time_t stampSecond = 0;
+	static __thread char stamp[32];
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	if(now.tv_sec != stampSecond) {
+		struct tm local;
+		localtime_r(&now.tv_sec, &local);
+		strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+		stampSecond = now.tv_sec;
+	}
+	int header = snprintf(buffer, size, "%s.%03d %s ", stamp, (int)(now.tv_usec/1000), levelNames[level]);
+	size_t length = header;
+	int body = vsnprintf(length < size ? buffer+length : NULL, length < size ? size-length : 0, format, args);
+	length += body > 0 ? body : 0;
+	if(length+1 < size) {
+		buffer[length] = '\n';
+		buffer[length+1] = '\0';
+	}
+	return length+1;
+}
+
+static size_t formatLinef(char* buffer, size_t size, loggerLevel_t level, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	size_t length = formatLine(buffer, size, level, format, args);
+	va_end(args);
+	return length;
+}
+
+static void submit(loggerLevel_t level, const char* format, va_list args)
+{
+	va_list copy;
+	if(!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+		// Not started yet, the line is written directly
+		char line[LOGGER_LINE];
+		va_copy(copy, args);
+		size_t length = formatLine(line, sizeof(line), level, format, copy);
+		va_end(copy);
+		char* data = line;
+		if(length >= sizeof(line)) {
+			data = malloc(length+1);
+			va_copy(copy, args);
+			formatLine(data, length+1, level, format, copy);
+			va_end(copy);
+		}
+		fwrite(data, 1, length, stdout);
+		fflush(stdout);
+		if(data != line) {
+			free(data);
+		}
+		return;
+	}
+
+	unsigned long position = __atomic_load_n(&enqueuePosition, __ATOMIC_RELAXED);
+	struct _loggerSlot* slot;
+	while(1) {
+		slot = &slots[position & (LOGGER_SLOTS-1)];
+		unsigned long sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		long difference = (long)(sequence-position);
+		if(difference == 0) {
+			if(__atomic_compare_exchange_n(&enqueuePosition, &position, position+1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		}else if(difference < 0) {
+			// The writer can't keep up, the line is dropped instead of blocking the caller
+			__atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}else {
+			position = __atomic_load_n(&enqueuePosition, __ATOMIC_RELAXED);
+		}
+	}
+
+	va_copy(copy, args);
+	slot->length = formatLine(slot->text, LOGGER_LINE, level, format, copy);
+	va_end(copy);
+	slot->data = NULL;
+	if(slot->length >= LOGGER_LINE) {
+		slot->data = malloc(slot->length+1);
+		if(slot->data != NULL) {
+			va_copy(copy, args);
+			formatLine(slot->data, slot->length+1, level, format, copy);
+			va_end(copy);
+		}else {
+			slot->length = LOGGER_LINE-1;
+			slot->text[LOGGER_LINE-2] = '\n';
+		}
+	}
+	__atomic_store_n(&slot->sequence, position+1, __ATOMIC_RELEASE);
+}
+
+void loggerPrintf(loggerLevel_t level, const char* format, ...)
+{
+	if(!loggerEnabled(level) || rateLimited(level)) {
+		return;
+	}
+	va_list args;
+	va_start(args, format);
+	submit(level, format, args);
+	va_end(args);
+}
+
+void loggerPayload(loggerLevel_t level, const char* direction, const char* deviceId, const char* payload, size_t length)
+{
+	if(!loggerEnabled(level)) {
+		return;
+	}
+	if(options.payloadSampling > 1 && __atomic_fetch_add(&payloadCounter, 1, __ATOMIC_RELAXED) % options.payloadSampling != 0) {
+		return;
+	}
+	if(payload == NULL) {
+		payload = "";
+		length = 0;
+	}
+	if(options.payloadLimit > 0 && length > options.payloadLimit) {
+		loggerPrintf(level, "%s %s: %.*s... (%lu bytes)", direction, deviceId != NULL ? deviceId : "*", (int)options.payloadLimit, payload, (unsigned long)length);
+	}else {
+		loggerPrintf(level, "%s %s: %.*s", direction, deviceId != NULL ? deviceId : "*", (int)length, payload);
+	}
+}
+
+static void writeAll(const char* data, size_t length)
+{
+	while(length > 0) {
+		ssize_t n = write(STDOUT_FILENO, data, length);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			return;
+		}
+		data += n;
+		length -= n;
+	}
+}
+
+// Append a line about discarded lines to the batch
+static size_t reportDiscarded(char* batch, size_t length, unsigned long* counter, const char* reason)
+{
+	unsigned long count = __atomic_exchange_n(counter, 0, __ATOMIC_RELAXED);
+	if(count == 0) {
+		return length;
+	}
+	if(length+LOGGER_LINE > LOGGER_BATCH) {
+		writeAll(batch, length);
+		length = 0;
+	}
+	return length+formatLinef(batch+length, LOGGER_LINE, LOGGER_WARNING, "%lu lines %s", count, reason);
+}
+
+// Write all lines in the buffer, returns the number of lines written
+static unsigned long drain(char* batch, int stop)
+{
+	// Discarded lines are reported at most once a second, the report would otherwise be flooded too
+	static time_t reported = 0;
+	unsigned long lines = 0;
+	size_t length = 0;
+	while(1) {
+		struct _loggerSlot* slot = &slots[dequeuePosition & (LOGGER_SLOTS-1)];
+		unsigned long sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		if(sequence != dequeuePosition+1) {
+			break;
+		}
+		const char* data = slot->data != NULL ? slot->data : slot->text;
+		if(length+slot->length > LOGGER_BATCH) {
+			writeAll(batch, length);
+			length = 0;
+		}
+		if(slot->length > LOGGER_BATCH) {
+			writeAll(data, slot->length);
+		}else {
+			memcpy(batch+length, data, slot->length);
+			length += slot->length;
+		}
+		free(slot->data);
+		slot->data = NULL;
+		__atomic_store_n(&slot->sequence, dequeuePosition+LOGGER_SLOTS, __ATOMIC_RELEASE);
+		dequeuePosition++;
+		lines++;
+	}
+	time_t now = time(NULL);
+	if(now != reported || stop) {
+		length = reportDiscarded(batch, length, &dropped, "dropped, log buffer full");
+		length = reportDiscarded(batch, length, &suppressed, "suppressed by rate limit");
+		reported = now;
+	}
+	if(length > 0) {
+		writeAll(batch, length);
+	}
+	return lines;
+}
+
+// Move the log file to <logFile>.1 when it has grown too large, devices like /dev/null are never rotated
+static void rotate(void)
+{
+	struct stat status;
+	if(options.rotateSize == 0 || logPath == NULL || fstat(STDOUT_FILENO, &status) != 0 || !S_ISREG(status.st_mode) || (size_t)status.st_size < options.rotateSize) {
+		return;
+	}
+	char* backup = malloc(strlen(logPath)+3);
+	sprintf(backup, "%s.1", logPath);
+	rename(logPath, backup);
+	free(backup);
+	int fd = open(logPath, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND, 0644);
+	if(fd != -1) {
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		close(fd);
+	}
+}
+
+static void* writerThread(void* arg)
+{
+	char* batch = malloc(LOGGER_BATCH+LOGGER_LINE);
+	while(1) {
+		int stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+		if(drain(batch, stop) > 0) {
+			rotate();
+		}else if(stop) {
+			break;
+		}else {
+			usleep(LOGGER_IDLE_INTERVAL);
+		}
+	}
+	free(batch);
+	return NULL;
+}
+
+int loggerStart(const char* logFile, const loggerOptions_t* startOptions)
+{
+	if(startOptions != NULL) {
+		options = *startOptions;
+	}
+	int result = 0;
+	int fd = open(logFile, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND, 0644);
+	if(fd != -1) {
+		fflush(stdout);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		close(fd);
+		logPath = strdup(logFile);
+	}else {
+		result = -1;
+	}
+
+	int i;
+	for(i=0;i<LOGGER_SLOTS;i++) {
+		slots[i].sequence = i;
+		slots[i].data = NULL;
+	}
+	enqueuePosition = 0;
+	dequeuePosition = 0;
+	stopping = 0;
+	if(pthread_create(&writer, NULL, writerThread, NULL) != 0) {
+		loggerPrintf(LOGGER_ERROR, "Unable to create log writer thread, logging synchronously");
+		return -1;
+	}
+	__atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+	return result;
+}
+
+void loggerStop(void)
+{
+	if(!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	// Lines logged from now on are written directly, the writer drains what is left in the buffer
+	__atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+	pthread_join(writer, NULL);
+	free(logPath);
+	logPath = NULL;
+}
@@ -0,0 +1,59 @@
+/*
+ * ickLogger.h
+ *
+ * Asynchronous log of the daemons. Lines are formatted by the calling thread
+ * into a lock-free ring buffer and written to the log file by a background
+ * thread, which also rotates the file when it grows too large.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#ifndef __ICKLOGGER_H
+#define __ICKLOGGER_H
+
+#include <stddef.h>
+
+typedef enum {
+	LOGGER_ERROR,
+	LOGGER_WARNING,
+	LOGGER_INFO,
+	LOGGER_DEBUG
+} loggerLevel_t;
+
+typedef struct {
+	loggerLevel_t level;
+	// Payloads are truncated to this many bytes, 0 logs them completely
+	size_t payloadLimit;
+	// Only every n-th payload is logged
+	int payloadSampling;
+	// Lines per second beyond which info and debug lines are dropped, 0 is unlimited
+	int rateLimit;
+	// The log file is moved to <logFile>.1 when it grows beyond this, 0 never rotates
+	size_t rotateSize;
+} loggerOptions_t;
+
+// Command line options understood by loggerParseOption, to be appended to the getopt string of a daemon
+#define LOGGER_GETOPT "L:T:S:R:Z:"
+#define LOGGER_USAGE "[-L error|warning|info|debug] [-T payloadBytes] [-S payloadSampling] [-R linesPerSecond] [-Z rotateSizeKB]"
+
+void loggerDefaultOptions(loggerOptions_t* options);
+
+// Apply a command line option, returns 0 if it isn't one of LOGGER_GETOPT
+int loggerParseOption(loggerOptions_t* options, int option, const char* value);
+
+// Open the log file and start the writer thread, stdout and stderr are redirected to the log file.
+// Until then all lines are written directly to stdout.
+int loggerStart(const char* logFile, const loggerOptions_t* options);
+
+// Write everything still buffered and stop the writer thread
+void loggerStop(void);
+
+int loggerEnabled(loggerLevel_t level);
+
+void loggerPrintf(loggerLevel_t level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+// Log a message exchanged with deviceId as "<direction> <deviceId>: <payload>", truncated and sampled according to the options
+void loggerPayload(loggerLevel_t level, const char* direction, const char* deviceId, const char* payload, size_t length);
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ * ickNotificationCoalescer.c
+ *
+ * Delays notifications of selected methods for a short window so that a
+ * burst of notifications from one player results in a single message
+ * containing the newest state.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "ickNotificationCoalescer.h"
+#include "ickLogger.h"
+
+#define COALESCER_MAX_METHODS 16
+
+struct _pendingNotification;
+struct _pendingNotification {
+	char* playerId;
+	// Index into the configured methods
+	int method;
+	char* message;
+	size_t messageLength;
+	struct timespec deadline;
+	struct _pendingNotification* next;
+};
+
+struct _notificationCoalescer {
+	int windowMs;
+	char* methods[COALESCER_MAX_METHODS];
+	int methodCount;
+	coalescerFlushCb_t callback;
+	// Ordered by deadline, all notifications have the same window
+	struct _pendingNotification* head;
+	struct _pendingNotification* tail;
+	int shutdown;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static void freeNotification(struct _pendingNotification* notification)
+{
+	free(notification->playerId);
+	free(notification->message);
+	free(notification);
+}
+
+static int isDue(const struct timespec* deadline, const struct timespec* now)
+{
+	return deadline->tv_sec < now->tv_sec || (deadline->tv_sec == now->tv_sec && deadline->tv_nsec <= now->tv_nsec);
+}
+
+static void* coalescerThread(void* arg)
+{
+	notificationCoalescer_t* coalescer = (notificationCoalescer_t*)arg;
+
+	pthread_mutex_lock(&coalescer->mutex);
+	while(1) {
+		if(coalescer->head == NULL) {
+			if(coalescer->shutdown) {
+				break;
+			}
+			pthread_cond_wait(&coalescer->cond, &coalescer->mutex);
+			continue;
+		}
+		struct _pendingNotification* notification = coalescer->head;
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		if(!coalescer->shutdown && !isDue(&notification->deadline, &now)) {
+			pthread_cond_timedwait(&coalescer->cond, &coalescer->mutex, &notification->deadline);
+			continue;
+		}
+		coalescer->head = notification->next;
+		if(coalescer->tail == notification) {
+			coalescer->tail = NULL;
+		}
+		pthread_mutex_unlock(&coalescer->mutex);
+
+		coalescer->callback(notification->playerId, notification->message, notification->messageLength);
+		freeNotification(notification);
+
+		pthread_mutex_lock(&coalescer->mutex);
+	}
+	pthread_mutex_unlock(&coalescer->mutex);
+	return NULL;
+}
+
+notificationCoalescer_t* coalescerCreate(int windowMs, const char* methods, coalescerFlushCb_t callback)
+{
+	if(windowMs <= 0 || methods == NULL) {
+		return NULL;
+	}
+	notificationCoalescer_t* coalescer = malloc(sizeof(notificationCoalescer_t));
+	if(coalescer == NULL) {
+		return NULL;
+	}
+	memset(coalescer, 0, sizeof(notificationCoalescer_t));
+	coalescer->windowMs = windowMs;
+	coalescer->callback = callback;
+
+	char* list = strdup(methods);
+	char* strtokContext = NULL;
+	char* method = strtok_r(list, ", ", &strtokContext);
+	while(method != NULL && coalescer->methodCount < COALESCER_MAX_METHODS) {
+		coalescer->methods[coalescer->methodCount++] = strdup(method);
+		method = strtok_r(NULL, ", ", &strtokContext);
+	}
+	free(list);
+
+	pthread_mutex_init(&coalescer->mutex, NULL);
+	pthread_cond_init(&coalescer->cond, NULL);
+	if(pthread_create(&coalescer->thread, NULL, coalescerThread, coalescer) != 0) {
+		loggerPrintf(LOGGER_ERROR, "Unable to create coalescer thread");
+		coalescer->shutdown = 1;
+		coalescerDestroy(coalescer);
+		return NULL;
+	}
+	return coalescer;
+}
+
+void coalescerDestroy(notificationCoalescer_t* coalescer)
+{
+	if(coalescer == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&coalescer->mutex);
+	int running = !coalescer->shutdown;
+	coalescer->shutdown = 1;
+	pthread_cond_signal(&coalescer->cond);
+	pthread_mutex_unlock(&coalescer->mutex);
+	if(running) {
+		pthread_join(coalescer->thread, NULL);
+	}
+
+	int i;
+	for(i=0;i<coalescer->methodCount;i++) {
+		free(coalescer->methods[i]);
+	}
+	pthread_cond_destroy(&coalescer->cond);
+	pthread_mutex_destroy(&coalescer->mutex);
+	free(coalescer);
+}
+
+// Find the method of a JSON-RPC message, returns the index of the configured method or -1
+static int findMethod(notificationCoalescer_t* coalescer, const char* message, size_t messageLength)
+{
+	const char* end = message+messageLength;
+	const char* p = memmem(message, messageLength, "\"method\"", 8);
+	if(p == NULL) {
+		return -1;
+	}
+	p += 8;
+	while(p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' || *p == ':')) {
+		p++;
+	}
+	if(p >= end || *p != '"') {
+		return -1;
+	}
+	p++;
+	const char* valueEnd = memchr(p, '"', end-p);
+	if(valueEnd == NULL) {
+		return -1;
+	}
+	int i;
+	for(i=0;i<coalescer->methodCount;i++) {
+		if(strlen(coalescer->methods[i]) == (size_t)(valueEnd-p) && strncmp(coalescer->methods[i], p, valueEnd-p) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int coalescerSubmit(notificationCoalescer_t* coalescer, const char* playerId, const char* message, size_t messageLength)
+{
+	if(coalescer == NULL) {
+		return 0;
+	}
+	int method = findMethod(coalescer, message, messageLength);
+	if(method < 0) {
+		return 0;
+	}
+	char* copy = malloc(messageLength+1);
+	if(copy == NULL) {
+		return 0;
+	}
+	memcpy(copy, message, messageLength);
+	copy[messageLength] = '\0';
+
+	pthread_mutex_lock(&coalescer->mutex);
+	if(coalescer->shutdown) {
+		pthread_mutex_unlock(&coalescer->mutex);
+		free(copy);
+		return 0;
+	}
+	struct _pendingNotification* notification = coalescer->head;
+	while(notification != NULL) {
+		if(notification->method == method && strcmp(notification->playerId, playerId) == 0) {
+			// Keep the deadline of the first notification in the window, only the content is replaced
+			free(notification->message);
+			notification->message = copy;
+			notification->messageLength = messageLength;
+			pthread_mutex_unlock(&coalescer->mutex);
+			return 1;
+		}
+		notification = notification->next;
+	}
+
+	notification = malloc(sizeof(struct _pendingNotification));
+	notification->playerId = strdup(playerId);
+	notification->method = method;
+	notification->message = copy;
+	notification->messageLength = messageLength;
+	notification->next = NULL;
+	clock_gettime(CLOCK_REALTIME, &notification->deadline);
+	notification->deadline.tv_sec += coalescer->windowMs/1000;
+	notification->deadline.tv_nsec += (long)(coalescer->windowMs%1000)*1000000;
+	if(notification->deadline.tv_nsec >= 1000000000) {
+		notification->deadline.tv_sec++;
+		notification->deadline.tv_nsec -= 1000000000;
+	}
+	if(coalescer->tail != NULL) {
+		coalescer->tail->next = notification;
+	}else {
+		coalescer->head = notification;
+	}
+	coalescer->tail = notification;
+	pthread_cond_signal(&coalescer->cond);
+	pthread_mutex_unlock(&coalescer->mutex);
+	return 1;
+}
@@ -0,0 +1,34 @@
+/*
+ * ickNotificationCoalescer.h
+ *
+ * Delays notifications of selected methods for a short window so that a
+ * burst of notifications from one player results in a single message
+ * containing the newest state.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#ifndef __ICKNOTIFICATIONCOALESCER_H
+#define __ICKNOTIFICATIONCOALESCER_H
+
+#include <stddef.h>
+
+struct _notificationCoalescer;
+typedef struct _notificationCoalescer notificationCoalescer_t;
+
+// Called from the coalescer thread when the window of a notification has passed
+typedef void (*coalescerFlushCb_t)(const char* playerId, const char* message, size_t messageLength);
+
+// Create a coalescer for the comma separated list of JSON-RPC methods, returns NULL if window is 0
+notificationCoalescer_t* coalescerCreate(int windowMs, const char* methods, coalescerFlushCb_t callback);
+
+// Send all pending notifications and free the coalescer
+void coalescerDestroy(notificationCoalescer_t* coalescer);
+
+// Returns 1 if the notification has been queued and will be sent by the coalescer, 0 if the
+// caller has to send it because its method isn't coalesced. A queued notification replaces
+// a pending one with the same player and method.
+int coalescerSubmit(notificationCoalescer_t* coalescer, const char* playerId, const char* message, size_t messageLength);
+
+#endif
@@ -0,0 +1,442 @@
+/*
+ * ickResponseCache.c
+ *
+ * Bounded cache of JSON-RPC responses of read-only methods, keyed on the
+ * method and the params of the request. Cached responses are returned with
+ * the id of the request they answer.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "ickResponseCache.h"
+#include "ickLogger.h"
+
+#define RESPONSE_CACHE_MAX_METHODS 32
+#define RESPONSE_CACHE_BUCKETS 1024
+
+struct _cacheEntry;
+struct _cacheEntry {
+	unsigned int hash;
+	// Method and params of the request separated by a newline
+	char* key;
+	size_t keyLength;
+	char* response;
+	size_t responseLength;
+	// Position of the id value in response, replaced on every hit
+	size_t idStart;
+	size_t idEnd;
+	struct _cacheEntry* bucketNext;
+	// Least recently used entry is at the tail
+	struct _cacheEntry* lruPrevious;
+	struct _cacheEntry* lruNext;
+};
+
+struct _responseCache {
+	size_t maxBytes;
+	size_t bytes;
+	char* methods[RESPONSE_CACHE_MAX_METHODS];
+	int methodCount;
+	struct _cacheEntry* buckets[RESPONSE_CACHE_BUCKETS];
+	struct _cacheEntry* lruHead;
+	struct _cacheEntry* lruTail;
+	unsigned int generation;
+	char* state;
+	size_t stateLength;
+	time_t lastValidation;
+	pthread_mutex_t mutex;
+};
+
+static const char* skipWhitespace(const char* p, const char* end)
+{
+	while(p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+		p++;
+	}
+	return p;
+}
+
+// Returns the end of the JSON value starting at p or NULL if it isn't complete
+static const char* skipValue(const char* p, const char* end)
+{
+	if(p >= end) {
+		return NULL;
+	}
+	if(*p == '"') {
+		p++;
+		while(p < end && *p != '"') {
+			if(*p == '\\') {
+				p++;
+			}
+			p++;
+		}
+		return p < end ? p+1 : NULL;
+	}
+	if(*p == '{' || *p == '[') {
+		int depth = 0;
+		while(p < end) {
+			if(*p == '"') {
+				p = skipValue(p, end);
+				if(p == NULL) {
+					return NULL;
+				}
+				continue;
+			}
+			if(*p == '{' || *p == '[') {
+				depth++;
+			}else if(*p == '}' || *p == ']') {
+				if(--depth == 0) {
+					return p+1;
+				}
+			}
+			p++;
+		}
+		return NULL;
+	}
+	while(p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+		p++;
+	}
+	return p;
+}
+
+// Find a member of the top level object, value is set to the raw JSON text of its value
+static int findMember(const char* json, size_t length, const char* name, const char** value, const char** valueEnd)
+{
+	const char* end = json+length;
+	const char* p = skipWhitespace(json, end);
+	if(p >= end || *p != '{') {
+		return -1;
+	}
+	size_t nameLength = strlen(name);
+	p = skipWhitespace(p+1, end);
+	while(p < end && *p == '"') {
+		const char* key = p+1;
+		p = skipValue(p, end);
+		if(p == NULL) {
+			return -1;
+		}
+		int match = (size_t)(p-1-key) == nameLength && memcmp(key, name, nameLength) == 0;
+		p = skipWhitespace(p, end);
+		if(p >= end || *p != ':') {
+			return -1;
+		}
+		p = skipWhitespace(p+1, end);
+		const char* memberEnd = skipValue(p, end);
+		if(memberEnd == NULL || memberEnd == p) {
+			return -1;
+		}
+		if(match) {
+			*value = p;
+			*valueEnd = memberEnd;
+			return 0;
+		}
+		p = skipWhitespace(memberEnd, end);
+		if(p < end && *p == ',') {
+			p = skipWhitespace(p+1, end);
+		}
+	}
+	return -1;
+}
+
+static unsigned int hashKey(const char* key, size_t length)
+{
+	// FNV-1a
+	unsigned int hash = 2166136261u;
+	size_t i;
+	for(i=0;i<length;i++) {
+		hash ^= (unsigned char)key[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Build the cache key of request, returns NULL if its method isn't cacheable
+static char* requestKey(responseCache_t* cache, const char* request, size_t requestLength, size_t* keyLength, const char** id, const char** idEnd)
+{
+	const char* method;
+	const char* methodEnd;
+	if(findMember(request, requestLength, "method", &method, &methodEnd) != 0 || *method != '"') {
+		return NULL;
+	}
+	// Notifications are never answered so there is nothing to cache
+	if(findMember(request, requestLength, "id", id, idEnd) != 0) {
+		return NULL;
+	}
+	size_t methodLength = methodEnd-method-2;
+	int i;
+	for(i=0;i<cache->methodCount;i++) {
+		if(strlen(cache->methods[i]) == methodLength && memcmp(cache->methods[i], method+1, methodLength) == 0) {
+			break;
+		}
+	}
+	if(i == cache->methodCount) {
+		return NULL;
+	}
+	const char* params = methodEnd;
+	const char* paramsEnd = methodEnd;
+	findMember(request, requestLength, "params", &params, &paramsEnd);
+
+	*keyLength = methodLength+1+(paramsEnd-params);
+	char* key = malloc(*keyLength+1);
+	if(key == NULL) {
+		return NULL;
+	}
+	memcpy(key, method+1, methodLength);
+	key[methodLength] = '\n';
+	memcpy(key+methodLength+1, params, paramsEnd-params);
+	key[*keyLength] = '\0';
+	return key;
+}
+
+static void lruUnlink(responseCache_t* cache, struct _cacheEntry* entry)
+{
+	if(entry->lruPrevious != NULL) {
+		entry->lruPrevious->lruNext = entry->lruNext;
+	}else {
+		cache->lruHead = entry->lruNext;
+	}
+	if(entry->lruNext != NULL) {
+		entry->lruNext->lruPrevious = entry->lruPrevious;
+	}else {
+		cache->lruTail = entry->lruPrevious;
+	}
+	entry->lruPrevious = NULL;
+	entry->lruNext = NULL;
+}
+
+static void lruPush(responseCache_t* cache, struct _cacheEntry* entry)
+{
+	entry->lruPrevious = NULL;
+	entry->lruNext = cache->lruHead;
+	if(cache->lruHead != NULL) {
+		cache->lruHead->lruPrevious = entry;
+	}
+	cache->lruHead = entry;
+	if(cache->lruTail == NULL) {
+		cache->lruTail = entry;
+	}
+}
+
+static struct _cacheEntry* findEntry(responseCache_t* cache, unsigned int hash, const char* key, size_t keyLength)
+{
+	struct _cacheEntry* entry = cache->buckets[hash % RESPONSE_CACHE_BUCKETS];
+	while(entry != NULL) {
+		if(entry->hash == hash && entry->keyLength == keyLength && memcmp(entry->key, key, keyLength) == 0) {
+			return entry;
+		}
+		entry = entry->bucketNext;
+	}
+	return NULL;
+}
+
+// Unlink and free an entry, called with the mutex held
+static void removeEntry(responseCache_t* cache, struct _cacheEntry* entry)
+{
+	struct _cacheEntry** link = &cache->buckets[entry->hash % RESPONSE_CACHE_BUCKETS];
+	while(*link != entry) {
+		link = &(*link)->bucketNext;
+	}
+	*link = entry->bucketNext;
+	lruUnlink(cache, entry);
+	cache->bytes -= entry->keyLength+entry->responseLength;
+	free(entry->key);
+	free(entry->response);
+	free(entry);
+}
+
+static void clearEntries(responseCache_t* cache)
+{
+	while(cache->lruHead != NULL) {
+		removeEntry(cache, cache->lruHead);
+	}
+	cache->generation++;
+}
+
+responseCache_t* responseCacheCreate(size_t maxBytes, const char* methods)
+{
+	if(maxBytes == 0 || methods == NULL) {
+		return NULL;
+	}
+	responseCache_t* cache = malloc(sizeof(responseCache_t));
+	if(cache == NULL) {
+		return NULL;
+	}
+	memset(cache, 0, sizeof(responseCache_t));
+	cache->maxBytes = maxBytes;
+
+	char* list = strdup(methods);
+	char* strtokContext = NULL;
+	char* method = strtok_r(list, ", ", &strtokContext);
+	while(method != NULL && cache->methodCount < RESPONSE_CACHE_MAX_METHODS) {
+		cache->methods[cache->methodCount++] = strdup(method);
+		method = strtok_r(NULL, ", ", &strtokContext);
+	}
+	free(list);
+	if(cache->methodCount == 0) {
+		free(cache);
+		return NULL;
+	}
+	pthread_mutex_init(&cache->mutex, NULL);
+	return cache;
+}
+
+void responseCacheDestroy(responseCache_t* cache)
+{
+	if(cache == NULL) {
+		return;
+	}
+	clearEntries(cache);
+	int i;
+	for(i=0;i<cache->methodCount;i++) {
+		free(cache->methods[i]);
+	}
+	free(cache->state);
+	pthread_mutex_destroy(&cache->mutex);
+	free(cache);
+}
+
+char* responseCacheLookup(responseCache_t* cache, const char* request, size_t requestLength, size_t* responseLength, unsigned int* generation)
+{
+	const char* id;
+	const char* idEnd;
+	size_t keyLength;
+	char* key = requestKey(cache, request, requestLength, &keyLength, &id, &idEnd);
+	if(key == NULL) {
+		return NULL;
+	}
+	unsigned int hash = hashKey(key, keyLength);
+	char* response = NULL;
+
+	pthread_mutex_lock(&cache->mutex);
+	struct _cacheEntry* entry = findEntry(cache, hash, key, keyLength);
+	if(entry != NULL) {
+		lruUnlink(cache, entry);
+		lruPush(cache, entry);
+		// Splice the id of this request in place of the one the response was created for
+		size_t idLength = idEnd-id;
+		*responseLength = entry->responseLength-(entry->idEnd-entry->idStart)+idLength;
+		response = malloc(*responseLength+1);
+		if(response != NULL) {
+			memcpy(response, entry->response, entry->idStart);
+			memcpy(response+entry->idStart, id, idLength);
+			memcpy(response+entry->idStart+idLength, entry->response+entry->idEnd, entry->responseLength-entry->idEnd);
+			response[*responseLength] = '\0';
+		}
+	}
+	*generation = cache->generation;
+	pthread_mutex_unlock(&cache->mutex);
+	free(key);
+	return response;
+}
+
+void responseCacheStore(responseCache_t* cache, const char* request, size_t requestLength, const char* response, size_t responseLength, unsigned int generation)
+{
+	const char* id;
+	const char* idEnd;
+	const char* result;
+	const char* resultEnd;
+	if(findMember(response, responseLength, "result", &result, &resultEnd) != 0 ||
+			findMember(response, responseLength, "id", &id, &idEnd) != 0) {
+		return;
+	}
+	// Entries larger than a quarter of the cache would evict too much
+	if(responseLength > cache->maxBytes/4) {
+		return;
+	}
+	const char* requestId;
+	const char* requestIdEnd;
+	size_t keyLength;
+	char* key = requestKey(cache, request, requestLength, &keyLength, &requestId, &requestIdEnd);
+	if(key == NULL) {
+		return;
+	}
+	struct _cacheEntry* entry = malloc(sizeof(struct _cacheEntry));
+	char* copy = malloc(responseLength);
+	if(entry == NULL || copy == NULL) {
+		free(entry);
+		free(copy);
+		free(key);
+		return;
+	}
+	memset(entry, 0, sizeof(struct _cacheEntry));
+	entry->hash = hashKey(key, keyLength);
+	entry->key = key;
+	entry->keyLength = keyLength;
+	memcpy(copy, response, responseLength);
+	entry->response = copy;
+	entry->responseLength = responseLength;
+	entry->idStart = id-response;
+	entry->idEnd = idEnd-response;
+
+	pthread_mutex_lock(&cache->mutex);
+	if(generation != cache->generation) {
+		// The library changed while the request was handled
+		pthread_mutex_unlock(&cache->mutex);
+		free(entry->key);
+		free(entry->response);
+		free(entry);
+		return;
+	}
+	struct _cacheEntry* existing = findEntry(cache, entry->hash, key, keyLength);
+	if(existing != NULL) {
+		removeEntry(cache, existing);
+	}
+	while(cache->lruTail != NULL && cache->bytes+keyLength+responseLength > cache->maxBytes) {
+		removeEntry(cache, cache->lruTail);
+	}
+	unsigned int bucket = entry->hash % RESPONSE_CACHE_BUCKETS;
+	entry->bucketNext = cache->buckets[bucket];
+	cache->buckets[bucket] = entry;
+	lruPush(cache, entry);
+	cache->bytes += keyLength+responseLength;
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+int responseCacheValidationDue(responseCache_t* cache, int intervalSeconds)
+{
+	time_t now = time(NULL);
+	int due = 0;
+	pthread_mutex_lock(&cache->mutex);
+	if(now-cache->lastValidation >= intervalSeconds || now < cache->lastValidation) {
+		cache->lastValidation = now;
+		due = 1;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+	return due;
+}
+
+void responseCacheValidate(responseCache_t* cache, const char* state, size_t stateLength)
+{
+	pthread_mutex_lock(&cache->mutex);
+	if(state == NULL || cache->state == NULL || cache->stateLength != stateLength || memcmp(cache->state, state, stateLength) != 0) {
+		if(cache->state != NULL) {
+			loggerPrintf(LOGGER_INFO, "Library changed, dropping cached responses");
+		}
+		clearEntries(cache);
+		free(cache->state);
+		cache->state = NULL;
+		cache->stateLength = 0;
+		if(state != NULL) {
+			cache->state = malloc(stateLength);
+			if(cache->state != NULL) {
+				memcpy(cache->state, state, stateLength);
+				cache->stateLength = stateLength;
+			}
+		}
+	}
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+char* responseCacheResult(const char* response, size_t responseLength)
+{
+	const char* result;
+	const char* resultEnd;
+	if(findMember(response, responseLength, "result", &result, &resultEnd) != 0) {
+		return NULL;
+	}
+	return strndup(result, resultEnd-result);
+}
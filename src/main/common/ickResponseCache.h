@@ -0,0 +1,43 @@
+/*
+ * ickResponseCache.h
+ *
+ * Bounded cache of JSON-RPC responses of read-only methods, keyed on the
+ * method and the params of the request. Cached responses are returned with
+ * the id of the request they answer.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#ifndef __ICKRESPONSECACHE_H
+#define __ICKRESPONSECACHE_H
+
+#include <stddef.h>
+
+struct _responseCache;
+typedef struct _responseCache responseCache_t;
+
+// Create a cache holding at most maxBytes of responses for the comma separated methods,
+// returns NULL if maxBytes is 0 or no method is given
+responseCache_t* responseCacheCreate(size_t maxBytes, const char* methods);
+
+void responseCacheDestroy(responseCache_t* cache);
+
+// Returns a malloc'd copy of the cached response with the id of request, or NULL if it isn't cached.
+// On a miss generation is set to the value which must be passed to responseCacheStore.
+char* responseCacheLookup(responseCache_t* cache, const char* request, size_t requestLength, size_t* responseLength, unsigned int* generation);
+
+// Store the response to request if its method is cacheable and the response isn't an error. The response is
+// dropped if the cache has been invalidated since the lookup which returned generation.
+void responseCacheStore(responseCache_t* cache, const char* request, size_t requestLength, const char* response, size_t responseLength, unsigned int generation);
+
+// Returns 1 if the library state should be checked, only one caller per interval gets 1
+int responseCacheValidationDue(responseCache_t* cache, int intervalSeconds);
+
+// Drop all entries if state differs from the state passed on the previous call, a NULL state always drops them
+void responseCacheValidate(responseCache_t* cache, const char* state, size_t stateLength);
+
+// Returns the zero terminated result member of a JSON-RPC response as a malloc'd string or NULL
+char* responseCacheResult(const char* response, size_t responseLength);
+
+#endif
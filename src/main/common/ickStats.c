@@ -0,0 +1,313 @@
+/*
+ * ickStats.c
+ *
+ * Process wide counters and latency histograms of the messages passing
+ * through a daemon, broken down by processing stage, JSON-RPC method and
+ * peer device.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+#include "ickStats.h"
+
+// Bucket i counts values below 2^i microseconds, the last one everything above
+#define STATS_BUCKETS 32
+// Methods and devices beyond this are counted as "other"
+#define STATS_MAX_KEYS 64
+#define STATS_MAX_NAME 64
+
+struct _histogram {
+	unsigned long count;
+	unsigned long long sum;
+	unsigned long long max;
+	unsigned long buckets[STATS_BUCKETS];
+};
+
+struct _statsKey {
+	char name[STATS_MAX_NAME];
+	unsigned long failed;
+	unsigned long cached;
+	unsigned long long bytesIn;
+	unsigned long long bytesOut;
+	struct _histogram latency;
+};
+
+struct _statsTable {
+	struct _statsKey keys[STATS_MAX_KEYS];
+	int count;
+	struct _statsKey other;
+};
+
+static const char* stageNames[STATS_STAGE_COUNT] = {
+	"receive", "connect", "send", "firstByte", "read", "p2pSend", "total"
+};
+
+static pthread_mutex_t statsMutex = PTHREAD_MUTEX_INITIALIZER;
+static long long statsStarted = 0;
+static int inFlight = 0;
+static int maxInFlight = 0;
+static unsigned long long totalBytesIn = 0;
+static unsigned long long totalBytesOut = 0;
+static struct _histogram stages[STATS_STAGE_COUNT];
+static struct _statsTable methods;
+static struct _statsTable devices;
+
+long long statsNow(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec*1000000+now.tv_nsec/1000;
+}
+
+void statsInit(void)
+{
+	pthread_mutex_lock(&statsMutex);
+	statsStarted = statsNow();
+	inFlight = 0;
+	maxInFlight = 0;
+	totalBytesIn = 0;
+	totalBytesOut = 0;
+	memset(stages, 0, sizeof(stages));
+	memset(&methods, 0, sizeof(methods));
+	memset(&devices, 0, sizeof(devices));
+	pthread_mutex_unlock(&statsMutex);
+}
+
+static void histogramAdd(struct _histogram* histogram, long long micros)
+{
+	if(micros < 0) {
+		micros = 0;
+	}
+	int bucket = 0;
+	while(bucket < STATS_BUCKETS-1 && (micros >> bucket) > 0) {
+		bucket++;
+	}
+	histogram->buckets[bucket]++;
+	histogram->count++;
+	histogram->sum += micros;
+	if((unsigned long long)micros > histogram->max) {
+		histogram->max = micros;
+	}
+}
+
+// Upper bound of the bucket containing the given percentile
+static unsigned long long histogramPercentile(const struct _histogram* histogram, int percentile)
+{
+	if(histogram->count == 0) {
+		return 0;
+	}
+	unsigned long long rank = ((unsigned long long)histogram->count*percentile+99)/100;
+	unsigned long long seen = 0;
+	int i;
+	for(i=0;i<STATS_BUCKETS;i++) {
+		seen += histogram->buckets[i];
+		if(seen >= rank) {
+			unsigned long long bound = i > 0 ? (1ULL << i)-1 : 0;
+			return bound < histogram->max ? bound : histogram->max;
+		}
+	}
+	return histogram->max;
+}
+
+// Copy a method or device name, anything which would need escaping in JSON is dropped
+static void copyName(char* destination, const char* source, size_t length)
+{
+	size_t i = 0;
+	while(i < length && i < STATS_MAX_NAME-1) {
+		char c = source[i];
+		if(c == '"' || c == '\\' || (unsigned char)c < 0x20) {
+			break;
+		}
+		destination[i++] = c;
+	}
+	destination[i] = '\0';
+}
+
+// Method of a JSON-RPC message or "-" if it has none, notifications and requests have one
+static void messageMethod(const char* message, size_t messageLength, char* method)
+{
+	strcpy(method, "-");
+	if(message == NULL) {
+		return;
+	}
+	const char* p = memmem(message, messageLength, "\"method\"", 8);
+	if(p == NULL) {
+		return;
+	}
+	const char* end = message+messageLength;
+	p += 8;
+	while(p < end && (*p == ' ' || *p == ':' || *p == '\t' || *p == '\r' || *p == '\n')) {
+		p++;
+	}
+	if(p < end && *p == '"') {
+		p++;
+		const char* methodEnd = memchr(p, '"', end-p);
+		if(methodEnd != NULL && methodEnd > p) {
+			copyName(method, p, methodEnd-p);
+		}
+	}
+}
+
+// Find or add the entry of name, called with the mutex held
+static struct _statsKey* tableEntry(struct _statsTable* table, const char* name)
+{
+	int i;
+	for(i=0;i<table->count;i++) {
+		if(strcmp(table->keys[i].name, name) == 0) {
+			return &table->keys[i];
+		}
+	}
+	if(table->count == STATS_MAX_KEYS) {
+		return &table->other;
+	}
+	struct _statsKey* key = &table->keys[table->count++];
+	strcpy(key->name, name);
+	return key;
+}
+
+static void recordKey(struct _statsKey* key, size_t bytesIn, size_t bytesOut, long long micros, int flags)
+{
+	key->bytesIn += bytesIn;
+	key->bytesOut += bytesOut;
+	if(flags & STATS_FAILED) {
+		key->failed++;
+	}
+	if(flags & STATS_CACHED) {
+		key->cached++;
+	}
+	histogramAdd(&key->latency, micros);
+}
+
+void statsInFlight(int delta)
+{
+	pthread_mutex_lock(&statsMutex);
+	inFlight += delta;
+	if(inFlight > maxInFlight) {
+		maxInFlight = inFlight;
+	}
+	pthread_mutex_unlock(&statsMutex);
+}
+
+void statsRecordStage(statsStage_t stage, long long micros)
+{
+	pthread_mutex_lock(&statsMutex);
+	histogramAdd(&stages[stage], micros);
+	pthread_mutex_unlock(&statsMutex);
+}
+
+void statsRecordHttp(const httpResponse_t* response)
+{
+	pthread_mutex_lock(&statsMutex);
+	// Requests on a pooled connection don't connect at all
+	if(response->connectTime > 0) {
+		histogramAdd(&stages[STATS_STAGE_CONNECT], response->connectTime);
+	}
+	histogramAdd(&stages[STATS_STAGE_SEND], response->sendTime);
+	histogramAdd(&stages[STATS_STAGE_FIRST_BYTE], response->firstByteTime);
+	histogramAdd(&stages[STATS_STAGE_READ], response->readTime);
+	pthread_mutex_unlock(&statsMutex);
+}
+
+void statsRecord(const char* message, size_t messageLength, const char* deviceId, size_t bytesIn, size_t bytesOut, long long micros, int flags)
+{
+	char method[STATS_MAX_NAME];
+	char device[STATS_MAX_NAME];
+	messageMethod(message, messageLength, method);
+	copyName(device, deviceId != NULL ? deviceId : "*", STATS_MAX_NAME);
+
+	pthread_mutex_lock(&statsMutex);
+	totalBytesIn += bytesIn;
+	totalBytesOut += bytesOut;
+	recordKey(tableEntry(&methods, method), bytesIn, bytesOut, micros, flags);
+	recordKey(tableEntry(&devices, device), bytesIn, bytesOut, micros, flags);
+	pthread_mutex_unlock(&statsMutex);
+}
+
+struct _reportBuffer {
+	char* data;
+	size_t length;
+	size_t size;
+};
+
+static void appendf(struct _reportBuffer* buffer, const char* format, ...)
+{
+	va_list args;
+	while(buffer->data != NULL) {
+		va_start(args, format);
+		int n = vsnprintf(buffer->data+buffer->length, buffer->size-buffer->length, format, args);
+		va_end(args);
+		if(n < 0) {
+			return;
+		}
+		if(buffer->length+n < buffer->size) {
+			buffer->length += n;
+			return;
+		}
+		char* data = realloc(buffer->data, buffer->size*2+n);
+		if(data == NULL) {
+			free(buffer->data);
+			buffer->data = NULL;
+			return;
+		}
+		buffer->data = data;
+		buffer->size = buffer->size*2+n;
+	}
+}
+
+static void appendHistogram(struct _reportBuffer* buffer, const struct _histogram* histogram)
+{
+	appendf(buffer, "\"count\":%lu,\"avg\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu",
+			histogram->count, histogram->count > 0 ? histogram->sum/histogram->count : 0,
+			histogramPercentile(histogram, 50), histogramPercentile(histogram, 90), histogramPercentile(histogram, 99), histogram->max);
+}
+
+static void appendKey(struct _reportBuffer* buffer, const struct _statsKey* key, const char* name, int first)
+{
+	appendf(buffer, "%s\"%s\":{\"failed\":%lu,\"cached\":%lu,\"bytesIn\":%llu,\"bytesOut\":%llu,", first ? "" : ",", name, key->failed, key->cached, key->bytesIn, key->bytesOut);
+	appendHistogram(buffer, &key->latency);
+	appendf(buffer, "}");
+}
+
+static void appendTable(struct _reportBuffer* buffer, const char* name, const struct _statsTable* table)
+{
+	appendf(buffer, ",\"%s\":{", name);
+	int i;
+	for(i=0;i<table->count;i++) {
+		appendKey(buffer, &table->keys[i], table->keys[i].name, i == 0);
+	}
+	if(table->other.latency.count > 0) {
+		appendKey(buffer, &table->other, "other", table->count == 0);
+	}
+	appendf(buffer, "}");
+}
+
+char* statsReport(void)
+{
+	struct _reportBuffer buffer;
+	buffer.size = 4096;
+	buffer.length = 0;
+	buffer.data = malloc(buffer.size);
+
+	pthread_mutex_lock(&statsMutex);
+	appendf(&buffer, "{\"uptime\":%lld,\"inFlight\":%d,\"maxInFlight\":%d,\"bytesIn\":%llu,\"bytesOut\":%llu,\"stages\":{",
+			(statsNow()-statsStarted)/1000000, inFlight, maxInFlight, totalBytesIn, totalBytesOut);
+	int i;
+	for(i=0;i<STATS_STAGE_COUNT;i++) {
+		appendf(&buffer, "%s\"%s\":{", i > 0 ? "," : "", stageNames[i]);
+		appendHistogram(&buffer, &stages[i]);
+		appendf(&buffer, "}");
+	}
+	appendf(&buffer, "}");
+	appendTable(&buffer, "methods", &methods);
+	appendTable(&buffer, "devices", &devices);
+	appendf(&buffer, "}");
+	pthread_mutex_unlock(&statsMutex);
+	return buffer.data;
+}
@@ -0,0 +1,53 @@
+/*
+ * ickStats.h
+ *
+ * Process wide counters and latency histograms of the messages passing
+ * through a daemon, broken down by processing stage, JSON-RPC method and
+ * peer device.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#ifndef __ICKSTATS_H
+#define __ICKSTATS_H
+
+#include <stddef.h>
+#include "ickHttpClient.h"
+
+typedef enum {
+	STATS_STAGE_RECEIVE,		// From the ickP2p callback until a worker starts handling the message
+	STATS_STAGE_CONNECT,		// Opening a new connection to LMS
+	STATS_STAGE_SEND,			// Sending the request to LMS
+	STATS_STAGE_FIRST_BYTE,		// From the request being sent until the status line of the response arrived
+	STATS_STAGE_READ,			// Reading the rest of the response
+	STATS_STAGE_P2P_SEND,		// ickP2pSendMsg
+	STATS_STAGE_TOTAL,			// From the ickP2p callback until the answer has been sent
+	STATS_STAGE_COUNT
+} statsStage_t;
+
+// Flags of statsRecord
+#define STATS_FAILED 1
+#define STATS_CACHED 2
+
+// Reset all counters, the uptime is reported relative to the last call
+void statsInit(void);
+
+// Monotonic time in microseconds
+long long statsNow(void);
+
+// Track the number of messages currently being handled
+void statsInFlight(int delta);
+
+void statsRecordStage(statsStage_t stage, long long micros);
+
+// Record the connect, send, first byte and read stages of a completed request
+void statsRecordHttp(const httpResponse_t* response);
+
+// Record a message exchanged with deviceId, the method is taken from message
+void statsRecord(const char* message, size_t messageLength, const char* deviceId, size_t bytesIn, size_t bytesOut, long long micros, int flags);
+
+// Returns the statistics as a malloc'd JSON object, times are in microseconds
+char* statsReport(void);
+
+#endif
@@ -0,0 +1,201 @@
+/*
+ * ickWorkerPool.c
+ *
+ * Pool of worker threads which executes jobs in parallel while keeping
+ * jobs submitted with the same key in submission order.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "ickWorkerPool.h"
+#include "ickLogger.h"
+
+struct _workerJob;
+struct _workerJob {
+	char* key;
+	workerJobCb_t callback;
+	void* data;
+	struct _workerJob* next;
+};
+
+struct _worker {
+	workerPool_t* pool;
+	pthread_t thread;
+	// Key of the job currently executed by this worker, NULL when idle
+	const char* activeKey;
+};
+
+struct _workerPool {
+	int workerCount;
+	struct _worker* workers;
+	struct _workerJob* head;
+	struct _workerJob* tail;
+	int shutdown;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static int isKeyActive(workerPool_t* pool, const char* key)
+{
+	int i;
+	for(i=0;i<pool->workerCount;i++) {
+		if(pool->workers[i].activeKey != NULL && strcmp(pool->workers[i].activeKey, key) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Unlink the oldest queued job whose key isn't being executed by another worker, called with the mutex held
+static struct _workerJob* takeRunnableJob(workerPool_t* pool)
+{
+	struct _workerJob* previous = NULL;
+	struct _workerJob* job = pool->head;
+	while(job != NULL) {
+		if(!isKeyActive(pool, job->key)) {
+			if(previous != NULL) {
+				previous->next = job->next;
+			}else {
+				pool->head = job->next;
+			}
+			if(pool->tail == job) {
+				pool->tail = previous;
+			}
+			job->next = NULL;
+			return job;
+		}
+		previous = job;
+		job = job->next;
+	}
+	return NULL;
+}
+
+static void* workerThread(void* arg)
+{
+	struct _worker* worker = (struct _worker*)arg;
+	workerPool_t* pool = worker->pool;
+
+	pthread_mutex_lock(&pool->mutex);
+	while(1) {
+		struct _workerJob* job = takeRunnableJob(pool);
+		if(job == NULL) {
+			if(pool->shutdown && pool->head == NULL) {
+				break;
+			}
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+			continue;
+		}
+		worker->activeKey = job->key;
+		pthread_mutex_unlock(&pool->mutex);
+
+		job->callback(job->data);
+
+		pthread_mutex_lock(&pool->mutex);
+		worker->activeKey = NULL;
+		// Jobs waiting for this key might be runnable now
+		if(pool->head != NULL) {
+			pthread_cond_broadcast(&pool->cond);
+		}
+		free(job->key);
+		free(job);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+workerPool_t* workerPoolCreate(int workers)
+{
+	if(workers <= 0) {
+		return NULL;
+	}
+	workerPool_t* pool = malloc(sizeof(workerPool_t));
+	if(pool == NULL) {
+		return NULL;
+	}
+	memset(pool, 0, sizeof(workerPool_t));
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	pool->workers = malloc(sizeof(struct _worker)*workers);
+	memset(pool->workers, 0, sizeof(struct _worker)*workers);
+
+	int i;
+	for(i=0;i<workers;i++) {
+		pool->workers[i].pool = pool;
+		if(pthread_create(&pool->workers[i].thread, NULL, workerThread, &pool->workers[i]) != 0) {
+			loggerPrintf(LOGGER_ERROR, "Unable to create worker thread %d",i);
+			break;
+		}
+		pool->workerCount++;
+	}
+	if(pool->workerCount == 0) {
+		workerPoolDestroy(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+void workerPoolShutdown(workerPool_t* pool)
+{
+	if(pool == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&pool->mutex);
+	if(pool->shutdown) {
+		pthread_mutex_unlock(&pool->mutex);
+		return;
+	}
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	int i;
+	for(i=0;i<pool->workerCount;i++) {
+		pthread_join(pool->workers[i].thread, NULL);
+	}
+}
+
+void workerPoolDestroy(workerPool_t* pool)
+{
+	if(pool == NULL) {
+		return;
+	}
+	workerPoolShutdown(pool);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->workers);
+	free(pool);
+}
+
+int workerPoolSubmit(workerPool_t* pool, const char* key, workerJobCb_t callback, void* data)
+{
+	struct _workerJob* job = malloc(sizeof(struct _workerJob));
+	if(job == NULL) {
+		return -1;
+	}
+	job->key = strdup(key != NULL ? key : "");
+	job->callback = callback;
+	job->data = data;
+	job->next = NULL;
+
+	pthread_mutex_lock(&pool->mutex);
+	if(pool->shutdown) {
+		pthread_mutex_unlock(&pool->mutex);
+		free(job->key);
+		free(job);
+		return -1;
+	}
+	if(pool->tail != NULL) {
+		pool->tail->next = job;
+	}else {
+		pool->head = job;
+	}
+	pool->tail = job;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+	return 0;
+}
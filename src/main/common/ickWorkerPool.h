@@ -0,0 +1,32 @@
+/*
+ * ickWorkerPool.h
+ *
+ * Pool of worker threads which executes jobs in parallel while keeping
+ * jobs submitted with the same key in submission order.
+ *
+ * Copyright (c) 2013 ickStream GmbH.
+ * All rights reserved.
+ */
+
+#ifndef __ICKWORKERPOOL_H
+#define __ICKWORKERPOOL_H
+
+struct _workerPool;
+typedef struct _workerPool workerPool_t;
+
+typedef void (*workerJobCb_t)(void* data);
+
+// Create a pool with the given number of worker threads
+workerPool_t* workerPoolCreate(int workers);
+
+// Stop accepting jobs and wait until the worker threads have executed all queued jobs,
+// workerPoolSubmit fails afterwards so callers execute their jobs directly
+void workerPoolShutdown(workerPool_t* pool);
+
+// Shut down the pool if that hasn't been done yet and free it
+void workerPoolDestroy(workerPool_t* pool);
+
+// Queue a job, jobs with the same key are never executed concurrently and run in the order they were queued
+int workerPoolSubmit(workerPool_t* pool, const char* key, workerJobCb_t callback, void* data);
+
+#endif
@@ -10,11 +10,28 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include "ickP2p.h"
+#include "ickHttpClient.h"
+#include "ickWorkerPool.h"
+#include "ickHttpParser.h"
+#include "ickContentServer.h"
+#include "ickNotificationCoalescer.h"
+#include "ickDiscoveryQueue.h"
+#include "ickStats.h"
+#include "ickLogger.h"
 
 #define closesocket(s) close(s)
 #define last_error() errno
 
+#define HTTP_SERVER_MAX_EVENTS 64
+#define HTTP_SERVER_IDLE_TIMEOUT 30
+
 
 char* networkAddress = NULL;
 int daemonPort = 9001;
@@ -26,6 +43,29 @@ char* wrapperDiscoveryPath = NULL;
 char* wrapperAuthorization = NULL;
 int bShutdown = 0;
 ickP2pContext_t* g_context = NULL;
+httpConnectionPool_t* g_httpPool = NULL;
+workerPool_t* g_workerPool = NULL;
+int workerCount = 4;
+// Content server hosted in this process, only used when started with -s
+char* contentServerDeviceId = NULL;
+char* contentServerDeviceName = NULL;
+char* contentServerPath = NULL;
+ickP2pContext_t* g_contentServerContext = NULL;
+// Responses of the content server are cached when started with -K
+int responseCacheSize = 0;
+char* responseCacheMethods = CONTENT_SERVER_CACHED_METHODS;
+responseCache_t* g_responseCache = NULL;
+// Unix domain socket for the control channel, only used when started with -u
+char* controlSocketPath = NULL;
+// Broadcast notifications of these methods are coalesced per player when started with -N, only
+// notifications carrying a full state qualify, playbackQueueChanged is a delta and must not be dropped
+int coalescingWindow = 0;
+char* coalescingMethods = "playerStatusChanged";
+notificationCoalescer_t* g_coalescer = NULL;
+// Discovery events are collected for this time before they are forwarded to the plugin
+int discoveryDelay = 250;
+discoveryQueue_t* g_discoveryQueue = NULL;
+loggerOptions_t loggerOptions;
 
 void messageCb(ickP2pContext_t *ictx, const char *szSourceDeviceId, ickP2pServicetype_t sourceService, ickP2pServicetype_t targetService, const char* message, size_t messageLength, ickP2pMessageFlag_t mFlags );
 void discoveryCb(ickP2pContext_t *ictx, const char *szDeviceId, ickP2pDeviceState_t change, ickP2pServicetype_t type);
@@ -35,127 +75,212 @@ void set_nonblock(int s) {
 	fcntl(s, F_SETFL, flags | O_NONBLOCK);
 }
 
+// Registered players, hashed both by device id and by ickP2p context. Lookups happen for
+// every notification so they only take a read lock.
 struct _ickP2pPlayerContext;
 struct _ickP2pPlayerContext {
     ickP2pContext_t* context;
     char* deviceId;
-    struct _ickP2pPlayerContext* next;
+    unsigned int deviceIdHash;
+    struct _ickP2pPlayerContext* nextById;
+    struct _ickP2pPlayerContext* nextByContext;
 };
 
-struct _ickP2pPlayerContext *contexts = NULL;
-pthread_mutex_t contextMutex;
+#define PLAYER_CONTEXT_INITIAL_BUCKETS 32
+
+struct _ickP2pPlayerContext **contextsById = NULL;
+struct _ickP2pPlayerContext **contextsByContext = NULL;
+size_t contextBuckets = 0;
+size_t contextCount = 0;
+pthread_rwlock_t contextLock = PTHREAD_RWLOCK_INITIALIZER;
+
+static unsigned int hashDeviceId(const char* deviceId) {
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    while(*deviceId) {
+        hash ^= (unsigned char)*deviceId++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
-void addPlayerForContext(ickP2pContext_t* context, char* deviceId) {
+static unsigned int hashContext(const ickP2pContext_t* context) {
+    uintptr_t value = (uintptr_t)context;
+    value ^= value >> 16;
+    value *= 0x45d9f3b;
+    value ^= value >> 16;
+    return (unsigned int)value;
+}
+
+// Grow the hash tables, called with the write lock held
+static int resizePlayerContexts(size_t buckets) {
+    struct _ickP2pPlayerContext **byId = calloc(buckets, sizeof(struct _ickP2pPlayerContext*));
+    struct _ickP2pPlayerContext **byContext = calloc(buckets, sizeof(struct _ickP2pPlayerContext*));
+    if(byId == NULL || byContext == NULL) {
+        free(byId);
+        free(byContext);
+        return -1;
+    }
+    size_t i;
+    for(i=0;i<contextBuckets;i++) {
+        struct _ickP2pPlayerContext* entry = contextsById[i];
+        while(entry != NULL) {
+            struct _ickP2pPlayerContext* next = entry->nextById;
+            size_t idBucket = entry->deviceIdHash & (buckets-1);
+            size_t contextBucket = hashContext(entry->context) & (buckets-1);
+            entry->nextById = byId[idBucket];
+            byId[idBucket] = entry;
+            entry->nextByContext = byContext[contextBucket];
+            byContext[contextBucket] = entry;
+            entry = next;
+        }
+    }
+    free(contextsById);
+    free(contextsByContext);
+    contextsById = byId;
+    contextsByContext = byContext;
+    contextBuckets = buckets;
+    return 0;
+}
+
+void addPlayerForContext(ickP2pContext_t* context, const char* deviceId) {
 
     struct _ickP2pPlayerContext* entry = malloc(sizeof(struct _ickP2pPlayerContext) );
     entry->context = context;
     entry->deviceId = malloc(strlen(deviceId)+1);
     strcpy(entry->deviceId,deviceId);
-    entry->next=NULL;
+    entry->deviceIdHash = hashDeviceId(deviceId);
 
-    pthread_mutex_lock( &contextMutex );
+    pthread_rwlock_wrlock( &contextLock );
 
-    if(contexts == NULL) {
-        contexts = entry;
-    }else {
-        struct _ickP2pPlayerContext* next = contexts;
-        while(next->next != NULL) {
-            next = next->next;
+    if(contextBuckets == 0 || contextCount >= contextBuckets*2) {
+        resizePlayerContexts(contextBuckets > 0 ? contextBuckets*2 : PLAYER_CONTEXT_INITIAL_BUCKETS);
+        if(contextBuckets == 0) {
+            pthread_rwlock_unlock( &contextLock );
+            loggerPrintf(LOGGER_ERROR, "Unable to allocate player registry");
+            free(entry->deviceId);
+            free(entry);
+            return;
         }
-        next->next = entry;
     }
+    size_t idBucket = entry->deviceIdHash & (contextBuckets-1);
+    size_t contextBucket = hashContext(context) & (contextBuckets-1);
+    entry->nextById = contextsById[idBucket];
+    contextsById[idBucket] = entry;
+    entry->nextByContext = contextsByContext[contextBucket];
+    contextsByContext[contextBucket] = entry;
+    contextCount++;
 
-    pthread_mutex_unlock( &contextMutex );
+    pthread_rwlock_unlock( &contextLock );
 }
 
-ickP2pContext_t* getContextForPlayer(char* deviceId) {
-    ickP2pContext_t* context = NULL;
-    pthread_mutex_lock( &contextMutex );
-
-    if(contexts != NULL) {
-        struct _ickP2pPlayerContext* next = contexts;
+// Called with the lock held
+static ickP2pContext_t* lookupPlayerContext(const char* deviceId) {
+    unsigned int hash = hashDeviceId(deviceId);
+    if(contextBuckets > 0) {
+        struct _ickP2pPlayerContext* next = contextsById[hash & (contextBuckets-1)];
         while(next != NULL) {
-        	if(strcmp(deviceId,next->deviceId)==0) {
-                context = next->context;
-                break;
+        	if(next->deviceIdHash == hash && strcmp(deviceId,next->deviceId)==0) {
+                return next->context;
             }
-            next = next->next;
+            next = next->nextById;
         }
     }
+    return NULL;
+}
 
-    pthread_mutex_unlock( &contextMutex );
+ickP2pContext_t* getContextForPlayer(const char* deviceId) {
+    pthread_rwlock_rdlock( &contextLock );
+    ickP2pContext_t* context = lookupPlayerContext(deviceId);
+    pthread_rwlock_unlock( &contextLock );
     return context;
 }
 
-void removePlayerForContext(ickP2pContext_t* context) {
-    pthread_mutex_lock( &contextMutex );
-
-    if(contexts != NULL) {
-        if(contexts->context == context) {
-           	free(contexts->deviceId);
-			free(contexts);
-			contexts = contexts->next;
-        }else {
-            struct _ickP2pPlayerContext* next = contexts;
-            while(next->next != NULL) {
-                if(next->next->context==context) {
-                	struct _ickP2pPlayerContext* deleted = next->next;
-	                next->next = next->next->next;
-	                free(deleted->deviceId);
-	                free(deleted);
-                    break;
-                }
-                next = next->next;
+// Unregister a player and return its context, senders look up the context and send with the
+// read lock held so once this returns nobody uses the context and it can be ended
+ickP2pContext_t* removePlayer(const char* deviceId) {
+    ickP2pContext_t* context = NULL;
+    unsigned int hash = hashDeviceId(deviceId);
+    pthread_rwlock_wrlock( &contextLock );
+
+    if(contextBuckets > 0) {
+        struct _ickP2pPlayerContext** next = &contextsById[hash & (contextBuckets-1)];
+        while(*next != NULL && ((*next)->deviceIdHash != hash || strcmp(deviceId,(*next)->deviceId) != 0)) {
+            next = &((*next)->nextById);
+        }
+        struct _ickP2pPlayerContext* deleted = *next;
+        if(deleted != NULL) {
+            *next = deleted->nextById;
+            next = &contextsByContext[hashContext(deleted->context) & (contextBuckets-1)];
+            while(*next != deleted) {
+                next = &((*next)->nextByContext);
             }
+            *next = deleted->nextByContext;
+            contextCount--;
+            context = deleted->context;
+            free(deleted->deviceId);
+            free(deleted);
         }
     }
 
-    pthread_mutex_unlock( &contextMutex );
+    pthread_rwlock_unlock( &contextLock );
+    return context;
 }
 
-void initPlayer(char* deviceId, char* deviceName) {
-    printf("Initializing ickP2P for %s(%s) at %s...\n",deviceName,deviceId,networkAddress);
-    printf("Wrapping URL: %s\n",wrapperURL);
-    printf("- Using IP-address: %s\n",wrapperIP);
-    printf("- Using port: %d\n",wrapperPort);
-    printf("- Using path: /%s\n",wrapperPath);
+void initPlayer(const char* deviceId, const char* deviceName) {
+    loggerPrintf(LOGGER_INFO, "Initializing ickP2P for %s(%s) at %s...",deviceName,deviceId,networkAddress);
+    loggerPrintf(LOGGER_DEBUG, "Wrapping URL: %s",wrapperURL);
+    loggerPrintf(LOGGER_DEBUG, "- Using IP-address: %s",wrapperIP);
+    loggerPrintf(LOGGER_DEBUG, "- Using port: %d",wrapperPort);
+    loggerPrintf(LOGGER_DEBUG, "- Using path: /%s",wrapperPath);
     
 	ickErrcode_t error;
-    printf("create(\"%s\",\"%s\",NULL,0,0,%d,%p)\n",deviceName,deviceId,ICKP2P_SERVICE_PLAYER,&error);
+    loggerPrintf(LOGGER_DEBUG, "create(\"%s\",\"%s\",NULL,0,0,%d,%p)",deviceName,deviceId,ICKP2P_SERVICE_PLAYER,&error);
 	ickP2pContext_t* context = ickP2pCreate(deviceName,deviceId,NULL,0,0,ICKP2P_SERVICE_PLAYER,&error);
 	if(error == ICKERR_SUCCESS) {
-		printf("context = %p\n",context);
+		loggerPrintf(LOGGER_DEBUG, "context = %p",context);
     	error = ickP2pRegisterMessageCallback(context, &messageCb);
     	if(error != ICKERR_SUCCESS) {
-    		printf("ickP2pRegisterMessageCallback failed=%d\n",(int)error);
+    		loggerPrintf(LOGGER_ERROR, "ickP2pRegisterMessageCallback failed=%d",(int)error);
     	}
     	error = ickP2pRegisterDiscoveryCallback(context, &discoveryCb);
     	if(error != ICKERR_SUCCESS) {
-    		printf("ickP2pRegisterDiscoveryCallback failed=%d\n",(int)error);
+    		loggerPrintf(LOGGER_ERROR, "ickP2pRegisterDiscoveryCallback failed=%d",(int)error);
     	}
 #ifdef ICK_DEBUG
 	    ickP2pSetHttpDebugging(context,1);
 #endif
 		error = ickP2pAddInterface(context, networkAddress, NULL);
     	if(error != ICKERR_SUCCESS) {
-    		printf("ickP2pAddInterface failed=%d\n",(int)error);
+    		loggerPrintf(LOGGER_ERROR, "ickP2pAddInterface failed=%d",(int)error);
     	}
     	error = ickP2pResume(context);
     	if(error != ICKERR_SUCCESS) {
-    		printf("ickP2pResume failed=%d\n",(int)error);
+    		loggerPrintf(LOGGER_ERROR, "ickP2pResume failed=%d",(int)error);
     	}
 		addPlayerForContext(context,deviceId);
 		sleep(1);
 	}
-	fflush (stdout);
 }
 
 void writeSuccessResponse(int fd) {
 	char answer[] = "HTTP/1.1 200 OK\r\nServer: ickHttpSqueezeboxPlayerDaemon\r\nConnection: close\r\nContent-Type: application/json\r\n\r\n";
 	int size = send(fd,answer,strlen(answer),0);
 	if(size<strlen(answer)) {
-		printf("Unable to write whole response: %s\n",answer);
+		loggerPrintf(LOGGER_WARNING, "Unable to write whole response: %s",answer);
+	}
+	closesocket(fd);
+}
+
+void writeSuccessBodyResponse(int fd, const char* contentType, const char* body) {
+	char template[] = "HTTP/1.1 200 OK\r\nServer: ickHttpSqueezeboxPlayerDaemon\r\nConnection: close\r\nContent-Type: %s\r\nContent-Length: %d\r\n\r\n%s";
+	char* answer = malloc(strlen(template)+strlen(contentType)+20+strlen(body));
+	sprintf(answer,template,contentType,(int)strlen(body),body);
+	int size = send(fd,answer,strlen(answer),0);
+	if(size<strlen(answer)) {
+		loggerPrintf(LOGGER_WARNING, "Unable to write whole response: %s",answer);
 	}
+	free(answer);
 	closesocket(fd);
 }
 
@@ -165,319 +290,794 @@ void writeErrorResponse(int fd, const char* error) {
 	sprintf(answer,template,error);
 	int size = send(fd,answer,strlen(answer),0);
 	if(size<strlen(answer)) {
-		printf("Unable to write whole response: %s\n",answer);
+		loggerPrintf(LOGGER_WARNING, "Unable to write whole response: %s",answer);
 	}
 	free(answer);
 	closesocket(fd);
 }
 
-void httpServer(int listenfd)
+// Send the newest notification of a coalescing window, the player might have been stopped meanwhile
+static void sendCoalescedNotification(const char* playerId, const char* message, size_t messageLength)
 {
-	while(!bShutdown) {
-		int fd;
-		
-		printf("Waiting for new connection in accept\n");
-		socklen_t addrlen;
-		struct sockaddr_in address;
-		addrlen = sizeof(struct sockaddr_in);
-  		fd = accept(listenfd, (struct sockaddr *)&address, &addrlen);
-		if(fd > 0) {
-
-			char buffer[1024];
-			char *method = NULL, *path = NULL, *prot = NULL, *res = NULL, *req = NULL, *par = NULL, *auth = NULL, *line = NULL;
-
-			fd_set read_set;
-			struct timeval tv;
-		
-			FD_ZERO(&read_set);
-			FD_SET(fd, &read_set);
-			tv.tv_sec = 2;
-			tv.tv_usec = 0;
-
-			printf("Waiting for select\n");
-			// wait up to 2 secs for fd to be readable - sp can delay sending request
-			if (select((int)fd + 1, &read_set, NULL, &read_set, &tv) > 0) {
-			
-				int flags = fcntl(fd, F_GETFL,0);
-				fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-				
-				char* completeBuffer = NULL;
-				int completeBufferSize = 0;
-				printf("Recv from socket\n");
-				int n=0;
-				do {
-					n = recv(fd, buffer, 1023, 0);
-					if(n>0) {
-						if(completeBuffer == NULL) {
-							completeBuffer = malloc(n+1);
-							memcpy(completeBuffer,buffer,n);
-							completeBufferSize=n;
-						}else {
-							char* oldCompleteBuffer = completeBuffer;
-							completeBuffer = malloc(completeBufferSize+n+1);
-							memcpy(completeBuffer,oldCompleteBuffer,completeBufferSize);
-							free(oldCompleteBuffer);
-							memcpy(completeBuffer+completeBufferSize,buffer,n);
-							completeBufferSize+=n;
-						}
-						*(completeBuffer+completeBufferSize) = '\0';
-					}
-				}while(n==1023);
-				
-				if(completeBuffer != NULL) {
-					char *strtokContext = NULL;
-					char* body = strstr(completeBuffer,"\r\n\r\n");
-					if(body != NULL) {
-						*body='\0';
-						body+=4;
-					}else {
-						printf("No body available\n");
-						printf("========\n");
-						printf(completeBuffer);
-						printf("========\n");
-					}
-					method = strtok_r(completeBuffer, " \n\r",&strtokContext);
-					path   = strtok_r(NULL, " \n\r",&strtokContext);
-					prot   = strtok_r(NULL, " \n\r",&strtokContext);
-	
-					// find additional headers
-					while ((line = strtok_r(NULL, "\n\r",&strtokContext))) {
-						if (!strncmp(line, "Authorization:", 14)) {
-							auth = line + 14;
-						}
-					}
-					if (auth) {
-						char* fromDeviceId = strtok_r(auth, " \n\r",&strtokContext);
-	
-						// split path from param
-						path = strtok_r(path, "?",&strtokContext);
-		
-						// split path: res = resource (null for search), req = request
-						char* command = strtok_r(path, "/",&strtokContext);
-						char* toDeviceId = strtok_r(NULL, "/",&strtokContext);
-	
-						printf("GOT: \nMETHOD: %s\nPATH: %s\nPROT: %s\nCommand: %s\nFrom: %s\nTo: %s\nData: %s\n",method,path,prot,command,fromDeviceId,toDeviceId,body);
-						fflush (stdout);
-						if(strcmp(command,"start")==0) {
-							char* deviceName = strtok_r(body, "\n\r",&strtokContext);
-							if(deviceName == NULL) {
-								deviceName = fromDeviceId;
-							}
-							ickP2pContext_t* context = getContextForPlayer(fromDeviceId);
-							if(context == NULL) {
-								initPlayer(fromDeviceId,deviceName);
-							}else {
-								printf("Player already initialized\n");
-							}
-						    writeSuccessResponse(fd);
-						}else if(strcmp(command,"sendMessage")==0) {
-							char* toServiceString = strtok_r(NULL, "?",&strtokContext);
-							int toService = ICKP2P_SERVICE_ANY;
-							if(toServiceString != NULL) {
-								toService = atoi(toServiceString);
-							}
-							ickP2pContext_t* context = getContextForPlayer(fromDeviceId);
-							if(context != NULL) {
-								ickErrcode_t error = ickP2pSendMsg(context,toDeviceId,toService,ICKP2P_SERVICE_PLAYER,body,strlen(body));
-								if(error != ICKERR_SUCCESS) {
-									printf("Error sending message to %s(%d): %d\n", toDeviceId,toService,error);
-									writeErrorResponse(fd,"500 Internal Server Error");
-								}else {
-								    writeSuccessResponse(fd);
-								}
-							}else {
-								writeErrorResponse(fd, "401 Unauthorized");
-							}
-						}else if(strcmp(command,"stop") == 0) {
-							ickP2pContext_t* context = getContextForPlayer(fromDeviceId);
-							if(context != NULL) {
-							    printf("Shutting down ickP2P for %s\n",fromDeviceId);
-								fflush (stdout);
-							    ickP2pEnd(context,NULL);
-							    printf("Removing context for %s\n",fromDeviceId);
-								fflush (stdout);
-							    removePlayerForContext(context);
-							    printf("Shutdown ickP2P for %s\n",fromDeviceId);
-								fflush (stdout);
-							    writeSuccessResponse(fd);
-							}else {
-								writeErrorResponse(fd, "401 Unauthorized");
-							}
-						}else {
-							writeErrorResponse(fd, "404 Not Found");
-						}
-							
-					}else {
-						writeErrorResponse(fd,"401 Unauthorized");
-					}
-					free(completeBuffer);
-				}
+	pthread_rwlock_rdlock( &contextLock );
+	ickP2pContext_t* context = lookupPlayerContext(playerId);
+	if(context == NULL) {
+		pthread_rwlock_unlock( &contextLock );
+		return;
+	}
+	long long started = statsNow();
+	ickErrcode_t error = ickP2pSendMsg(context,NULL,ICKP2P_SERVICE_ANY,ICKP2P_SERVICE_PLAYER,message,messageLength);
+	long long elapsed = statsNow()-started;
+	pthread_rwlock_unlock( &contextLock );
+	statsRecordStage(STATS_STAGE_P2P_SEND, elapsed);
+	statsRecord(message, messageLength, NULL, 0, messageLength, elapsed, error != ICKERR_SUCCESS ? STATS_FAILED : 0);
+	if(error != ICKERR_SUCCESS) {
+		loggerPrintf(LOGGER_WARNING, "Error sending notification from %s: %d", playerId,error);
+	}
+}
+
+// Send a message from a player, returns NULL on success or the HTTP status to answer with.
+// Called with the read lock held so the player can't be stopped while its context is used
+static const char* sendPlayerMessage(ickP2pContext_t* context, const char* fromDeviceId, const char* toDeviceId, const char* toServiceString, const char* body, size_t bodyLength)
+{
+	int toService = ICKP2P_SERVICE_ANY;
+	if(toServiceString != NULL) {
+		toService = atoi(toServiceString);
+	}
+	if(context == NULL) {
+		return "401 Unauthorized";
+	}
+	if(toDeviceId == NULL && toServiceString == NULL && coalescerSubmit(g_coalescer, fromDeviceId, body, bodyLength)) {
+		return NULL;
+	}
+	long long started = statsNow();
+	ickErrcode_t error = ickP2pSendMsg(context,toDeviceId,toService,ICKP2P_SERVICE_PLAYER,body,bodyLength);
+	long long elapsed = statsNow()-started;
+	statsRecordStage(STATS_STAGE_P2P_SEND, elapsed);
+	statsRecord(body, bodyLength, toDeviceId, 0, bodyLength, elapsed, error != ICKERR_SUCCESS ? STATS_FAILED : 0);
+	if(error != ICKERR_SUCCESS) {
+		loggerPrintf(LOGGER_WARNING, "Error sending message to %s(%d): %d", toDeviceId,toService,error);
+		return "500 Internal Server Error";
+	}
+	return NULL;
+}
+
+struct _batchMessage {
+	const char* fromDeviceId;
+	const char* toDeviceId;
+	const char* toService;
+	const char* body;
+	size_t bodyLength;
+};
+
+// Send a batch of messages, each one framed as
+//   <fromDeviceId> <toDeviceId|-> <toService|-> <bodyLength>\n<body>
+// Returns the status codes of the messages separated by commas, or NULL if the batch is malformed
+// or can't be allocated, nothing is sent then
+char* sendBatch(char* batch, size_t batchLength)
+{
+	size_t count = 0;
+	size_t size = 16;
+	struct _batchMessage* messages = malloc(sizeof(struct _batchMessage)*size);
+	if(messages == NULL) {
+		return NULL;
+	}
+	char* end = batch+batchLength;
+	char* p = batch;
+
+	// The headers are split in place, all messages are parsed before anything is sent
+	while(p < end) {
+		char* newline = memchr(p, '\n', end-p);
+		if(newline == NULL) {
+			free(messages);
+			return NULL;
+		}
+		*newline = '\0';
+		if(count == size) {
+			struct _batchMessage* grown = realloc(messages, sizeof(struct _batchMessage)*size*2);
+			if(grown == NULL) {
+				loggerPrintf(LOGGER_ERROR, "Unable to allocate batch of more than %d messages",(int)count);
+				free(messages);
+				return NULL;
 			}
-			
+			messages = grown;
+			size *= 2;
+		}
+		struct _batchMessage* message = &messages[count];
+		char* strtokContext = NULL;
+		char* fromDeviceId = strtok_r(p, " ", &strtokContext);
+		char* toDeviceId = strtok_r(NULL, " ", &strtokContext);
+		char* toService = strtok_r(NULL, " ", &strtokContext);
+		char* length = strtok_r(NULL, " \r", &strtokContext);
+		char* lengthEnd = NULL;
+		long bodyLength = length != NULL ? strtol(length, &lengthEnd, 10) : -1;
+		if(length == NULL || lengthEnd == length || bodyLength < 0 || bodyLength > end-(newline+1)) {
+			free(messages);
+			return NULL;
+		}
+		message->fromDeviceId = fromDeviceId;
+		message->toDeviceId = strcmp(toDeviceId, "-") != 0 ? toDeviceId : NULL;
+		message->toService = strcmp(toService, "-") != 0 ? toService : NULL;
+		message->body = newline+1;
+		message->bodyLength = bodyLength;
+		count++;
+		p = newline+1+bodyLength;
+	}
+
+	// Three digits and a separator per message
+	char* statuses = malloc(count*4+1);
+	if(statuses == NULL) {
+		free(messages);
+		return NULL;
+	}
+	statuses[0] = '\0';
+	// The players are resolved and the messages sent with a single lock acquisition, which also
+	// keeps the contexts from being ended while they are used
+	size_t i;
+	pthread_rwlock_rdlock( &contextLock );
+	for(i=0;i<count;i++) {
+		const char* error = sendPlayerMessage(lookupPlayerContext(messages[i].fromDeviceId), messages[i].fromDeviceId, messages[i].toDeviceId, messages[i].toService, messages[i].body, messages[i].bodyLength);
+		sprintf(statuses+i*4, "%.3s%s", error != NULL ? error : "200", i+1 < count ? "," : "");
+	}
+	pthread_rwlock_unlock( &contextLock );
+	loggerPrintf(LOGGER_DEBUG, "Sent batch of %d messages: %s",(int)count,statuses);
+	free(messages);
+	return statuses;
+}
+
+// Execute a command received from the plugin, returns NULL on success or the HTTP status to answer with
+const char* executeCommand(const char* command, const char* fromDeviceId, const char* toDeviceId, const char* toServiceString, char* body, size_t bodyLength)
+{
+	char *strtokContext = NULL;
+	if(command == NULL || fromDeviceId == NULL || strlen(fromDeviceId) == 0) {
+		return "404 Not Found";
+	}else if(strcmp(command,"start")==0) {
+		const char* deviceName = body != NULL ? strtok_r(body, "\n\r",&strtokContext) : NULL;
+		if(deviceName == NULL) {
+			deviceName = fromDeviceId;
+		}
+		ickP2pContext_t* context = getContextForPlayer(fromDeviceId);
+		if(context == NULL) {
+			initPlayer(fromDeviceId,deviceName);
 		}else {
-			fprintf(stderr, "Fail to accept socket: %d\n",errno);
+			loggerPrintf(LOGGER_INFO, "Player already initialized");
+		}
+		return NULL;
+	}else if(strcmp(command,"sendMessage")==0) {
+		pthread_rwlock_rdlock( &contextLock );
+		const char* error = sendPlayerMessage(lookupPlayerContext(fromDeviceId), fromDeviceId, toDeviceId, toServiceString, body, bodyLength);
+		pthread_rwlock_unlock( &contextLock );
+		return error;
+	}else if(strcmp(command,"stop") == 0) {
+	    loggerPrintf(LOGGER_INFO, "Removing context for %s",fromDeviceId);
+		ickP2pContext_t* context = removePlayer(fromDeviceId);
+		if(context == NULL) {
+			return "401 Unauthorized";
 		}
+	    loggerPrintf(LOGGER_INFO, "Shutting down ickP2P for %s",fromDeviceId);
+	    ickP2pEnd(context,NULL);
+	    loggerPrintf(LOGGER_INFO, "Shutdown ickP2P for %s",fromDeviceId);
+		return NULL;
 	}
-	closesocket(listenfd);
+	return "404 Not Found";
 }
 
-char* httpRequest(const char* ip, int port, const char* path, const char* authorization, const char* fromDeviceId, ickP2pServicetype_t fromService, const char* toDeviceId, const char* requestData)
+void handleRequest(int fd, httpParser_t* request)
 {
-	int SIZE = 1023;
-	char buffer[SIZE+1];
-	char *request = NULL;
-    char *responseData = NULL;
-	char* responseBody = NULL;
-    struct sockaddr_in * server_addr = NULL;
-	int server_socket = socket(AF_INET, SOCK_STREAM, 0);
-	if(server_socket < 0) {
-		fprintf(stderr, "Unable to open socket: %d\n",server_socket);
-		goto httpRequest_end;
-	}
-
-	//printf("Getting address for %s and port %d\n",ip,port);
-	server_addr = (struct sockaddr_in *) malloc(sizeof(struct sockaddr_in));
-	server_addr->sin_family = AF_INET;
-	server_addr->sin_port = htons(port);
-	if(inet_pton(AF_INET,ip,(void *)(&(server_addr->sin_addr.s_addr))) <= 0) {
-		fprintf(stderr,"Unable to convert string IP to byte IP using inet_pton\n");
-		goto httpRequest_end;
-	}
-	bzero(&(server_addr->sin_zero), 8);
-	
-	struct timeval tv;
-	tv.tv_sec = 30;  // 30 Secs Timeout
-	tv.tv_usec = 0;  // Not init'ing this can cause strange errors
-	setsockopt(server_socket,SOL_SOCKET,SO_RCVTIMEO,(char *)&tv,sizeof(struct timeval));
-
-	int rc = connect(server_socket, 
-		(struct sockaddr *) server_addr, 
-		sizeof(struct sockaddr));
-	if(rc < 0) {
-		fprintf(stderr, "Fail to connect to socket: %d\n",errno);
-		goto httpRequest_end;
+	char *strtokContext = NULL;
+	char* method = request->method;
+	char* path = request->path;
+	char* prot = request->protocol;
+	char* body = request->body;
+	size_t bodyLength = request->contentLength;
+	const char* auth = httpParserHeader(request, "Authorization");
+
+	if(strcmp(method,"GET") == 0 && strncmp(path,"/stats",6) == 0 && (path[6] == '\0' || path[6] == '?')) {
+		char* report = statsReport();
+		if(report != NULL) {
+			writeSuccessBodyResponse(fd, "application/json", report);
+			free(report);
+		}else {
+			writeErrorResponse(fd, "500 Internal Server Error");
+		}
+		return;
 	}
-	char FROM_DEVICE_ID[]="fromDeviceId=";
-	char FROM_SERVICE[]="fromService=";
-	char TO_DEVICE_ID[]="toDeviceId=";
-	char *pathAndParameters = malloc(strlen(path)+1+strlen(FROM_DEVICE_ID)+strlen(fromDeviceId)+1+strlen(FROM_SERVICE)+2+1+strlen(TO_DEVICE_ID)+strlen(toDeviceId)+1);
-	sprintf(pathAndParameters, "%s?%s%s&%s%d&%s%s",path,FROM_DEVICE_ID,fromDeviceId,FROM_SERVICE,fromService,TO_DEVICE_ID,toDeviceId);
-	char *requestHeader;
-	const int CONTENT_LENGTH_SPACE = 10; // just allocate enough
-	if(authorization != NULL) {
-		requestHeader = "POST /%s HTTP/1.0\r\nHost: %s\r\nAuthorization: Basic %s\r\nX-Scanner: 1\r\nUser-Agent: ickHttpSqueezeboxPlayerDaemon/1.0\r\nContent-Type: application/json\r\nContent-Length: %d\r\n\r\n%s";
-		request = (char*)malloc(strlen(requestHeader)+strlen(authorization)+strlen(ip)+strlen(pathAndParameters)+CONTENT_LENGTH_SPACE+strlen(requestData)-8+1+23);
-		sprintf(request,requestHeader,pathAndParameters,ip,authorization,strlen(requestData),requestData);
+	if (auth) {
+		char fromDeviceId[100];
+		size_t fromDeviceIdLength = strcspn(auth, " ");
+		if(fromDeviceIdLength >= sizeof(fromDeviceId)) {
+			fromDeviceIdLength = sizeof(fromDeviceId)-1;
+		}
+		memcpy(fromDeviceId, auth, fromDeviceIdLength);
+		fromDeviceId[fromDeviceIdLength] = '\0';
+
+		// split path from param
+		path = strtok_r(path, "?",&strtokContext);
+
+		// split path: res = resource (null for search), req = request
+		char* command = strtok_r(path, "/",&strtokContext);
+		char* toDeviceId = strtok_r(NULL, "/",&strtokContext);
+		char* toServiceString = toDeviceId != NULL ? strtok_r(NULL, "?",&strtokContext) : NULL;
+
+		if(loggerEnabled(LOGGER_DEBUG)) {
+			char direction[256];
+			snprintf(direction, sizeof(direction), "GOT %s %s %s to %s from", method, command != NULL ? command : "(null)", prot, toDeviceId != NULL ? toDeviceId : "*");
+			loggerPayload(LOGGER_DEBUG, direction, fromDeviceId, body, bodyLength);
+		}
+		if(command != NULL && strcmp(command,"sendMessages") == 0) {
+			// Every message of the batch names its own player, the result lists the status of each message
+			char* statuses = sendBatch(body, bodyLength);
+			if(statuses != NULL) {
+				writeSuccessBodyResponse(fd, "text/plain", statuses);
+				free(statuses);
+			}else {
+				writeErrorResponse(fd, "400 Bad Request");
+			}
+			return;
+		}
+		const char* error = executeCommand(command, fromDeviceId, toDeviceId, toServiceString, body, bodyLength);
+		if(error != NULL) {
+			writeErrorResponse(fd, error);
+		}else {
+		    writeSuccessResponse(fd);
+		}
 	}else {
-		requestHeader = "POST /%s HTTP/1.0\r\nHost: %s\r\nUser-Agent: ickHttpSqueezeboxPlayerDaemon/1.0\r\nContent-Type: application/json\r\nContent-Length: %d\r\n\r\n%s";
-		request = (char*)malloc(strlen(requestHeader)+strlen(ip)+strlen(pathAndParameters)+CONTENT_LENGTH_SPACE+strlen(requestData)-8+1);
-		sprintf(request,requestHeader,pathAndParameters,ip,strlen(requestData),requestData);
+		writeErrorResponse(fd,"401 Unauthorized");
+	}
+}
+
+struct _httpServerConnection;
+struct _httpServerConnection {
+	int fd;
+	httpParser_t request;
+	time_t lastActivity;
+	struct _httpServerConnection* next;
+};
+
+struct _httpServerConnection* serverConnections = NULL;
+
+struct _requestJob {
+	int fd;
+	httpParser_t request;
+};
+
+static void requestJob(void* data)
+{
+	struct _requestJob* job = (struct _requestJob*)data;
+	handleRequest(job->fd, &job->request);
+	httpParserFree(&job->request);
+	free(job);
+}
+
+// Read what is available on a connection, returns 1 when a complete request is available, 0 if more data is needed and -1 if the connection failed
+static int readFromConnection(struct _httpServerConnection* conn)
+{
+	while(1) {
+		size_t available = 0;
+		char* buffer = httpParserBuffer(&conn->request, &available);
+		if(buffer == NULL || available == 0) {
+			return conn->request.state == HTTP_PARSER_ERROR ? 1 : -1;
+		}
+		int n = recv(conn->fd, buffer, available, 0);
+		if(n > 0) {
+			conn->lastActivity = time(NULL);
+			httpParserState_t state = httpParserConsume(&conn->request, n);
+			if(state == HTTP_PARSER_DONE || state == HTTP_PARSER_ERROR) {
+				return 1;
+			}
+		}else if(n == 0) {
+			return -1;
+		}else if(errno == EINTR) {
+			continue;
+		}else if(errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
+		}else {
+			return -1;
+		}
+	}
+}
+
+static void unlinkServerConnection(struct _httpServerConnection* conn)
+{
+	struct _httpServerConnection** next = &serverConnections;
+	while(*next != NULL) {
+		if(*next == conn) {
+			*next = conn->next;
+			break;
+		}
+		next = &((*next)->next);
+	}
+}
+
+static void closeServerConnection(int epollfd, struct _httpServerConnection* conn)
+{
+	epoll_ctl(epollfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	unlinkServerConnection(conn);
+	closesocket(conn->fd);
+	httpParserFree(&conn->request);
+	free(conn);
+}
+
+// Hand a completely received request over to the workers, requests from the same player are handled in order
+static void dispatchRequest(int epollfd, struct _httpServerConnection* conn)
+{
+	epoll_ctl(epollfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	unlinkServerConnection(conn);
+	int flags = fcntl(conn->fd, F_GETFL,0);
+	fcntl(conn->fd, F_SETFL, flags & ~O_NONBLOCK);
+
+	if(conn->request.state == HTTP_PARSER_ERROR) {
+		loggerPrintf(LOGGER_WARNING, "Invalid request: %s",conn->request.error);
+		writeErrorResponse(conn->fd, conn->request.error);
+		httpParserFree(&conn->request);
+		free(conn);
+		return;
+	}
+
+	// The parsed request is moved to the job, the buffer is not copied
+	struct _requestJob* job = malloc(sizeof(struct _requestJob));
+	job->fd = conn->fd;
+	job->request = conn->request;
+	free(conn);
+
+	const char* fromDeviceId = httpParserHeader(&job->request, "Authorization");
+	if(g_workerPool == NULL || workerPoolSubmit(g_workerPool, fromDeviceId, &requestJob, job) != 0) {
+		requestJob(job);
+	}
+}
+
+static void acceptConnections(int epollfd, int listenfd)
+{
+	while(1) {
+		struct sockaddr_in address;
+		socklen_t addrlen = sizeof(struct sockaddr_in);
+		int fd = accept(listenfd, (struct sockaddr *)&address, &addrlen);
+		if(fd < 0) {
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				loggerPrintf(LOGGER_ERROR, "Fail to accept socket: %d",errno);
+			}
+			return;
+		}
+		set_nonblock(fd);
+
+		struct _httpServerConnection* conn = malloc(sizeof(struct _httpServerConnection));
+		memset(conn, 0, sizeof(struct _httpServerConnection));
+		conn->fd = fd;
+		httpParserInit(&conn->request);
+		conn->lastActivity = time(NULL);
+
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN | EPOLLRDHUP;
+		event.data.ptr = conn;
+		if(epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+			loggerPrintf(LOGGER_ERROR, "Unable to watch socket: %d",errno);
+			closesocket(fd);
+			free(conn);
+			continue;
+		}
+		conn->next = serverConnections;
+		serverConnections = conn;
+	}
+}
+
+// Drop connections which haven't delivered a complete request in time
+static void closeIdleConnections(int epollfd)
+{
+	time_t now = time(NULL);
+	struct _httpServerConnection* conn = serverConnections;
+	while(conn != NULL) {
+		struct _httpServerConnection* next = conn->next;
+		if(now-conn->lastActivity > HTTP_SERVER_IDLE_TIMEOUT) {
+			loggerPrintf(LOGGER_DEBUG, "Closing idle connection %d",conn->fd);
+			closeServerConnection(epollfd, conn);
+		}
+		conn = next;
+	}
+}
+
+void httpServer(int listenfd)
+{
+	int epollfd = epoll_create(HTTP_SERVER_MAX_EVENTS);
+	if(epollfd < 0) {
+		loggerPrintf(LOGGER_ERROR, "Unable to create epoll instance: %d",errno);
+		closesocket(listenfd);
+		return;
+	}
+	set_nonblock(listenfd);
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	epoll_ctl(epollfd, EPOLL_CTL_ADD, listenfd, &event);
+
+	struct epoll_event events[HTTP_SERVER_MAX_EVENTS];
+	time_t lastIdleCheck = time(NULL);
+	while(!bShutdown) {
+		int n = epoll_wait(epollfd, events, HTTP_SERVER_MAX_EVENTS, 1000);
+		if(n < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			loggerPrintf(LOGGER_ERROR, "Fail to wait for sockets: %d",errno);
+			break;
+		}
+		int i;
+		for(i=0;i<n;i++) {
+			struct _httpServerConnection* conn = (struct _httpServerConnection*)events[i].data.ptr;
+			if(conn == NULL) {
+				acceptConnections(epollfd, listenfd);
+				continue;
+			}
+			int rc = readFromConnection(conn);
+			if(rc > 0) {
+				dispatchRequest(epollfd, conn);
+			}else if(rc < 0 || (events[i].events & (EPOLLERR | EPOLLHUP))) {
+				closeServerConnection(epollfd, conn);
+			}
+		}
+		if(time(NULL) != lastIdleCheck) {
+			closeIdleConnections(epollfd);
+			lastIdleCheck = time(NULL);
+		}
+	}
+	while(serverConnections != NULL) {
+		closeServerConnection(epollfd, serverConnections);
+	}
+	close(epollfd);
+	closesocket(listenfd);
+}
+
+// Control channel: a persistent connection on a unix domain socket used by the plugin instead of
+// one HTTP POST per command. Each request is framed as a header line followed by the body:
+//   <command> <sequence> <playerId> <toDeviceId|-> <toService|-> <bodyLength>\n<body>
+// and acknowledged, possibly out of order between players, with:
+//   <sequence> <HTTP status>\n
+// The sendMessages command carries a batch as described at sendBatch, its acknowledgement
+// is followed by a tab and the comma separated status codes of the messages.
+#define CONTROL_MAX_HEADER_SIZE 1024
+
+struct _controlConnection {
+	int fd;
+	// One reference for the reader thread and one for each queued request
+	int references;
+	pthread_mutex_t mutex;
+};
+
+struct _controlJob {
+	struct _controlConnection* conn;
+	char* sequence;
+	char* command;
+	char* playerId;
+	char* toDeviceId;
+	char* toService;
+	char* body;
+	size_t bodyLength;
+	// Header of the frame, the fields above except body point into it
+	char* frame;
+};
+
+static void releaseControlConnection(struct _controlConnection* conn)
+{
+	pthread_mutex_lock(&conn->mutex);
+	int references = --conn->references;
+	pthread_mutex_unlock(&conn->mutex);
+	if(references == 0) {
+		closesocket(conn->fd);
+		pthread_mutex_destroy(&conn->mutex);
+		free(conn);
 	}
+}
+
+static void writeControlResponse(struct _controlConnection* conn, const char* sequence, const char* status, const char* details)
+{
+	size_t size = strlen(sequence)+strlen(status)+(details != NULL ? strlen(details)+1 : 0)+3;
+	char* answer = malloc(size);
+	int length = snprintf(answer, size, details != NULL ? "%s %s\t%s\n" : "%s %s\n", sequence, status, details);
+	// Acknowledgements from different workers must not be interleaved
+	pthread_mutex_lock(&conn->mutex);
 	int sent = 0;
-	while(sent < strlen(request)) {
-		//printf("Forwarding request: ===============\n%s\n==============\n",request);
-		int bytes_sent = send(server_socket, request, strlen(request), 0);
-		if(bytes_sent < 0) {
-			fprintf(stderr, "Error when forwarding request data: %d\n",bytes_sent);
-			goto httpRequest_end;
+	while(sent < length) {
+		int n = send(conn->fd, answer+sent, length-sent, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR) {
+			continue;
 		}
-		sent = sent + bytes_sent;
+		if(n <= 0) {
+			loggerPrintf(LOGGER_WARNING, "Unable to write control response: %s %s",sequence,status);
+			break;
+		}
+		sent += n;
 	}
-	printf("Request successfully sent to perl module via HTTP\n");
-	fflush (stdout);
-	free(pathAndParameters);
+	pthread_mutex_unlock(&conn->mutex);
+	free(answer);
+}
 
-	//printf("Starting to read data\n");
-	int bytes_received = 0;
-	int total_bytes_received = 0;
-	while((bytes_received = recv(server_socket, buffer, SIZE, 0)) > 0) {
-		buffer[bytes_received] = '\0';
-		responseData = realloc(responseData,total_bytes_received+bytes_received+1);
-		if(responseData != NULL) {
-			memcpy(responseData+total_bytes_received, buffer, bytes_received + 1);
-			total_bytes_received += bytes_received;
-		}else {
-			fprintf(stderr, "Error allocating memory for response via HTTP\n");
-			goto httpRequest_end;
+static void controlJob(void* data)
+{
+	struct _controlJob* job = (struct _controlJob*)data;
+	if(loggerEnabled(LOGGER_DEBUG)) {
+		char direction[256];
+		snprintf(direction, sizeof(direction), "GOT CONTROL %s %s to %s from", job->command, job->sequence, job->toDeviceId != NULL ? job->toDeviceId : "*");
+		loggerPayload(LOGGER_DEBUG, direction, job->playerId, job->body, job->bodyLength);
+	}
+	if(strcmp(job->command, "sendMessages") == 0) {
+		char* statuses = sendBatch(job->body, job->bodyLength);
+		writeControlResponse(job->conn, job->sequence, statuses != NULL ? "200 OK" : "400 Bad Request", statuses);
+		free(statuses);
+	}else {
+		const char* error = executeCommand(job->command, job->playerId, job->toDeviceId, job->toService, job->body, job->bodyLength);
+		writeControlResponse(job->conn, job->sequence, error != NULL ? error : "200 OK", NULL);
+	}
+	releaseControlConnection(job->conn);
+	free(job->body);
+	free(job->frame);
+	free(job);
+}
+
+// Split a frame header in place, returns the body length or -1 if the header is invalid
+static long parseControlHeader(struct _controlJob* job)
+{
+	char* strtokContext = NULL;
+	job->command = strtok_r(job->frame, " ", &strtokContext);
+	job->sequence = strtok_r(NULL, " ", &strtokContext);
+	job->playerId = strtok_r(NULL, " ", &strtokContext);
+	job->toDeviceId = strtok_r(NULL, " ", &strtokContext);
+	job->toService = strtok_r(NULL, " ", &strtokContext);
+	char* length = strtok_r(NULL, " \r", &strtokContext);
+	if(length == NULL || strlen(job->sequence) > 64) {
+		return -1;
+	}
+	if(strcmp(job->toDeviceId, "-") == 0) {
+		job->toDeviceId = NULL;
+	}
+	if(strcmp(job->toService, "-") == 0) {
+		job->toService = NULL;
+	}
+	char* lengthEnd = NULL;
+	long value = strtol(length, &lengthEnd, 10);
+	if(lengthEnd == length || value < 0 || value > HTTP_PARSER_MAX_BODY_SIZE) {
+		return -1;
+	}
+	return value;
+}
+
+static int readControlFully(int fd, char* buffer, size_t length)
+{
+	size_t received = 0;
+	while(received < length) {
+		int n = recv(fd, buffer+received, length-received, 0);
+		if(n < 0 && errno == EINTR) {
+			continue;
 		}
+		if(n <= 0) {
+			return -1;
+		}
+		received += n;
 	}
-	if(bytes_received<0) {
-			fprintf(stderr, "Error reading response via HTTP: %d\n",errno);
+	return 0;
+}
+
+static void* controlConnectionThread(void* arg)
+{
+	struct _controlConnection* conn = (struct _controlConnection*)arg;
+	char header[CONTROL_MAX_HEADER_SIZE+1];
+	char buffer[4096];
+	size_t buffered = 0;
+	size_t headerLength = 0;
+
+	while(!bShutdown) {
+		// Collect the header line, the part of the buffer behind it belongs to the body
+		char* newline = memchr(buffer, '\n', buffered);
+		if(newline == NULL) {
+			if(headerLength+buffered > CONTROL_MAX_HEADER_SIZE) {
+				loggerPrintf(LOGGER_WARNING, "Control frame header too large, closing channel");
+				break;
+			}
+			memcpy(header+headerLength, buffer, buffered);
+			headerLength += buffered;
+			buffered = 0;
+			int n = recv(conn->fd, buffer, sizeof(buffer), 0);
+			if(n < 0 && errno == EINTR) {
+				continue;
+			}
+			if(n <= 0) {
+				break;
+			}
+			buffered = n;
+			continue;
+		}
+		size_t lineLength = newline-buffer;
+		if(headerLength+lineLength > CONTROL_MAX_HEADER_SIZE) {
+			loggerPrintf(LOGGER_WARNING, "Control frame header too large, closing channel");
+			break;
+		}
+		memcpy(header+headerLength, buffer, lineLength);
+		headerLength += lineLength;
+		header[headerLength] = '\0';
+		buffered -= lineLength+1;
+		memmove(buffer, newline+1, buffered);
+
+		struct _controlJob* job = malloc(sizeof(struct _controlJob));
+		memset(job, 0, sizeof(struct _controlJob));
+		job->frame = malloc(headerLength+1);
+		memcpy(job->frame, header, headerLength+1);
+		headerLength = 0;
+		long bodyLength = parseControlHeader(job);
+		if(bodyLength < 0) {
+			loggerPrintf(LOGGER_WARNING, "Invalid control frame: %s",header);
+			free(job->frame);
+			free(job);
+			break;
+		}
+
+		// The body gets its own zero terminated buffer, only the part still buffered is copied
+		job->bodyLength = bodyLength;
+		job->body = malloc(bodyLength+1);
+		size_t fromBuffer = buffered < job->bodyLength ? buffered : job->bodyLength;
+		memcpy(job->body, buffer, fromBuffer);
+		buffered -= fromBuffer;
+		memmove(buffer, buffer+fromBuffer, buffered);
+		if(readControlFully(conn->fd, job->body+fromBuffer, job->bodyLength-fromBuffer) < 0) {
+			free(job->body);
+			free(job->frame);
+			free(job);
+			break;
+		}
+		job->body[job->bodyLength] = '\0';
+
+		pthread_mutex_lock(&conn->mutex);
+		conn->references++;
+		pthread_mutex_unlock(&conn->mutex);
+		job->conn = conn;
+		if(g_workerPool == NULL || workerPoolSubmit(g_workerPool, job->playerId, &controlJob, job) != 0) {
+			controlJob(job);
+		}
 	}
+	loggerPrintf(LOGGER_DEBUG, "Control channel %d closed",conn->fd);
+	// Queued requests are still executed and acknowledged if possible
+	shutdown(conn->fd, SHUT_RD);
+	releaseControlConnection(conn);
+	return NULL;
+}
+
+static void* controlServerThread(void* arg)
+{
+	int listenfd = *(int*)arg;
+	free(arg);
+	while(!bShutdown) {
+		int fd = accept(listenfd, NULL, NULL);
+		if(fd < 0) {
+			if(errno != EINTR) {
+				loggerPrintf(LOGGER_ERROR, "Fail to accept control connection: %d",errno);
+				sleep(1);
+			}
+			continue;
+		}
+		struct _controlConnection* conn = malloc(sizeof(struct _controlConnection));
+		conn->fd = fd;
+		conn->references = 1;
+		pthread_mutex_init(&conn->mutex, NULL);
 
-	//printf("Finished reading, total=%d, last=%d\n",total_bytes_received,bytes_received);
-	if(responseData != NULL) {
-		char *bodyOffset = strstr(responseData, "\r\n\r\n");
-		if(bodyOffset != NULL) {
-			int bodySize = total_bytes_received-(bodyOffset+4-responseData)+1;
-			responseBody = malloc(bodySize);
-			memcpy(responseBody, bodyOffset+4, bodySize);
-			//printf("Got body:\n%s\n",responseBody);
+		pthread_t thread;
+		if(pthread_create(&thread, NULL, controlConnectionThread, conn) != 0) {
+			loggerPrintf(LOGGER_ERROR, "Unable to create control channel thread");
+			releaseControlConnection(conn);
+			continue;
 		}
+		pthread_detach(thread);
+		loggerPrintf(LOGGER_DEBUG, "Control channel %d opened",fd);
 	}
-httpRequest_end:
-	if(request) {
-		free(request);
+	return NULL;
+}
+
+// Listen for control channel connections on a unix domain socket, only the owner may connect
+int startControlServer(const char* socketPath)
+{
+	struct sockaddr_un address;
+	if(strlen(socketPath) >= sizeof(address.sun_path)) {
+		loggerPrintf(LOGGER_ERROR, "Control socket path too long: %s",socketPath);
+		return -1;
 	}
-	if(server_socket>=0) {
-		close(server_socket);
+	int listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(listenfd < 0) {
+		loggerPrintf(LOGGER_ERROR, "Unable to create control socket: %d",errno);
+		return -1;
 	}
-	if(server_addr) {
-		free(server_addr);
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketPath);
+	unlink(socketPath);
+	mode_t mask = umask(0077);
+	int result = bind(listenfd, (struct sockaddr *) &address, sizeof(address));
+	umask(mask);
+	if(result < 0 || listen(listenfd, 5) != 0) {
+		loggerPrintf(LOGGER_ERROR, "Unable to listen on control socket %s: %s",socketPath,strerror(last_error()));
+		closesocket(listenfd);
+		return -1;
 	}
-	if(responseData != NULL) {
-		free(responseData);
+	int* arg = malloc(sizeof(int));
+	*arg = listenfd;
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, controlServerThread, arg) != 0) {
+		loggerPrintf(LOGGER_ERROR, "Unable to create control server thread");
+		free(arg);
+		closesocket(listenfd);
+		unlink(socketPath);
+		return -1;
+	}
+	pthread_detach(thread);
+	loggerPrintf(LOGGER_INFO, "Listening for control channel on %s",socketPath);
+	return 0;
+}
+
+int httpRequest(const char* path, const char* fromDeviceId, ickP2pServicetype_t fromService, const char* toDeviceId, const char* requestData, size_t requestLength, httpResponse_t* response)
+{
+	char FROM_DEVICE_ID[]="fromDeviceId=";
+	char FROM_SERVICE[]="fromService=";
+	char TO_DEVICE_ID[]="toDeviceId=";
+	char *pathAndParameters = malloc(strlen(path)+1+strlen(FROM_DEVICE_ID)+strlen(fromDeviceId)+1+strlen(FROM_SERVICE)+3+1+strlen(TO_DEVICE_ID)+strlen(toDeviceId)+1);
+	sprintf(pathAndParameters, "%s?%s%s&%s%d&%s%s",path,FROM_DEVICE_ID,fromDeviceId,FROM_SERVICE,fromService,TO_DEVICE_ID,toDeviceId);
+	int result = httpPoolPost(g_httpPool, pathAndParameters, requestData, requestLength, response);
+	if(result == 0) {
+		loggerPrintf(LOGGER_DEBUG, "Request successfully sent to perl module via HTTP");
 	}
-	return responseBody;
+	free(pathAndParameters);
+	return result;
 }
 
 void discoveryCb(ickP2pContext_t *ictx, const char *szDeviceId, ickP2pDeviceState_t change, ickP2pServicetype_t service)
 {
-    printf("DISCOVERY %s type=%d services=%d\n",szDeviceId,(int)change,(int)service);
-	fflush (stdout);
+    loggerPrintf(LOGGER_INFO, "DISCOVERY %s type=%d services=%d",szDeviceId,(int)change,(int)service);
 	const char* destinationDeviceId = ickP2pGetDeviceUuid(ictx);
+	const char* status = NULL;
 	if(change == ICKP2P_CONNECTED) {
-		httpRequest(wrapperIP, wrapperPort, wrapperDiscoveryPath,wrapperAuthorization, szDeviceId, service, destinationDeviceId, "{\"status\": \"CONNECTED\"}");
+		status = "{\"status\": \"CONNECTED\"}";
 	}else if(change==ICKP2P_DISCONNECTED) {
-		httpRequest(wrapperIP, wrapperPort, wrapperDiscoveryPath,wrapperAuthorization, szDeviceId, service, destinationDeviceId, "{\"status\": \"DISCONNECTED\"}");
+		status = "{\"status\": \"DISCONNECTED\"}";
+	}
+	if(status != NULL && g_discoveryQueue != NULL) {
+		// Never block the ickP2p thread on the plugin, messages to all players would be delayed
+		discoveryQueuePush(g_discoveryQueue, destinationDeviceId, szDeviceId, service, change == ICKP2P_CONNECTED ? "CONNECTED" : "DISCONNECTED");
+	}else if(status != NULL) {
+		httpResponse_t response;
+		if(httpRequest(wrapperDiscoveryPath, szDeviceId, service, destinationDeviceId, status, strlen(status), &response) == 0) {
+			httpResponseFree(&response);
+		}
 	}
 }
 
 void messageCb(ickP2pContext_t *ictx, const char *szSourceDeviceId, ickP2pServicetype_t sourceService, ickP2pServicetype_t targetService, const char* message, size_t messageLength, ickP2pMessageFlag_t mFlags )
 {
-	char* terminatedMessage = NULL;
-	if(messageLength>0) {
-		terminatedMessage = malloc(messageLength+1);
-		memcpy(terminatedMessage,message,messageLength);
-		terminatedMessage[(int)messageLength]='\0';
-		printf("%p: From %s: %s\n", ictx , szSourceDeviceId, terminatedMessage);
-	}else {
-		printf("%p: From %s: %s\n", ictx , szSourceDeviceId, message);
+	if(messageLength == 0) {
+		messageLength = strlen(message);
 	}
-	fflush (stdout);
+	long long received = statsNow();
+	loggerPayload(LOGGER_DEBUG, "From", szSourceDeviceId, message, messageLength);
+	statsInFlight(1);
 	const char* destinationDeviceId = ickP2pGetDeviceUuid(ictx);
-	char* response = NULL;
-	if(terminatedMessage != NULL) {
-		response = httpRequest(wrapperIP, wrapperPort, wrapperPath,wrapperAuthorization, szSourceDeviceId, sourceService, destinationDeviceId, terminatedMessage);
-	}else {
-		response = httpRequest(wrapperIP, wrapperPort, wrapperPath,wrapperAuthorization, szSourceDeviceId, sourceService, destinationDeviceId, message);
-	}
-    if( response ) {
-        printf("To %s: %s\n",szSourceDeviceId, response);
-        fflush (stdout);
-        ickErrcode_t error = ickP2pSendMsg(ictx,szSourceDeviceId, sourceService,ICKP2P_SERVICE_SERVER_GENERIC,response, strlen(response));
+	httpResponse_t response;
+	size_t responseLength = 0;
+	int flags = STATS_FAILED;
+    if( httpRequest(wrapperPath, szSourceDeviceId, sourceService, destinationDeviceId, message, messageLength, &response) == 0 ) {
+        statsRecordHttp(&response);
+        loggerPayload(LOGGER_DEBUG, "To", szSourceDeviceId, response.body, response.bodyLength);
+        // The body is sent straight out of the receive buffer
+        long long started = statsNow();
+        ickErrcode_t error = ickP2pSendMsg(ictx,szSourceDeviceId, sourceService,ICKP2P_SERVICE_SERVER_GENERIC,response.body, response.bodyLength);
+        statsRecordStage(STATS_STAGE_P2P_SEND, statsNow()-started);
         if(error != ICKERR_SUCCESS) {
-    		fprintf(stderr,"Failed to send response=%d\n",(int)error);
+    		loggerPrintf(LOGGER_ERROR, "Failed to send response=%d",(int)error);
+    	}else if(response.status == 200) {
+    		flags = 0;
     	}
+        responseLength = response.bodyLength;
+		httpResponseFree(&response);
     }
-	if(response != NULL) {
-		free(response);
-		response = NULL;
-	}
-	if(terminatedMessage != NULL) {
-		free(terminatedMessage);
-		terminatedMessage = NULL;
-	}
+	long long total = statsNow()-received;
+	statsRecordStage(STATS_STAGE_TOTAL, total);
+	statsRecord(message, messageLength, szSourceDeviceId, messageLength, responseLength, total, flags);
+	statsInFlight(-1);
 }
 	
 static void shutdownHandler( int sig, siginfo_t *siginfo, void *context )
@@ -494,8 +1094,53 @@ static void shutdownHandler( int sig, siginfo_t *siginfo, void *context )
 
 int main( int argc, char *argv[] )
 {
+	int option;
+	loggerDefaultOptions(&loggerOptions);
+	while((option = getopt(argc, argv, "+w:s:n:c:K:C:u:N:M:d:" LOGGER_GETOPT)) != -1) {
+		switch(option) {
+			case 'w':
+				workerCount = atoi(optarg);
+				break;
+			case 's':
+				contentServerDeviceId = optarg;
+				break;
+			case 'n':
+				contentServerDeviceName = optarg;
+				break;
+			case 'c':
+				contentServerPath = optarg;
+				break;
+			case 'K':
+				responseCacheSize = atoi(optarg);
+				break;
+			case 'C':
+				responseCacheMethods = optarg;
+				break;
+			case 'u':
+				controlSocketPath = optarg;
+				break;
+			case 'N':
+				coalescingWindow = atoi(optarg);
+				break;
+			case 'M':
+				coalescingMethods = optarg;
+				break;
+			case 'd':
+				discoveryDelay = atoi(optarg);
+				break;
+			default:
+				loggerParseOption(&loggerOptions, option, optarg);
+				break;
+		}
+	}
+	argc -= optind-1;
+	argv += optind-1;
 	if(argc != 6 && argc != 7) {
-		printf("Usage: %s IP-address daemonPort wrapperURL logFile authorizationHeader\n",argv[0]);
+		printf("Usage: %s [-w workers] [-s serverDeviceId -n serverDeviceName -c contentServicePath [-K cacheSizeKB [-C cachedMethods]]] [-u controlSocket] [-N coalescingWindowMs [-M methods]] [-d discoveryDelayMs] " LOGGER_USAGE " IP-address daemonPort wrapperURL discoveryPath logFile authorizationHeader\n",argv[0]);
+		return 0;
+	}
+	if(contentServerDeviceId != NULL && contentServerPath == NULL) {
+		loggerPrintf(LOGGER_ERROR, "The content service path is required when hosting the content server");
 		return 0;
 	}
     networkAddress = argv[1];
@@ -510,32 +1155,43 @@ int main( int argc, char *argv[] )
     char host[100];
 	memset(wrapperPath, 0, 1024);
 	memset(host, 0, 100);
-	printf("Parsing url...%s\n",wrapperURL);
+	loggerPrintf(LOGGER_DEBUG, "Parsing url...%s",wrapperURL);
 	sscanf(wrapperURL, "http://%99[^:]:%99d/%99[^\n]", host, &wrapperPort, wrapperPath);
     
-	printf("Parsed...\n");
+	loggerPrintf(LOGGER_DEBUG, "Parsed...");
 	if(strlen(host)==0) {
-		printf("Unable to parse host from URL\n");
+		loggerPrintf(LOGGER_ERROR, "Unable to parse host from URL");
 		return 0;
 	}else {
-		printf("Parsed url: %s, %d, %s\n",host,wrapperPort,wrapperPath);
+		loggerPrintf(LOGGER_DEBUG, "Parsed url: %s, %d, %s",host,wrapperPort,wrapperPath);
 		struct hostent *hent = NULL;
 		memset(wrapperIP, 0, 16);
 		if((hent = (struct hostent *)gethostbyname(host)) == NULL)
 		{
-			printf("Unable to get host information for hostname\n");
+			loggerPrintf(LOGGER_ERROR, "Unable to get host information for hostname");
 			return 0;
 		}
 		if(inet_ntop(AF_INET, (void *)hent->h_addr_list[0], wrapperIP, 15) == NULL)
 		{
-			printf("Can't resolve host to IP\n");
+			loggerPrintf(LOGGER_ERROR, "Can't resolve host to IP");
 			return 0;
 		}
 	}
 	if(strlen(wrapperPath)==0) {
-		printf("Unable to parse path from URL\n");
+		loggerPrintf(LOGGER_ERROR, "Unable to parse path from URL");
 		return 0;
 	}
+	// The discovery path is given with a leading slash
+	while(*wrapperDiscoveryPath == '/') {
+		wrapperDiscoveryPath++;
+	}
+	if(contentServerPath != NULL) {
+		while(*contentServerPath == '/') {
+			contentServerPath++;
+		}
+	}
+	statsInit();
+	g_httpPool = httpPoolCreate(wrapperIP, wrapperPort, wrapperAuthorization, "ickHttpSqueezeboxPlayerDaemon/1.0", 4);
 
 	
 	int listenfd;
@@ -549,29 +1205,25 @@ int main( int argc, char *argv[] )
 	serv_addr.sin_addr.s_addr = INADDR_ANY;
 	serv_addr.sin_port = htons(daemonPort);
 
-	printf("Binding socket %d to port: %d\n",listenfd,daemonPort);
+	loggerPrintf(LOGGER_INFO, "Binding socket %d to port: %d",listenfd,daemonPort);
 	if (bind(listenfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
-		printf("Error on bind listenfd: %s", strerror(last_error()));
+		loggerPrintf(LOGGER_ERROR, "Error on bind listenfd: %s", strerror(last_error()));
 		return 0;
 	}
 
-	printf("Listening to socket\n");
+	loggerPrintf(LOGGER_INFO, "Listening to socket");
 	if(listen(listenfd, 20)!=0) {
-		printf("Fail to listen to socket: %d\n",errno);
+		loggerPrintf(LOGGER_ERROR, "Fail to listen to socket: %d",errno);
 	}
 
     int fd1 = open( "/dev/null", O_RDWR, 0 );
-    int fd2 = open( logFile, O_RDWR|O_CREAT|O_TRUNC, 0644 );
     if( fd1!=-1) {
       dup2(fd1, fileno(stdin));
     }
-    if( fd2!=-1) {
-      dup2(fd2, fileno(stdout));
-      dup2(fd2, fileno(stderr));
-    }
+    loggerStart(logFile, &loggerOptions);
 
 #ifdef DEBUG
-    printf("ickP2pSetLogLevel(7)\n");
+    loggerPrintf(LOGGER_DEBUG, "ickP2pSetLogLevel(7)");
     ickP2pSetLogging(7,stderr,100);
 #elif ICK_DEBUG
     ickP2pSetLogging(6,NULL,100);
@@ -584,7 +1236,46 @@ int main( int argc, char *argv[] )
     sigaction( SIGINT, &act, NULL );
     sigaction( SIGTERM, &act, NULL );
 
+	if(workerCount > 0) {
+		g_workerPool = workerPoolCreate(workerCount);
+	}
+	if(contentServerDeviceId != NULL) {
+		// The content server shares the LMS connections and the worker threads with the players
+		if(contentServerDeviceName == NULL) {
+			contentServerDeviceName = contentServerDeviceId;
+		}
+	    loggerPrintf(LOGGER_INFO, "Initializing ickP2P for content server %s(%s) at %s...",contentServerDeviceName,contentServerDeviceId,networkAddress);
+	    loggerPrintf(LOGGER_INFO, "- Using path: /%s",contentServerPath);
+		if(responseCacheSize > 0) {
+			loggerPrintf(LOGGER_INFO, "- Caching up to %d KB of responses to: %s",responseCacheSize,responseCacheMethods);
+			g_responseCache = responseCacheCreate((size_t)responseCacheSize*1024, responseCacheMethods);
+		}
+		g_contentServerContext = contentServerStart(networkAddress, contentServerDeviceId, contentServerDeviceName, contentServerPath, g_httpPool, g_workerPool, g_responseCache);
+	}
+	g_discoveryQueue = discoveryQueueCreate(g_httpPool, wrapperDiscoveryPath, discoveryDelay);
+	if(coalescingWindow > 0) {
+		loggerPrintf(LOGGER_INFO, "Coalescing %s notifications within %dms",coalescingMethods,coalescingWindow);
+		g_coalescer = coalescerCreate(coalescingWindow, coalescingMethods, &sendCoalescedNotification);
+	}
+	if(controlSocketPath != NULL) {
+		startControlServer(controlSocketPath);
+	}
 	httpServer(listenfd);
+	if(controlSocketPath != NULL) {
+		unlink(controlSocketPath);
+	}
+	// Queued requests are answered before the content server context they are answered through is ended
+	workerPoolShutdown(g_workerPool);
+	if(g_contentServerContext != NULL) {
+	    loggerPrintf(LOGGER_INFO, "Shutting down ickP2P for %s",contentServerDeviceName);
+		contentServerStop(g_contentServerContext);
+	}
+	workerPoolDestroy(g_workerPool);
+	responseCacheDestroy(g_responseCache);
+	coalescerDestroy(g_coalescer);
+	discoveryQueueDestroy(g_discoveryQueue);
+	httpPoolDestroy(g_httpPool);
+	loggerStop();
 	
 	return 1;
 }
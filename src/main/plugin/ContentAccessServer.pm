@@ -79,6 +79,43 @@ sub binaries {
 	return (undef,undef);
 }
 
+# Returns the ickStream device id and name of the content server, the
+# device id is created on first use
+sub identity {
+	my $class = shift;
+
+	my $serverName = $sprefs->get('libraryname');
+	if(!defined($serverName) || $serverName eq '') {
+		$serverName = Slim::Utils::Network::hostName();
+	}
+	$log->debug("With name: $serverName");
+
+	my $serverUUID = $prefs->get('uuid');
+	if(!defined($serverUUID)) {
+		$log->debug("No ickStream id created, creating a new one...");
+		$serverUUID = uc(UUID::Tiny::create_UUID_as_string( UUID::Tiny::UUID_V4() ));
+		$prefs->set('uuid',$serverUUID);
+	}
+	$log->debug("Using ickStream identity: $serverUUID");
+	return ($serverUUID, $serverName);
+}
+
+# Returns the daemon options for caching responses to read-only requests
+sub cacheArguments {
+	my $class = shift;
+
+	my $cacheSize = $prefs->get('contentCacheSize');
+	if(!$cacheSize) {
+		return ();
+	}
+	$log->debug("Caching up to $cacheSize KB of responses");
+	my @args = ("-K", $cacheSize);
+	if($prefs->get('contentCacheMethods')) {
+		push @args, ("-C", $prefs->get('contentCacheMethods'));
+	}
+	return @args;
+}
+
 sub start {
 	my ($class, $plugin) = @_;
 	$PLUGIN = $plugin;
@@ -142,19 +179,7 @@ sub start {
 		$log->debug("Calculated authorization token");
 	}
 
-	my $serverName = $sprefs->get('libraryname');
-	if(!defined($serverName) || $serverName eq '') {
-		$serverName = Slim::Utils::Network::hostName();
-	}
-	$log->debug("With name: $serverName");
-
-	my $serverUUID = $prefs->get('uuid');
-	if(!defined($serverUUID)) {
-		$log->debug("No ickStream id created, creating a new one...");
-		$serverUUID = uc(UUID::Tiny::create_UUID_as_string( UUID::Tiny::UUID_V4() ));
-		$prefs->set('uuid',$serverUUID);
-	}
-	$log->debug("Using ickStream identity: $serverUUID");
+	my ($serverUUID, $serverName) = $class->identity();
 
     my $serverIP = Slim::Utils::IPDetect::IP();
     if(!$serverIP) {
@@ -163,7 +188,8 @@ sub start {
     }
 	$log->debug("Local IP-address: $serverIP");
 
-	my @cmd = ($serverPath, $serverIP, $serverUUID, $serverName, $endpoint, $serverLog);
+	# Without debug logging the output is discarded anyway, only errors are formatted
+	my @cmd = ($serverPath, $class->cacheArguments(), "-L", ($log->is_debug() ? "debug" : "error"), $serverIP, $serverUUID, $serverName, $endpoint, $serverLog);
 	$log->info("Starting server");
 
 	$log->debug("cmdline: ", join(' ', @cmd));
@@ -35,6 +35,7 @@ use Slim::Web::JSONRPC;
 
 use HTTP::Status qw(RC_OK);
 use JSON::XS::VersionOneAndTwo;
+use MIME::Base64;
 use Scalar::Util qw(blessed);
 use Slim::Web::HTTP;
 use HTTP::Status qw(RC_MOVED_TEMPORARILY RC_NOT_FOUND);
@@ -45,6 +46,9 @@ use Slim::Utils::Strings qw(string);
 
 
 use Plugins::IckStreamPlugin::JsonHandler;
+use Plugins::IckStreamPlugin::LibraryIndex;
+use Plugins::IckStreamPlugin::RandomTrackPool;
+use Plugins::IckStreamPlugin::JsonFragmentCache;
 
 my $log = logger('plugin.ickstream.content');
 my $prefs  = preferences('plugin.ickstream');
@@ -64,6 +68,17 @@ my %methods = (
         'findItems'        => \&findItems,
         'getNextDynamicPlaylistTracks'        => \&getNextDynamicPlaylistTracks,
         'getItem'	=> \&getItem,
+        'getLastScannedTime'	=> \&getLibraryState,
+);
+
+# the query selecting random tracks for each supported dynamic playlist type
+my %dynamicPlaylistSelections = (
+		'RANDOM_ALL'	=> \&queryNextDynamicPlaylistTracks,
+		'RANDOM_MY_LIBRARY'	=> \&queryNextDynamicPlaylistTracks,
+		'RANDOM_MY_PLAYLISTS'	=> \&queryNextDynamicPlaylistTracksFromMyPlaylists,
+		'RANDOM_FOR_ARTIST'	=> \&queryNextDynamicPlaylistTracksFromArtist,
+		'RANDOM_FOR_PLAYLIST'	=> \&queryNextDynamicPlaylistTracksFromPlaylist,
+		'RANDOM_FOR_CATEGORY'	=> \&queryNextDynamicPlaylistTracksFromCategory,
 );
 
 sub init {
@@ -743,6 +758,19 @@ sub getLastScannedTime {
 	}
 }
 
+# Used by the daemons to invalidate their response cache, the result changes
+# after each scan and all the time while a scan is running
+sub getLibraryState {
+	my $context = shift;
+	if ( $log->is_debug ) {
+	        $log->debug( "getLastScannedTime()" );
+	}
+	my $result = {
+		'lastChanged' => Slim::Music::Import->stillScanning() ? time() : (Slim::Music::Import->lastScanTime || 0)
+	};
+	Plugins::IckStreamPlugin::JsonHandler::requestWrite($result, $context->{'httpClient'}, $context);
+}
+
 sub getItem {
 	my $context = shift;
 
@@ -796,6 +824,13 @@ sub findItems {
 		my $count = $reqParams->{'count'} if exists($reqParams->{'count'});
 		my $offset = $reqParams->{'offset'} || 0;
 
+		# A continuation from a previous page is used instead of the offset, the
+		# sort keys in it let the next page start without skipping offset rows
+		my $continuation = undef;
+		if(defined($reqParams->{'continuation'})) {
+			($offset,$continuation) = decodeContinuation($reqParams->{'continuation'});
+		}
+
 		if(defined($reqParams->{'search'})) {
 			if(!defined($count)) {
 				$count = 200 - $offset;
@@ -805,15 +840,16 @@ sub findItems {
 		}
 
 		my $items = undef;
+		my $lastKeys = undef;
 		if(!defined($reqParams->{'search'}) || $count>0) {		
 			if(exists($reqParams->{'type'}) && $reqParams->{'type'} eq 'album') {
-				$items = findAlbums($reqParams,$offset,$count);
+				($items,$lastKeys) = findAlbums($reqParams,$offset,$count,$continuation);
 			} elsif(exists($reqParams->{'type'}) && $reqParams->{'type'} eq 'playlist') {
-				$items = findPlaylists($reqParams,$offset,$count);
+				($items,$lastKeys) = findPlaylists($reqParams,$offset,$count,$continuation);
 			} elsif(exists($reqParams->{'type'}) && $reqParams->{'type'} eq 'artist') {
-				$items = findArtists($reqParams,$offset,$count);
+				($items,$lastKeys) = findArtists($reqParams,$offset,$count,$continuation);
 			} elsif(exists($reqParams->{'type'}) && $reqParams->{'type'} eq 'track') {
-				$items = findTracks($reqParams,$offset,$count);
+				($items,$lastKeys) = findTracks($reqParams,$offset,$count,$continuation);
 			} elsif(exists($reqParams->{'type'}) && $reqParams->{'type'} eq 'category') {
 				$items = findCategories($reqParams,$offset,$count);
 			} elsif(exists($reqParams->{'type'}) && $reqParams->{'type'} eq 'decade') {
@@ -833,6 +869,10 @@ sub findItems {
 				'lastChanged' => getLastScannedTime(),
 				'items' => $items
 			};
+			# Only a full page can be followed by another one
+			if(defined($count) && $count>0 && scalar(@$items)==$count) {
+				$result->{'continuation'} = encodeContinuation($offset+$count,$lastKeys);
+			}
 		}else {
 			my @empty = ();
 			$result = {
@@ -851,6 +891,136 @@ sub findItems {
     }
 }
 
+# The continuation returned with a page of findItems results is the offset of
+# the next page together with the sort keys of the last item, for the types
+# without keyset support it only contains the offset.
+sub encodeContinuation {
+	my $offset = shift;
+	my $keys = shift;
+
+	my @continuation = ($offset);
+	if(defined($keys)) {
+		push @continuation,@$keys;
+	}
+	return encode_base64(to_json(\@continuation),'');
+}
+
+sub decodeContinuation {
+	my $continuation = shift;
+
+	my $decoded = eval { from_json(decode_base64($continuation)) };
+	if(!defined($decoded) || ref($decoded) ne 'ARRAY' || scalar(@$decoded)==0 || $decoded->[0] !~ /^\d+$/) {
+		$log->warn("Ignoring invalid continuation: $continuation");
+		return (0,undef);
+	}
+	my ($offset,@keys) = @$decoded;
+	if(scalar(@keys)==0) {
+		return ($offset,undef);
+	}
+	for my $key (@keys) {
+		# Keys are bound as they were read from the database, not as decoded JSON strings
+		utf8::downgrade($key,1) if defined($key);
+	}
+	return ($offset,\@keys);
+}
+
+# A keyset is the ORDER BY of a find* query as a list of [expression, collation, descending],
+# its last expression must be unique to make the order total. The expressions are selected
+# as the last columns so the keys of the last row can be returned as continuation.
+sub keysetColumns {
+	my $keyset = shift;
+
+	return join('',map { ','.$_->[0] } @$keyset);
+}
+
+sub keysetOrderBy {
+	my $keyset = shift;
+
+	return join(', ',map { keysetExpression($_).($_->[2]?' desc':'') } @$keyset);
+}
+
+sub keysetExpression {
+	my $key = shift;
+
+	return $key->[0].($key->[1]?' '.$key->[1]:'');
+}
+
+# Returns the WHERE directive matching the rows after the continuation keys, e.g.
+# "a>=? AND (a>? OR (a=? AND b>?))", its values are added to $whereDirectiveValues.
+# The leading range on the first key lets SQLite use an index on it.
+sub keysetDirective {
+	my $keyset = shift;
+	my $keys = shift;
+	my $whereDirectiveValues = shift;
+
+	my $first = $keyset->[0];
+	my $directive = keysetExpression($first).($first->[2]?'<=?':'>=?');
+	push @$whereDirectiveValues,$keys->[0];
+
+	my @alternatives = ();
+	for(my $i=0;$i<scalar(@$keyset);$i++) {
+		my @conditions = ();
+		for(my $j=0;$j<$i;$j++) {
+			push @conditions,keysetExpression($keyset->[$j]).'=?';
+			push @$whereDirectiveValues,$keys->[$j];
+		}
+		push @conditions,keysetExpression($keyset->[$i]).($keyset->[$i]->[2]?'<?':'>?');
+		push @$whereDirectiveValues,$keys->[$i];
+		push @alternatives,'('.join(' AND ',@conditions).')';
+	}
+	return $directive.' AND ('.join(' OR ',@alternatives).')';
+}
+
+# The FROM clause of a find* query for $table, limited to the rows matching the search if one is given.
+# The match of the search is then the first placeholder of the query. Search results are ordered by
+# relevance and limited to 200 rows anyway, they are paged by offset instead of keyset.
+sub searchFrom {
+	my $search = shift;
+	my $table = shift;
+
+	if(defined($search)) {
+		return $search->{'from'}."JOIN $table ON $table.id=search.id ";
+	}
+	return "$table ";
+}
+
+sub searchOrderBy {
+	my $search = shift;
+
+	if(defined($search) && defined($search->{'order_by'})) {
+		return $search->{'order_by'}.', ';
+	}
+	return '';
+}
+
+# A continuation can only be used with the keyset of the query it was returned by
+sub isKeysetContinuation {
+	my $keyset = shift;
+	my $keys = shift;
+
+	if(!defined($keys) || scalar(@$keys)!=scalar(@$keyset)) {
+		return 0;
+	}
+	for my $key (@$keys) {
+		return 0 if !defined($key);
+	}
+	return 1;
+}
+
+# Binds the keyset columns following the $column columns read by the process*Result functions,
+# after the result has been processed they contain the keys of the last row
+sub bindKeyset {
+	my $sth = shift;
+	my $column = shift;
+	my $keyset = shift;
+
+	my @keys = (undef) x scalar(@$keyset);
+	for(my $i=0;$i<scalar(@keys);$i++) {
+		$sth->bind_col($column+$i+1,\$keys[$i]);
+	}
+	return \@keys;
+}
+
 sub getServiceInformation {
 	my $context = shift;
 	if ( $log->is_debug ) {
@@ -898,7 +1068,10 @@ sub getProtocolVersions {
 sub getCategory {
 	my $genreId = shift;
 
-	my $sql = 'SELECT genres.id,genres.name,genres.namesort FROM genres ';
+	my $sql = 'SELECT genres.id,genres.name,genres.namesort,NULL FROM genres ';
+	if(Plugins::IckStreamPlugin::LibraryIndex::isCurrent()) {
+		$sql = 'SELECT genres.id,genres.name,genres.namesort,genres.artwork FROM ickstream_genres AS genres ';
+	}
 	my $collate = Slim::Utils::OSDetect->getOS()->sqlHelperClass()->collate();
 	my $order_by = "genres.namesort $collate";
 
@@ -941,7 +1114,10 @@ sub findCategories {
 	my @whereDirectiveValues = ();
 	my @whereSearchDirectives = ();
 	my @whereSearchDirectiveValues = ();
-	my $sql = 'SELECT genres.id,genres.name,genres.namesort FROM genres ';
+	my $sql = 'SELECT genres.id,genres.name,genres.namesort,NULL FROM genres ';
+	if(Plugins::IckStreamPlugin::LibraryIndex::isCurrent()) {
+		$sql = 'SELECT genres.id,genres.name,genres.namesort,genres.artwork FROM ickstream_genres AS genres ';
+	}
 	my $order_by = undef;
 	my $collate = Slim::Utils::OSDetect->getOS()->sqlHelperClass()->collate();
 	$order_by = "genres.namesort $collate";
@@ -967,16 +1143,25 @@ sub processCategoryResult {
 	my $collate = Slim::Utils::OSDetect->getOS()->sqlHelperClass()->collate();
 
 	my @items = ();
+	my $useFragments = Plugins::IckStreamPlugin::JsonFragmentCache::isAvailable();
 	
 	my $genreId;
 	my $genreName;
 	my $genreSortName;
+	my $genreCover;
 	
 	$sth->bind_col(1,\$genreId);
 	$sth->bind_col(2,\$genreName);
 	$sth->bind_col(3,\$genreSortName);
+	$sth->bind_col(4,\$genreCover);
 	
 	while ($sth->fetch) {
+		my $fragmentKey = "category:$genreId";
+		my $fragment = $useFragments ? Plugins::IckStreamPlugin::JsonFragmentCache::get($fragmentKey) : undef;
+		if(defined($fragment)) {
+			push @items,$fragment;
+			next;
+		}
 		utf8::decode($genreName);
 		utf8::decode($genreSortName);
 		
@@ -994,7 +1179,11 @@ sub processCategoryResult {
 		
 		$item->{'sortText'} = $genreSortName;
 		
-		push @items,$item;
+		if(defined($genreCover)) {
+			$item->{'image'} = "service://".getServiceId()."/music/$genreCover/cover";
+		}
+
+		push @items,($useFragments ? Plugins::IckStreamPlugin::JsonFragmentCache::set($fragmentKey,$item) : $item);
 	}
 	$sth->finish();
 	return \@items;		
@@ -1012,7 +1201,10 @@ sub findYears {
 	my @whereDirectiveValues = ();
 	my @whereSearchDirectives = ();
 	my @whereSearchDirectiveValues = ();
-	my $sql = 'SELECT years.id FROM years ';
+	my $sql = 'SELECT years.id,NULL FROM years ';
+	if(Plugins::IckStreamPlugin::LibraryIndex::isCurrent()) {
+		$sql = 'SELECT years.id,years.artwork FROM ickstream_years AS years ';
+	}
 	my $order_by = undef;
 	$order_by = "years.id desc";
 
@@ -1036,13 +1228,22 @@ sub processYearResult {
 	my $serverPrefix = getServerId();
 
 	my @items = ();
+	my $useFragments = Plugins::IckStreamPlugin::JsonFragmentCache::isAvailable();
 	
 	my $yearId;
 	my $yearName;
+	my $yearCover;
 	
 	$sth->bind_col(1,\$yearId);
+	$sth->bind_col(2,\$yearCover);
 	
 	while ($sth->fetch) {
+		my $fragmentKey = "year:$yearId";
+		my $fragment = $useFragments ? Plugins::IckStreamPlugin::JsonFragmentCache::get($fragmentKey) : undef;
+		if(defined($fragment)) {
+			push @items,$fragment;
+			next;
+		}
 		if($yearId == 0) {
 			$yearName = string('UNK');
 		}else {
@@ -1058,7 +1259,11 @@ sub processYearResult {
 			}
 		};
 		
-		push @items,$item;
+		if(defined($yearCover)) {
+			$item->{'image'} = "service://".getServiceId()."/music/$yearCover/cover";
+		}
+
+		push @items,($useFragments ? Plugins::IckStreamPlugin::JsonFragmentCache::set($fragmentKey,$item) : $item);
 	}
 	$sth->finish();
 	return \@items;		
@@ -1075,11 +1280,15 @@ sub findDecades {
 	my @whereDirectiveValues = ();
 	my @whereSearchDirectives = ();
 	my @whereSearchDirectiveValues = ();
-	my $sql = 'SELECT floor(years.id/10)*10 FROM years ';
+	my $sql = 'SELECT floor(years.id/10)*10,NULL FROM years ';
 	my $order_by = undef;
 	$order_by = "years.id desc";
 
-	$sql .= "GROUP BY floor(years.id/10)*10 ORDER BY $order_by";
+	if(Plugins::IckStreamPlugin::LibraryIndex::isCurrent()) {
+		$sql = "SELECT decades.id,decades.artwork FROM ickstream_decades AS decades ORDER BY decades.id desc";
+	}else {
+		$sql .= "GROUP BY floor(years.id/10)*10 ORDER BY $order_by";
+	}
 	if(defined($count)) {
 		$sql .= " LIMIT $offset, $count";
 	}
@@ -1099,13 +1308,22 @@ sub processDecadeResult {
 	my $serverPrefix = getServerId();
 
 	my @items = ();
+	my $useFragments = Plugins::IckStreamPlugin::JsonFragmentCache::isAvailable();
 	
 	my $decadeId;
 	my $decadeName;
+	my $decadeCover;
 	
 	$sth->bind_col(1,\$decadeId);
+	$sth->bind_col(2,\$decadeCover);
 	
 	while ($sth->fetch) {
+		my $fragmentKey = "decade:$decadeId";
+		my $fragment = $useFragments ? Plugins::IckStreamPlugin::JsonFragmentCache::get($fragmentKey) : undef;
+		if(defined($fragment)) {
+			push @items,$fragment;
+			next;
+		}
 		if($decadeId == 0) {
 			$decadeName = string('UNK');
 		}else {
@@ -1121,7 +1339,11 @@ sub processDecadeResult {
 			}
 		};
 		
-		push @items,$item;
+		if(defined($decadeCover)) {
+			$item->{'image'} = "service://".getServiceId()."/music/$decadeCover/cover";
+		}
+
+		push @items,($useFragments ? Plugins::IckStreamPlugin::JsonFragmentCache::set($fragmentKey,$item) : $item);
 	}
 	$sth->finish();
 	return \@items;		
@@ -1167,6 +1389,7 @@ sub findAlbums {
 	my $reqParams = shift;
 	my $offset = shift;
 	my $count = shift;
+	my $continuation = shift;
 	
 	my @items = ();
 	
@@ -1174,9 +1397,14 @@ sub findAlbums {
 	my @whereDirectiveValues = ();
 	my @whereSearchDirectives = ();
 	my @whereSearchDirectiveValues = ();
-	my $sql = 'SELECT albums.id,albums.title,albums.titlesort,albums.artwork,albums.disc,albums.year,contributors.id,contributors.name FROM albums ';
 	my $order_by = undef;
 	my $collate = Slim::Utils::OSDetect->getOS()->sqlHelperClass()->collate();
+	my @keyset = (['albums.titlesort',$collate],['IFNULL(albums.disc,0)'],['albums.id']);
+	if(exists($reqParams->{'artistId'}) && $prefs->get('orderAlbumsForArtist') eq 'by_year_title') {
+		unshift @keyset,['IFNULL(albums.year,0)',undef,1];
+	}
+	my $search = exists($reqParams->{'search'}) ? Plugins::IckStreamPlugin::LibraryIndex::search('albums',$reqParams->{'search'}) : undef;
+	my $sql = 'SELECT albums.id,albums.title,albums.titlesort,albums.artwork,albums.disc,albums.year,contributors.id,contributors.name'.keysetColumns(\@keyset).' FROM '.searchFrom($search,'albums');
 	if(exists($reqParams->{'artistId'})) {
 		$sql .= 'JOIN contributors on contributors.id = albums.contributor ';
 
@@ -1219,11 +1447,17 @@ sub findAlbums {
 	}
 	
 	if(exists($reqParams->{'categoryId'})) {
-		$sql .= 'JOIN tracks on tracks.album = albums.id ';
-		$sql .= 'JOIN genre_track on genre_track.track = tracks.id ';
-		$sql .= 'JOIN genres on genres.id = genre_track.genre ';
+		if(Plugins::IckStreamPlugin::LibraryIndex::isCurrent()) {
+			$sql .= 'JOIN ickstream_genre_albums on ickstream_genre_albums.album = albums.id ';
 
-		push @whereDirectives, 'genres.name=? ';
+			push @whereDirectives, 'ickstream_genre_albums.genre=? ';
+		}else {
+			$sql .= 'JOIN tracks on tracks.album = albums.id ';
+			$sql .= 'JOIN genre_track on genre_track.track = tracks.id ';
+			$sql .= 'JOIN genres on genres.id = genre_track.genre ';
+
+			push @whereDirectives, 'genres.name=? ';
+		}
 		push @whereDirectiveValues, getInternalId($reqParams->{'categoryId'});
 	}
 	if(exists($reqParams->{'yearId'})) {
@@ -1236,7 +1470,7 @@ sub findAlbums {
 		push @whereDirectiveValues, getInternalId($reqParams->{'decadeId'})+9;
 	}
 	
-	if(exists($reqParams->{'search'})) {
+	if(exists($reqParams->{'search'}) && !defined($search)) {
 		my $searchStrings = Slim::Utils::Text::searchStringSplit($reqParams->{'search'});
 		if( ref $searchStrings->[0] eq 'ARRAY') {
 			for my $search (@{$searchStrings->[0]}) {
@@ -1254,6 +1488,11 @@ sub findAlbums {
 		}
 	}
 	
+	my $useKeyset = !defined($search) && defined($count) && isKeysetContinuation(\@keyset,$continuation);
+	if($useKeyset) {
+		push @whereDirectives, keysetDirective(\@keyset,$continuation,\@whereDirectiveValues);
+	}
+
 	if(scalar(@whereDirectives)>0 || scalar(@whereSearchDirectives)>0) {
 		$sql .= 'WHERE ';
 		my $whereDirective;
@@ -1269,17 +1508,24 @@ sub findAlbums {
 		push @whereDirectiveValues,@whereSearchDirectiveValues;
 		$sql .= $whereDirective . ' ';
 	}
-	$sql .= "GROUP BY albums.id ORDER BY $order_by";
-	if(defined($count)) {
+	$sql .= "GROUP BY albums.id ORDER BY ".searchOrderBy($search).keysetOrderBy(\@keyset);
+	if($useKeyset) {
+		$sql .= " LIMIT $count";
+	}elsif(defined($count)) {
 		$sql .= " LIMIT $offset, $count";
 	}
+	if(defined($search)) {
+		unshift @whereDirectiveValues,$search->{'match'};
+	}
 	my $dbh = Slim::Schema->dbh;
 	my $sth = $dbh->prepare_cached($sql);
 	$log->debug("Executing $sql");
 	$log->debug("Using values: ".join(',',@whereDirectiveValues));
 	$sth->execute(@whereDirectiveValues);
 
-	return processAlbumResult($sth,$order_by);
+	my $lastKeys = bindKeyset($sth,8,\@keyset);
+	my $items = processAlbumResult($sth,$order_by);
+	return ($items,defined($search)?undef:$lastKeys);
 }
 
 sub processAlbumResult {
@@ -1290,6 +1536,7 @@ sub processAlbumResult {
 	my $collate = Slim::Utils::OSDetect->getOS()->sqlHelperClass()->collate();
 
 	my @items = ();
+	my $useFragments = Plugins::IckStreamPlugin::JsonFragmentCache::isAvailable();
 	
 	my $albumId;
 	my $albumTitle;
@@ -1310,6 +1557,12 @@ sub processAlbumResult {
 	$sth->bind_col(8,\$artistName);
 	
 	while ($sth->fetch) {
+		my $fragmentKey = "album:$albumId:$order_by";
+		my $fragment = $useFragments ? Plugins::IckStreamPlugin::JsonFragmentCache::get($fragmentKey) : undef;
+		if(defined($fragment)) {
+			push @items,$fragment;
+			next;
+		}
 		utf8::decode($albumTitle);
 		utf8::decode($albumSortTitle);
 		utf8::decode($artistName);
@@ -1345,7 +1598,7 @@ sub processAlbumResult {
 			$item->{'itemAttributes'}->{'year'} = $albumYear;
 		}
 		
-		push @items,$item;
+		push @items,($useFragments ? Plugins::IckStreamPlugin::JsonFragmentCache::set($fragmentKey,$item) : $item);
 	}
 	$sth->finish();
 	return \@items;		
@@ -1392,6 +1645,7 @@ sub findArtists {
 	my $reqParams = shift;
 	my $offset = shift;
 	my $count = shift;
+	my $continuation = shift;
 	
 	my $serverPrefix = getServerId();
 
@@ -1401,7 +1655,10 @@ sub findArtists {
 	
 	my @whereDirectives = ();
 	my @whereDirectiveValues = ();
-	my $sql = 'SELECT contributors.id,contributors.name,contributors.namesort FROM contributors JOIN contributor_album ON contributors.id=contributor_album.contributor ';
+	my $collate = Slim::Utils::OSDetect->getOS()->sqlHelperClass()->collate();
+	my @keyset = (['contributors.namesort',$collate],['contributors.id']);
+	my $search = exists($reqParams->{'search'}) ? Plugins::IckStreamPlugin::LibraryIndex::search('contributors',$reqParams->{'search'}) : undef;
+	my $sql = 'SELECT contributors.id,contributors.name,contributors.namesort'.keysetColumns(\@keyset).' FROM '.searchFrom($search,'contributors').'JOIN contributor_album ON contributors.id=contributor_album.contributor ';
 	if(!exists($reqParams->{'search'})) {
 		if(exists($reqParams->{'roleId'})) {
 			my $role = Slim::Schema::Contributor->typeToRole(uc($reqParams->{'roleId'}));
@@ -1434,22 +1691,24 @@ sub findArtists {
 	}
 
 	if(exists($reqParams->{'categoryId'})) {
-		$sql .= 'JOIN contributor_track on contributor_track.contributor=contributor_album.contributor ';
-		$sql .= 'JOIN tracks on tracks.id = contributor_track.track ';
-		$sql .= 'JOIN genre_track on genre_track.track = tracks.id ';
-		$sql .= 'JOIN genres on genres.id = genre_track.genre ';
+		if(Plugins::IckStreamPlugin::LibraryIndex::isCurrent()) {
+			$sql .= 'JOIN ickstream_genre_contributors on ickstream_genre_contributors.contributor=contributor_album.contributor ';
 
-		push @whereDirectives, 'genres.name=? ';
+			push @whereDirectives, 'ickstream_genre_contributors.genre=? ';
+		}else {
+			$sql .= 'JOIN contributor_track on contributor_track.contributor=contributor_album.contributor ';
+			$sql .= 'JOIN tracks on tracks.id = contributor_track.track ';
+			$sql .= 'JOIN genre_track on genre_track.track = tracks.id ';
+			$sql .= 'JOIN genres on genres.id = genre_track.genre ';
+
+			push @whereDirectives, 'genres.name=? ';
+		}
 		push @whereDirectiveValues, getInternalId($reqParams->{'categoryId'});
 	}
 
-	my $order_by = undef;
-	my $collate = Slim::Utils::OSDetect->getOS()->sqlHelperClass()->collate();
-	$order_by = "contributors.namesort $collate";
-
 	my @whereSearchDirectives = ();
 	my @whereSearchDirectiveValues = ();
-	if(exists($reqParams->{'search'})) {
+	if(exists($reqParams->{'search'}) && !defined($search)) {
 		my $searchStrings = Slim::Utils::Text::searchStringSplit($reqParams->{'search'});
 		if( ref $searchStrings->[0] eq 'ARRAY') {
 			for my $search (@{$searchStrings->[0]}) {
@@ -1467,6 +1726,11 @@ sub findArtists {
 		}
 	}
 
+	my $useKeyset = !defined($search) && defined($count) && isKeysetContinuation(\@keyset,$continuation);
+	if($useKeyset) {
+		push @whereDirectives, keysetDirective(\@keyset,$continuation,\@whereDirectiveValues);
+	}
+
 	if(scalar(@whereDirectives)>0 || scalar(@whereSearchDirectives)>0) {
 		$sql .= 'WHERE ';
 		my $whereDirective;
@@ -1483,10 +1747,15 @@ sub findArtists {
 		$sql .= $whereDirective . ' ';
 	}
 
-	$sql .= "GROUP BY contributors.id ORDER BY $order_by";
-	if(defined($count)) {
+	$sql .= "GROUP BY contributors.id ORDER BY ".searchOrderBy($search).keysetOrderBy(\@keyset);
+	if($useKeyset) {
+		$sql .= " LIMIT $count";
+	}elsif(defined($count)) {
 		$sql .= " LIMIT $offset, $count";
 	}
+	if(defined($search)) {
+		unshift @whereDirectiveValues,$search->{'match'};
+	}
 	my $dbh = Slim::Schema->dbh;
 	my $sth = $dbh->prepare_cached($sql);
 	$log->debug("Executing $sql");
@@ -1496,7 +1765,9 @@ sub findArtists {
 	}else {
 		$sth->execute();
 	}
-	return processArtistResult($sth);	
+	my $lastKeys = bindKeyset($sth,3,\@keyset);
+	my $items = processArtistResult($sth);
+	return ($items,defined($search)?undef:$lastKeys);
 }
 
 sub processArtistResult {
@@ -1505,6 +1776,7 @@ sub processArtistResult {
 	my $serverPrefix = getServerId();
 
 	my @items = ();
+	my $useFragments = Plugins::IckStreamPlugin::JsonFragmentCache::isAvailable();
 	
 	my $artistId;
 	my $artistName;
@@ -1515,6 +1787,12 @@ sub processArtistResult {
 	$sth->bind_col(3,\$artistSortName);
 	
 	while ($sth->fetch) {
+		my $fragmentKey = "artist:$artistId";
+		my $fragment = $useFragments ? Plugins::IckStreamPlugin::JsonFragmentCache::get($fragmentKey) : undef;
+		if(defined($fragment)) {
+			push @items,$fragment;
+			next;
+		}
 		utf8::decode($artistName);
 		utf8::decode($artistSortName);
 		
@@ -1532,7 +1810,7 @@ sub processArtistResult {
 			$item->{'image'} = "service://".getServiceId()."/imageproxy/mai/artist/".$artistId."/image.png";
 		}
 		
-		push @items,$item;
+		push @items,($useFragments ? Plugins::IckStreamPlugin::JsonFragmentCache::set($fragmentKey,$item) : $item);
 	}
 	$sth->finish();
 	return \@items;		
@@ -1542,21 +1820,22 @@ sub findPlaylists {
 	my $reqParams = shift;
 	my $offset = shift;
 	my $count = shift;
+	my $continuation = shift;
 	
 	my $serverPrefix = getServerId();
 
 	my @items = ();
 	
-	my $sql = 'SELECT tracks.urlmd5,tracks.title,tracks.titlesort FROM tracks ';
-	my $order_by = undef;
 	my $collate = Slim::Utils::OSDetect->getOS()->sqlHelperClass()->collate();
-	$order_by = "tracks.titlesort $collate";
+	my @keyset = (['tracks.titlesort',$collate],['tracks.id']);
+	my $search = exists($reqParams->{'search'}) ? Plugins::IckStreamPlugin::LibraryIndex::search('tracks',$reqParams->{'search'}) : undef;
+	my $sql = 'SELECT tracks.urlmd5,tracks.title,tracks.titlesort'.keysetColumns(\@keyset).' FROM '.searchFrom($search,'tracks');
 
 	my @whereDirectives = ('tracks.content_type=?');
 	my @whereDirectiveValues = ('ssp');
 	my @whereSearchDirectives = ();
 	my @whereSearchDirectiveValues = ();
-	if(exists($reqParams->{'search'})) {
+	if(exists($reqParams->{'search'}) && !defined($search)) {
 		my $searchStrings = Slim::Utils::Text::searchStringSplit($reqParams->{'search'});
 		if( ref $searchStrings->[0] eq 'ARRAY') {
 			for my $search (@{$searchStrings->[0]}) {
@@ -1574,6 +1853,11 @@ sub findPlaylists {
 		}
 	}
 
+	my $useKeyset = !defined($search) && defined($count) && isKeysetContinuation(\@keyset,$continuation);
+	if($useKeyset) {
+		push @whereDirectives, keysetDirective(\@keyset,$continuation,\@whereDirectiveValues);
+	}
+
 	if(scalar(@whereDirectives)>0 || scalar(@whereSearchDirectives)>0) {
 		$sql .= 'WHERE ';
 		my $whereDirective;
@@ -1590,10 +1874,15 @@ sub findPlaylists {
 		$sql .= $whereDirective . ' ';
 	}
 
-	$sql .= "GROUP BY tracks.id ORDER BY $order_by";
-	if(defined($count)) {
+	$sql .= "GROUP BY tracks.id ORDER BY ".searchOrderBy($search).keysetOrderBy(\@keyset);
+	if($useKeyset) {
+		$sql .= " LIMIT $count";
+	}elsif(defined($count)) {
 		$sql .= " LIMIT $offset, $count";
 	}
+	if(defined($search)) {
+		unshift @whereDirectiveValues,$search->{'match'};
+	}
 	my $dbh = Slim::Schema->dbh;
 	my $sth = $dbh->prepare_cached($sql);
 	$log->debug("Executing $sql");
@@ -1603,7 +1892,9 @@ sub findPlaylists {
 	}else {
 		$sth->execute();
 	}
-	return processPlaylistResult($sth);	
+	my $lastKeys = bindKeyset($sth,3,\@keyset);
+	my $items = processPlaylistResult($sth);
+	return ($items,defined($search)?undef:$lastKeys);
 }
 
 sub processPlaylistResult {
@@ -1714,6 +2005,7 @@ sub findTracks {
 	my $reqParams = shift;
 	my $offset = shift;
 	my $count = shift;
+	my $continuation = shift;
 	
 	my $serverPrefix = getServerId();
 
@@ -1723,15 +2015,20 @@ sub findTracks {
 	my @whereDirectiveValues = ();
 	my @whereSearchDirectives = ();
 	my @whereSearchDirectiveValues = ();
-	my $sql = 'SELECT tracks.id,tracks.url,tracks.urlmd5,tracks.samplerate,tracks.samplesize,tracks.channels,tracks.tracknum, tracks.title,tracks.titlesort,tracks.coverid,tracks.year,tracks.disc,tracks.secs,tracks.content_type,albums.id,albums.title,albums.year,group_concat(contributors.id,"|"), group_concat(contributors.name,"|") FROM tracks JOIN albums on albums.id=tracks.album LEFT JOIN contributor_track as ct on ct.track=tracks.id and ct.role in (1,5) JOIN contributors on ct.contributor=contributors.id ';
-	my $order_by = "tracks.disc,tracks.tracknum,tracks.titlesort";
+	my @keyset = (['tracks.titlesort'],['tracks.id']);
+	if(exists($reqParams->{'playlistId'})) {
+		@keyset = (['IFNULL(playlist_track.position,0)'],['tracks.id']);
+	}elsif(exists($reqParams->{'albumId'})) {
+		@keyset = (['IFNULL(tracks.disc,0)'],['IFNULL(tracks.tracknum,0)'],['tracks.titlesort'],['tracks.id']);
+	}
+	my $search = exists($reqParams->{'search'}) ? Plugins::IckStreamPlugin::LibraryIndex::search('tracks',$reqParams->{'search'}) : undef;
+	my $sql = 'SELECT tracks.id,tracks.url,tracks.urlmd5,tracks.samplerate,tracks.samplesize,tracks.channels,tracks.tracknum, tracks.title,tracks.titlesort,tracks.coverid,tracks.year,tracks.disc,tracks.secs,tracks.content_type,albums.id,albums.title,albums.year,group_concat(contributors.id,"|"), group_concat(contributors.name,"|")'.keysetColumns(\@keyset).' FROM '.searchFrom($search,'tracks').'JOIN albums on albums.id=tracks.album LEFT JOIN contributor_track as ct on ct.track=tracks.id and ct.role in (1,5) JOIN contributors on ct.contributor=contributors.id ';
 	if(exists($reqParams->{'playlistId'})) {
 		my $collate = Slim::Utils::OSDetect->getOS()->sqlHelperClass()->collate();
 		$sql .= 'JOIN playlist_track ON playlist_track.track = tracks.url ';
 		$sql .= 'JOIN tracks AS playlists ON playlists.id = playlist_track.playlist ';
 		push @whereDirectives, 'playlists.urlmd5=?';
 		push @whereDirectiveValues, getInternalId($reqParams->{'playlistId'});
-		$order_by = "playlist_track.position";
 	}
 	if(exists($reqParams->{'artistId'})) {
 		my $collate = Slim::Utils::OSDetect->getOS()->sqlHelperClass()->collate();
@@ -1759,10 +2056,8 @@ sub findTracks {
 	if(exists($reqParams->{'albumId'})) {
 		push @whereDirectives, 'tracks.album=?';
 		push @whereDirectiveValues, getInternalId($reqParams->{'albumId'});
-	}elsif(!exists($reqParams->{'playlistId'})) {
-		$order_by = "tracks.titlesort";
 	}
-	if(exists($reqParams->{'search'})) {
+	if(exists($reqParams->{'search'}) && !defined($search)) {
 		my $searchStrings = Slim::Utils::Text::searchStringSplit($reqParams->{'search'});
 		if( ref $searchStrings->[0] eq 'ARRAY') {
 			for my $search (@{$searchStrings->[0]}) {
@@ -1780,6 +2075,11 @@ sub findTracks {
 		}
 	}
 
+	my $useKeyset = !defined($search) && defined($count) && isKeysetContinuation(\@keyset,$continuation);
+	if($useKeyset) {
+		push @whereDirectives, keysetDirective(\@keyset,$continuation,\@whereDirectiveValues);
+	}
+
 	if(scalar(@whereDirectives)>0 || scalar(@whereSearchDirectives)>0) {
 		$sql .= 'WHERE ';
 		my $whereDirective;
@@ -1795,17 +2095,24 @@ sub findTracks {
 		push @whereDirectiveValues,@whereSearchDirectiveValues;
 		$sql .= $whereDirective . ' ';
 	}
-	$sql .= "GROUP BY tracks.id ORDER BY $order_by";
-	if(defined($count)) {
+	$sql .= "GROUP BY tracks.id ORDER BY ".searchOrderBy($search).keysetOrderBy(\@keyset);
+	if($useKeyset) {
+		$sql .= " LIMIT $count";
+	}elsif(defined($count)) {
 		$sql .= " LIMIT $offset, $count";
 	}
+	if(defined($search)) {
+		unshift @whereDirectiveValues,$search->{'match'};
+	}
 	my $dbh = Slim::Schema->dbh;
 	my $sth = $dbh->prepare_cached($sql);
 	$log->debug("Executing $sql");
 	$log->debug("Using values: ".join(',',@whereDirectiveValues));
 	$sth->execute(@whereDirectiveValues);
 
-	return processTrackResult($sth,$reqParams->{'albumId'});	
+	my $lastKeys = bindKeyset($sth,19,\@keyset);
+	my $items = processTrackResult($sth,$reqParams->{'albumId'});
+	return ($items,defined($search)?undef:$lastKeys);
 }
 
 sub processTrackResult {
@@ -1814,6 +2121,7 @@ sub processTrackResult {
 	
 	my $serverPrefix = getServerId();
 	my @items = ();
+	my $useFragments = Plugins::IckStreamPlugin::JsonFragmentCache::isAvailable();
 
 	my $trackId;
 	my $trackUrl;
@@ -1861,6 +2169,12 @@ sub processTrackResult {
 	$serverAddress .= ":" . $serverPrefs->get('httpport');
 	
 	while ($sth->fetch) {
+		my $fragmentKey = "track:$trackId:".($requestedAlbumId?"album":"");
+		my $fragment = $useFragments ? Plugins::IckStreamPlugin::JsonFragmentCache::get($fragmentKey) : undef;
+		if(defined($fragment)) {
+			push @items,$fragment;
+			next;
+		}
 		utf8::decode($trackSortTitle);
 		utf8::decode($trackTitle);
 		utf8::decode($albumTitle);
@@ -1963,7 +2277,7 @@ sub processTrackResult {
 			} @contributors;
 			$item->{'itemAttributes'}->{'mainArtists'} = \@contributors;
 		}
-		push @items,$item;
+		push @items,($useFragments ? Plugins::IckStreamPlugin::JsonFragmentCache::set($fragmentKey,$item) : $item);
 	}
 	$sth->finish();
 	return \@items;		
@@ -2042,6 +2356,7 @@ sub processFolderResult {
 	
 	my $serverPrefix = getServerId();
 	my @items = ();
+	my $useFragments = Plugins::IckStreamPlugin::JsonFragmentCache::isAvailable();
 
 	my $trackId;
 	my $trackUrl;
@@ -2061,6 +2376,12 @@ sub processFolderResult {
 	$serverAddress .= ":" . $serverPrefs->get('httpport');
 	
 	while ($sth->fetch) {
+		my $fragmentKey = "folder:$trackId";
+		my $fragment = $useFragments ? Plugins::IckStreamPlugin::JsonFragmentCache::get($fragmentKey) : undef;
+		if(defined($fragment)) {
+			push @items,$fragment;
+			next;
+		}
 		utf8::decode($trackSortTitle);
 		utf8::decode($trackTitle);
 			
@@ -2079,7 +2400,7 @@ sub processFolderResult {
 			}
 		};
 		
-		push @items,$item;
+		push @items,($useFragments ? Plugins::IckStreamPlugin::JsonFragmentCache::set($fragmentKey,$item) : $item);
 	}
 	$sth->finish();
 	return \@items;		
@@ -2120,13 +2441,7 @@ sub getNextDynamicPlaylistTracks {
 		
 		my $items = undef;
 		
-		if($type eq 'RANDOM_ALL') {
-			$items = queryNextDynamicPlaylistTracks($count);
-		}elsif($type eq 'RANDOM_MY_LIBRARY') {
-			$items = queryNextDynamicPlaylistTracks($count);
-		}elsif($type eq 'RANDOM_MY_PLAYLISTS') {
-			$items = queryNextDynamicPlaylistTracksFromMyPlaylists($count);
-		}elsif($type eq 'RANDOM_FOR_ARTIST') {
+		if($type eq 'RANDOM_FOR_ARTIST') {
 			if(!defined($selectionParameters->{'data'})) {
 				Plugins::IckStreamPlugin::JsonHandler::requestWrite(undef,$context->{'httpClient'}, $context, {
 					'code' => -32602,
@@ -2139,7 +2454,6 @@ sub getNextDynamicPlaylistTracks {
 					'message' => 'Missing parameter: selectionParameters.data.playlist or selectionParameters.data.playlistId'
 				});
 			}
-			$items = queryNextDynamicPlaylistTracksFromArtist($count,$selectionParameters->{'data'});
 		}elsif($type eq 'RANDOM_FOR_PLAYLIST') {
 			if(!defined($selectionParameters->{'data'})) {
 				Plugins::IckStreamPlugin::JsonHandler::requestWrite(undef,$context->{'httpClient'}, $context, {
@@ -2153,7 +2467,6 @@ sub getNextDynamicPlaylistTracks {
 					'message' => 'Missing parameter: selectionParameters.data.playlist or selectionParameters.data.playlistId'
 				});
 			}
-			$items = queryNextDynamicPlaylistTracksFromPlaylist($count, $selectionParameters->{'data'});
 		}elsif($type eq 'RANDOM_FOR_CATEGORY') {
 			if(!defined($selectionParameters->{'data'})) {
 				Plugins::IckStreamPlugin::JsonHandler::requestWrite(undef,$context->{'httpClient'}, $context, {
@@ -2167,7 +2480,15 @@ sub getNextDynamicPlaylistTracks {
 					'message' => 'Missing parameter: selectionParameters.data.category or selectionParameters.data.categoryId'
 				});
 			}
-			$items = queryNextDynamicPlaylistTracksFromCategory($count, $selectionParameters->{'data'});
+		}
+
+		# Dynamic playlists are served from the pools of RandomTrackPool, a selection is queried
+		# directly until its pool has been filled
+		if(exists($dynamicPlaylistSelections{$type})) {
+			$items = Plugins::IckStreamPlugin::RandomTrackPool::takeTracks($type,$selectionParameters->{'data'},$count);
+			if(!defined($items)) {
+				$items = queryNextDynamicPlaylistTracksForSelection($count,$type,$selectionParameters->{'data'});
+			}
 		}
 			
 		my $result;
@@ -2192,6 +2513,17 @@ sub getNextDynamicPlaylistTracks {
     }
 }
 
+sub queryNextDynamicPlaylistTracksForSelection {
+	my $count = shift;
+	my $type = shift;
+	my $data = shift;
+
+	if(!exists($dynamicPlaylistSelections{$type})) {
+		return undef;
+	}
+	return $dynamicPlaylistSelections{$type}->($count,$data);
+}
+
 sub queryNextDynamicPlaylistTracks {
 	my $count = shift;
 	
@@ -2413,7 +2745,6 @@ sub handleJSONRPC {
 		eval {
 	        # Parse the input
 	        # Convert JSON to Perl
-	        # FIXME: JSON 2.0 accepts multiple requests ? How do we parse that efficiently?
 	        $procedure = from_json($input);
 		};
         if ($@) {
@@ -2424,6 +2755,12 @@ sub handleJSONRPC {
 				return;
         }
 
+        # A JSON-RPC 2.0 batch, all calls are answered in one array
+        if (ref($procedure) eq 'ARRAY') {
+                Plugins::IckStreamPlugin::JsonHandler::handleBatch($context, $procedure, \&dispatchProcedure);
+                return;
+        }
+
         # Validate the procedure
         # We must get a JSON object, i.e. a hash
         if (ref($procedure) ne 'HASH') {
@@ -2439,18 +2776,25 @@ sub handleJSONRPC {
         }
 
         $context->{'procedure'} = $procedure;
+        dispatchProcedure($context);
+}
+
+# Validates and runs a single procedure, also used for each call of a batch
+sub dispatchProcedure {
+        my $context = shift;
+        my $procedure = $context->{'procedure'};
 		
 		# ignore notifications (which don't have an id)
 		if (!defined($procedure->{'id'})) {
 				$log->debug("Ignoring notification: ".$procedure->{'method'});
-                Slim::Web::HTTP::closeHTTPSocket($httpClient);
+                Plugins::IckStreamPlugin::JsonHandler::finishWithoutResponse($context);
                 return;
 		}
 
 		# ignore errors, just log them
 		if (defined($procedure->{'error'})) {
 				$log->warn("JSON error on id=".$procedure->{'id'}.": ".$procedure->{'error'}->{'code'}.":".$procedure->{'error'}->{'code'}.(defined($procedure->{'error'}->{'data'})?"(".$procedure->{'error'}->{'data'}.")":""));
-                Slim::Web::HTTP::closeHTTPSocket($httpClient);
+                Plugins::IckStreamPlugin::JsonHandler::finishWithoutResponse($context);
                 return;
 		}
 
@@ -2482,7 +2826,7 @@ sub handleJSONRPC {
                 # return internal server error
                 $log->error("Procedure $method refers to non CODE ??? => closing connection");
                 
-                Slim::Web::HTTP::closeHTTPSocket($httpClient);
+                Plugins::IckStreamPlugin::JsonHandler::finishWithoutResponse($context);
                 return;
         }
         
@@ -2494,38 +2838,15 @@ sub handleJSONRPC {
                 
                 # error, params is an array or an object
                 $log->warn("Procedure $method has params not HASH => closing connection");
-                Slim::Web::HTTP::closeHTTPSocket($httpClient);
+                Plugins::IckStreamPlugin::JsonHandler::finishWithoutResponse($context);
                 return;
         }        
 
-        # Detect the language the client wants content returned in
-        if ( my $lang = $httpResponse->request->header('Accept-Language') ) {
-                my @parts = split(/[,-]/, $lang);
-                $context->{lang} = uc $parts[0] if $parts[0];
+        # the context of a batch has been prepared once for all calls
+        if (!defined($context->{'batch'})) {
+                Plugins::IckStreamPlugin::JsonHandler::prepareContext($context, $method);
         }
 
-        if ( my $ua = ( $httpResponse->request->header('X-User-Agent') || $httpResponse->request->header('User-Agent') ) ) {
-                $context->{ua} = $ua;
-        }
-
-        # Check our operational mode using our X-Jive header
-        # We must be delaing with a 1.1 client because X-Jive uses chunked transfers
-        # We must not be closing the connection
-        if (defined(my $xjive = $httpResponse->request()->header('X-Jive')) &&
-                $httpClient->proto_ge('1.1') &&
-                $httpResponse->header('Connection') !~ /close/i) {
-        
-                main::INFOLOG && $log->info("Operating in x-jive mode for procedure $method and client $httpClient");
-                $context->{'x-jive'} = 1;
-                $httpResponse->header('X-Jive' => 'Jive')
-        }
-                
-        # remember we need to send headers. We'll reset this once sent.
-        $context->{'sendheaders'} = 1;
-        
-        # store our context. It'll get erased by the callback in HTTP.pm through handleClose
-        Plugins::IckStreamPlugin::JsonHandler::setContext($httpClient, $context);
-
         # jump to the code handling desired method. It is responsible to send a suitable output
         eval { &{$funcPtr}($context); };
 
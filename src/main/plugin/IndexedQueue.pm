@@ -0,0 +1,273 @@
+# Copyright (c) 2014, ickStream GmbH
+# All rights reserved.
+# 
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#     * Redistributions of source code must retain the above copyright
+#       notice, this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright
+#       notice, this list of conditions and the following disclaimer in the
+#       documentation and/or other materials provided with the distribution.
+#     * Neither the name of ickStream nor the
+#       names of its contributors may be used to endorse or promote products
+#       derived from this software without specific prior written permission.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL LOGITECH, INC BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+package Plugins::IckStreamPlugin::IndexedQueue;
+
+# Sequence of playback queue items with positional access, insert, remove and move in O(log n).
+# The items are kept in a treap ordered by position, where each node knows the size of its
+# subtree and its parent, so the position of an item can also be found from its instanceId.
+
+use strict;
+use warnings;
+
+use Scalar::Util qw(weaken);
+
+# Fields of a tree node
+use constant ITEM     => 0;
+use constant PRIORITY => 1;
+use constant SIZE     => 2;
+use constant LEFT     => 3;
+use constant RIGHT    => 4;
+use constant PARENT   => 5;
+
+sub new {
+	my $class = shift;
+	my $items = shift || [];
+
+	my $self = bless {
+		'root' => undef,
+		'nodes' => {},
+	}, $class;
+	$self->{'root'} = $self->_build($items);
+	return $self;
+}
+
+sub count {
+	my $self = shift;
+
+	return _size($self->{'root'});
+}
+
+# Returns the item at $pos or undef if there is none
+sub get {
+	my $self = shift;
+	my $pos = shift;
+
+	return undef if(!defined($pos) || $pos < 0 || $pos >= $self->count());
+	my $node = $self->{'root'};
+	while(defined($node)) {
+		my $leftSize = _size($node->[LEFT]);
+		if($pos < $leftSize) {
+			$node = $node->[LEFT];
+		}elsif($pos == $leftSize) {
+			return $node->[ITEM];
+		}else {
+			$pos -= $leftSize + 1;
+			$node = $node->[RIGHT];
+		}
+	}
+	return undef;
+}
+
+# Returns up to $count items starting at $offset, all remaining items if $count is undefined
+sub items {
+	my $self = shift;
+	my $offset = shift || 0;
+	my $count = shift;
+
+	my $to = $self->count();
+	$to = $offset + $count if(defined($count) && $offset + $count < $to);
+	my @result = ();
+	_collect($self->{'root'}, $offset, $to, \@result);
+	return \@result;
+}
+
+# Returns the position of the item with the same instanceId, undef if it isn't in the queue
+sub position {
+	my $self = shift;
+	my $item = shift;
+
+	my $node = $self->{'nodes'}->{$item->{'instanceId'}};
+	return undef if(!defined($node));
+	my $pos = _size($node->[LEFT]);
+	while(defined(my $parent = $node->[PARENT])) {
+		if(defined($parent->[RIGHT]) && $parent->[RIGHT] == $node) {
+			$pos += _size($parent->[LEFT]) + 1;
+		}
+		$node = $parent;
+	}
+	return $pos;
+}
+
+# Inserts the items before $pos, they are appended if $pos is undefined or beyond the end
+sub insert {
+	my $self = shift;
+	my $pos = shift;
+	my $items = shift;
+
+	my $count = $self->count();
+	$pos = $count if(!defined($pos) || $pos > $count);
+	my ($left, $right) = _split($self->{'root'}, $pos);
+	$self->_setRoot(_merge(_merge($left, $self->_build($items)), $right));
+}
+
+# Removes and returns the item at $pos
+sub remove {
+	my $self = shift;
+	my $pos = shift;
+
+	return undef if(!defined($pos) || $pos < 0 || $pos >= $self->count());
+	my ($left, $rest) = _split($self->{'root'}, $pos);
+	my ($node, $right) = _split($rest, 1);
+	$self->_setRoot(_merge($left, $right));
+	delete $self->{'nodes'}->{$node->[ITEM]->{'instanceId'}};
+	return $node->[ITEM];
+}
+
+# Removes the item with the same instanceId, returns its former position
+sub removeItem {
+	my $self = shift;
+	my $item = shift;
+
+	my $pos = $self->position($item);
+	$self->remove($pos) if(defined($pos));
+	return $pos;
+}
+
+# Moves the item at $from so it ends up at position $to
+sub move {
+	my $self = shift;
+	my $from = shift;
+	my $to = shift;
+
+	my $item = $self->remove($from);
+	$self->insert($to, [$item]) if(defined($item));
+	return $item;
+}
+
+sub _setRoot {
+	my $self = shift;
+	my $root = shift;
+
+	$root->[PARENT] = undef if(defined($root));
+	$self->{'root'} = $root;
+}
+
+# Builds a treap of the items in O(n) from the right spine of the tree built so far
+sub _build {
+	my $self = shift;
+	my $items = shift;
+
+	my @spine = ();
+	for my $item (@{$items}) {
+		my $node = [$item, rand(), 1, undef, undef, undef];
+		$self->{'nodes'}->{$item->{'instanceId'}} = $node;
+		my $last = undef;
+		while(scalar(@spine) > 0 && $spine[-1]->[PRIORITY] < $node->[PRIORITY]) {
+			$last = pop @spine;
+		}
+		$node->[LEFT] = $last;
+		$spine[-1]->[RIGHT] = $node if(scalar(@spine) > 0);
+		push @spine, $node;
+	}
+	return undef if(scalar(@spine) == 0);
+	_updateAll($spine[0]);
+	$spine[0]->[PARENT] = undef;
+	return $spine[0];
+}
+
+sub _size {
+	my $node = shift;
+
+	return defined($node) ? $node->[SIZE] : 0;
+}
+
+# Recalculates the size of a node and makes it the parent of its children
+sub _update {
+	my $node = shift;
+
+	$node->[SIZE] = 1 + _size($node->[LEFT]) + _size($node->[RIGHT]);
+	for my $child ($node->[LEFT], $node->[RIGHT]) {
+		if(defined($child)) {
+			# Weak, so the tree isn't kept alive by its own cycles
+			$child->[PARENT] = $node;
+			weaken($child->[PARENT]);
+		}
+	}
+}
+
+sub _updateAll {
+	my $node = shift;
+
+	_updateAll($node->[LEFT]) if(defined($node->[LEFT]));
+	_updateAll($node->[RIGHT]) if(defined($node->[RIGHT]));
+	_update($node);
+}
+
+# Splits a tree into the first $count items and the rest
+sub _split {
+	my $node = shift;
+	my $count = shift;
+
+	return (undef, undef) if(!defined($node));
+	my $leftSize = _size($node->[LEFT]);
+	if($count <= $leftSize) {
+		my ($left, $right) = _split($node->[LEFT], $count);
+		$node->[LEFT] = $right;
+		_update($node);
+		$left->[PARENT] = undef if(defined($left));
+		return ($left, $node);
+	}else {
+		my ($left, $right) = _split($node->[RIGHT], $count - $leftSize - 1);
+		$node->[RIGHT] = $left;
+		_update($node);
+		$right->[PARENT] = undef if(defined($right));
+		return ($node, $right);
+	}
+}
+
+# Joins two trees, all items of $left come before the ones of $right
+sub _merge {
+	my $left = shift;
+	my $right = shift;
+
+	return $right if(!defined($left));
+	return $left if(!defined($right));
+	if($left->[PRIORITY] > $right->[PRIORITY]) {
+		$left->[RIGHT] = _merge($left->[RIGHT], $right);
+		_update($left);
+		return $left;
+	}else {
+		$right->[LEFT] = _merge($left, $right->[LEFT]);
+		_update($right);
+		return $right;
+	}
+}
+
+# Appends the items of a subtree with positions in [$from,$to) to $result
+sub _collect {
+	my $node = shift;
+	my $from = shift;
+	my $to = shift;
+	my $result = shift;
+
+	return if(!defined($node) || $from >= $to || $to <= 0 || $from >= $node->[SIZE]);
+	my $leftSize = _size($node->[LEFT]);
+	_collect($node->[LEFT], $from, $to, $result) if($from < $leftSize);
+	push @{$result}, $node->[ITEM] if($from <= $leftSize && $leftSize < $to);
+	_collect($node->[RIGHT], $from - $leftSize - 1, $to - $leftSize - 1, $result) if($to > $leftSize + 1);
+}
+
+1;
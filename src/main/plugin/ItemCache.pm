@@ -31,20 +31,29 @@ use Plugins::IckStreamPlugin::Plugin;
 use Slim::Utils::Prefs;
 use Slim::Utils::Log;
 use Slim::Utils::Misc;
+use Slim::Utils::Scheduler;
+use Tie::Cache::LRU;
 
 my $log   = logger('plugin.ickstream');
 my $prefs = preferences('plugin.ickstream');
 
-sub getItemFromCache {
-	my $itemId = shift;
-	
-	my $cache = Slim::Utils::Cache->new("IckStreamItemCache");
-	my $meta = $cache->get( $itemId );
-	return $meta;
+# Metadata is looked up repeatedly while LMS redraws the now playing screens, the
+# most recently used items are therefore kept in memory in front of the disk cache
+tie my %memoryCache, 'Tie::Cache::LRU', 5000;
+# Items written to the disk cache each time the scheduler runs the write task
+my $DISK_WRITES_PER_STEP = 50;
+
+my $diskCache = undef;
+my @pendingDiskWrites = ();
+
+sub _getDiskCache {
+	if(!defined($diskCache)) {
+		$diskCache = Slim::Utils::Cache->new("IckStreamItemCache");
+	}
+	return $diskCache;
 }
 
-sub setItemInCache {
-	my $itemId = shift;
+sub _createMeta {
 	my $item = shift;
 	my $streamingRef = shift;
 
@@ -65,23 +74,80 @@ sub setItemInCache {
 	}elsif(defined($streamingRef) && defined($streamingRef->{'format'})) {
 		$meta->{'format'} = $streamingRef->{'format'}
 	}
+	return $meta;
+}
+
+sub getItemFromCache {
+	my $itemId = shift;
+	
+	my $meta = $memoryCache{$itemId};
+	if(!defined($meta)) {
+		$meta = _getDiskCache()->get( $itemId );
+		if(defined($meta)) {
+			$memoryCache{$itemId} = $meta;
+		}
+	}
+	return $meta;
+}
 
-	my $cache = Slim::Utils::Cache->new("IckStreamItemCache");
-	$cache->set($itemId,$meta, 86400 );
+sub setItemInCache {
+	my $itemId = shift;
+	my $item = shift;
+	my $streamingRef = shift;
+
+	my $meta = _createMeta($item,$streamingRef);
+	$memoryCache{$itemId} = $meta;
+	_getDiskCache()->set($itemId,$meta, 86400 );
 	return $meta;
 }
 
+# Caches all items of a playback queue at once, the disk cache is written in the background.
+# Returns the ids of the items which came without metadata and aren't cached yet.
+sub setItemsInCache {
+	my $items = shift;
+
+	my @missingItemIds = ();
+	for my $item (@$items) {
+		if(!defined($item->{'text'})) {
+			if(!defined(getItemFromCache($item->{'id'}))) {
+				push @missingItemIds,$item->{'id'};
+			}
+			next;
+		}
+		my $meta = _createMeta($item);
+		$memoryCache{$item->{'id'}} = $meta;
+		push @pendingDiskWrites,[$item->{'id'},$meta];
+	}
+	if(scalar(@pendingDiskWrites)>0) {
+		# Never schedule the write task twice
+		Slim::Utils::Scheduler::remove_task(\&_writeToDisk);
+		Slim::Utils::Scheduler::add_task(\&_writeToDisk);
+	}
+	return \@missingItemIds;
+}
+
+sub _writeToDisk {
+	my $cache = _getDiskCache();
+	for(my $i=0;$i<$DISK_WRITES_PER_STEP && scalar(@pendingDiskWrites)>0;$i++) {
+		my $write = shift @pendingDiskWrites;
+		$cache->set($write->[0],$write->[1], 86400 );
+	}
+	return scalar(@pendingDiskWrites)>0 ? 1 : 0;
+}
+
 sub setItemStreamingRefInCache {
 	my $itemId = shift;
 	my $meta = shift;
 	my $streamingRef = shift;
 	
-	my $cache = Slim::Utils::Cache->new("IckStreamItemCache");
-	my $meta = $cache->get($itemId);
+	my $meta = getItemFromCache($itemId);
 	if(defined($streamingRef) && defined($streamingRef->{'format'})) {
 		$meta->{'format'} = $streamingRef->{'format'}
 	}
-	$cache->set($itemId,$meta, 86400 );
+	if(defined($meta)) {
+		$memoryCache{$itemId} = $meta;
+	}
+	_getDiskCache()->set($itemId,$meta, 86400 );
 	return $meta;
 }
 
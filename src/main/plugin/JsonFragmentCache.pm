@@ -0,0 +1,112 @@
+# Copyright (c) 2014, ickStream GmbH
+# All rights reserved.
+# 
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#     * Redistributions of source code must retain the above copyright
+#       notice, this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright
+#       notice, this list of conditions and the following disclaimer in the
+#       documentation and/or other materials provided with the distribution.
+#     * Neither the name of ickStream nor the
+#       names of its contributors may be used to endorse or promote products
+#       derived from this software without specific prior written permission.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL LOGITECH, INC BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+package Plugins::IckStreamPlugin::JsonFragmentCache;
+
+# The JSON of the items ContentAccessService returns from the LMS library,
+# encoded once per scan. The process*Result methods return a cached fragment
+# instead of building and encoding the item again, JsonHandler inserts the
+# fragments as they are into the encoded response. A fragment is an object
+# with the id and the JSON of the item, only JsonHandler looks at the JSON.
+
+use strict;
+use JSON::XS::VersionOneAndTwo;
+use Slim::Utils::Log;
+use Slim::Utils::Prefs;
+use Tie::Cache::LRU;
+
+my $log = logger('plugin.ickstream.content');
+my $prefs = preferences('plugin.ickstream');
+my $serverPrefs = preferences('server');
+
+# The lastScanTime of LMS, the state of the library index, the service id and the language
+# the fragments were encoded with, genres only have artwork with the library index
+my $cachedVersion = undef;
+# Fragments by key, the least recently used ones are dropped
+tie my %cache, 'Tie::Cache::LRU', 20000;
+
+# Returns true if fragments can be used for the current library, the cache is cleared if the
+# library or the settings the items depend on have changed. While LMS is scanning the items
+# are encoded with each request.
+sub isAvailable {
+	if(Slim::Music::Import->stillScanning()) {
+		return 0;
+	}
+	my $version = version();
+	if(!defined($cachedVersion) || $cachedVersion ne $version) {
+		if(defined($cachedVersion)) {
+			$log->debug("Library or settings changed, clearing ".scalar(keys %cache)." JSON fragments");
+		}
+		clear();
+		$cachedVersion = $version;
+	}
+	return 1;
+}
+
+# Returns the version of the library and the settings the items are encoded for, anything
+# else holding items returned by ContentAccessService must be dropped when it changes
+sub version {
+	return join('|',Slim::Music::Import->lastScanTime || 0,Plugins::IckStreamPlugin::LibraryIndex::isCurrent() ? 1 : 0,$prefs->get('uuid') || '',$serverPrefs->get('language') || '');
+}
+
+sub clear {
+	%cache = ();
+	$cachedVersion = undef;
+}
+
+# Returns the fragment of an item or undef if it hasn't been encoded yet,
+# the key identifies the item and everything its content depends on
+sub get {
+	my $key = shift;
+
+	return $cache{$key};
+}
+
+# Encodes an item and returns its fragment
+sub set {
+	my $key = shift;
+	my $item = shift;
+
+	my $fragment = bless {
+		'id' => $item->{'id'},
+		'json' => to_json($item)
+	}, 'Plugins::IckStreamPlugin::JsonFragmentCache';
+	$cache{$key} = $fragment;
+	return $fragment;
+}
+
+sub isFragment {
+	my $value = shift;
+
+	return ref($value) eq 'Plugins::IckStreamPlugin::JsonFragmentCache';
+}
+
+sub json {
+	my $fragment = shift;
+
+	return $fragment->{'json'};
+}
+
+1;
@@ -44,6 +44,8 @@ use Slim::Utils::Compress;
 use POSIX qw(floor);
 use Crypt::Tea;
 
+use Plugins::IckStreamPlugin::JsonFragmentCache;
+
 my $log = logger('plugin.ickstream');
 my $prefs  = preferences('plugin.ickstream');
 
@@ -89,9 +91,221 @@ sub generateJSONResponse {
         $response->{'result'} = $result if(defined($result));
         $response->{'error'} = $error if (defined($error) && !defined($result));
 
+        if (defined($context->{'batch'})) {
+                completeBatchCall($context, $response);
+                return;
+        }
+        my $encoded = encodeResponse($response, 3);
+        if (defined($encoded)) {
+                writeEncodedResponse($context, $encoded);
+                return;
+        }
         Slim::Web::JSONRPC::writeResponse($context, $response);
 }
 
+# encodeResponse
+# encodes a response containing JSON fragments, the fragments are inserted as they are.
+# Fragments are looked for down to the items of the result, which are $depth levels below
+# the response. Returns undef if there are none, the response is written by LMS then.
+sub encodeResponse {
+        my $response = shift;
+        my $depth = shift;
+
+        my @fragments = ();
+        my $placeholders = replaceFragments($response, \@fragments, $depth);
+        if (!scalar(@fragments)) {
+                return undef;
+        }
+        my $encoded = to_json($placeholders);
+        $encoded =~ s/"\\u0000fragment(\d+)\\u0000"/$fragments[$1]/g;
+        return $encoded;
+}
+
+# replaceFragments
+# returns a copy of a value where each fragment down to $depth levels below it is replaced by a placeholder string
+sub replaceFragments {
+        my $value = shift;
+        my $fragments = shift;
+        my $depth = shift;
+
+        if (Plugins::IckStreamPlugin::JsonFragmentCache::isFragment($value)) {
+                push @$fragments, Plugins::IckStreamPlugin::JsonFragmentCache::json($value);
+                return "\0fragment".$#$fragments."\0";
+        }
+        if ($depth<=0) {
+                return $value;
+        }
+        if (ref($value) eq 'HASH') {
+                my %copy = map { $_ => replaceFragments($value->{$_}, $fragments, $depth-1) } keys %$value;
+                return \%copy;
+        }
+        if (ref($value) eq 'ARRAY') {
+                my @copy = map { replaceFragments($_, $fragments, $depth-1) } @$value;
+                return \@copy;
+        }
+        return $value;
+}
+
+# writeEncodedResponse
+# writes a response which has already been encoded as Slim::Web::JSONRPC::writeResponse would do
+sub writeEncodedResponse {
+        my $context = shift;
+        my $encoded = shift;
+
+        my $httpClient = $context->{'httpClient'};
+        my $httpResponse = $context->{'httpResponse'};
+
+        # Chunked responses of x-jive mode are left to LMS
+        if ($context->{'x-jive'}) {
+                Slim::Web::JSONRPC::writeResponse($context, from_json($encoded));
+                return;
+        }
+        if (!$httpClient->connected()) {
+                main::INFOLOG && $log->info("Client no longer connected in writeEncodedResponse");
+                handleClose($httpClient);
+                return;
+        }
+        if ( main::DEBUGLOG && $log->is_debug ) {
+                $log->debug("JSON response: $encoded");
+        }
+
+        # to_json already returns UTF-8 octets, as do the fragments
+        utf8::encode($encoded) if utf8::is_utf8($encoded);
+        $context->{'sendheaders'} = 0;
+        $httpResponse->code(RC_OK);
+        $httpResponse->content_type('application/json');
+        $httpResponse->header('Content-Length' => length($encoded));
+        $httpResponse->header('Expires' => '-1');
+        $httpResponse->header('Pragma' => 'no-cache');
+        $httpResponse->header('Cache-Control' => 'no-cache');
+        Slim::Web::HTTP::addHTTPResponse($httpClient, $httpResponse, \$encoded, 1, 0);
+}
+
+# finishWithoutResponse
+# ends a request which isn't answered, inside a batch only this call is finished
+sub finishWithoutResponse {
+        my $context = shift;
+
+        if (defined($context->{'batch'})) {
+                completeBatchCall($context, undef);
+                return;
+        }
+        Slim::Web::HTTP::closeHTTPSocket($context->{'httpClient'});
+}
+
+# prepareContext
+# detects the client preferences and registers the context of a request before
+# it is dispatched
+sub prepareContext {
+        my $context = shift;
+        my $method = shift;
+
+        my $httpClient = $context->{'httpClient'};
+        my $httpResponse = $context->{'httpResponse'};
+
+        # Detect the language the client wants content returned in
+        if ( my $lang = $httpResponse->request->header('Accept-Language') ) {
+                my @parts = split(/[,-]/, $lang);
+                $context->{lang} = uc $parts[0] if $parts[0];
+        }
+
+        if ( my $ua = ( $httpResponse->request->header('X-User-Agent') || $httpResponse->request->header('User-Agent') ) ) {
+                $context->{ua} = $ua;
+        }
+
+        # Check our operational mode using our X-Jive header
+        # We must be delaing with a 1.1 client because X-Jive uses chunked transfers
+        # We must not be closing the connection
+        if (defined(my $xjive = $httpResponse->request()->header('X-Jive')) &&
+                $httpClient->proto_ge('1.1') &&
+                $httpResponse->header('Connection') !~ /close/i) {
+        
+                main::INFOLOG && $log->info("Operating in x-jive mode for procedure $method and client $httpClient");
+                $context->{'x-jive'} = 1;
+                $httpResponse->header('X-Jive' => 'Jive')
+        }
+                
+        # remember we need to send headers. We'll reset this once sent.
+        $context->{'sendheaders'} = 1;
+        
+        # store our context. It'll get erased by the callback in HTTP.pm through handleClose
+        setContext($httpClient, $context);
+}
+
+# handleBatch
+# dispatches each call of a JSON-RPC 2.0 batch with its own context, the
+# responses are written as one array when the last call has been answered
+sub handleBatch {
+        my $context = shift;
+        my $procedures = shift;
+        my $dispatch = shift;
+
+        if (!scalar(@$procedures)) {
+                generateJSONResponse($context, undef, {
+                        'code' => -32600,
+                        'message' => 'Invalid Request'
+                });
+                return;
+        }
+        if ( main::DEBUGLOG && $log->is_debug ) {
+                $log->debug( "JSON parsed batch: " . Data::Dump::dump($procedures) );
+        }
+
+        prepareContext($context, 'batch');
+
+        my $batch = {
+                'context' => $context,
+                'responses' => [],
+                'pending' => scalar(@$procedures),
+        };
+        my $index = 0;
+        foreach my $procedure (@$procedures) {
+                my $callContext = { %$context };
+                $callContext->{'batch'} = $batch;
+                $callContext->{'batchIndex'} = $index++;
+                if (ref($procedure) ne 'HASH') {
+                        $callContext->{'procedure'} = {};
+                        generateJSONResponse($callContext, undef, {
+                                'code' => -32600,
+                                'message' => 'Invalid Request'
+                        });
+                        next;
+                }
+                $callContext->{'procedure'} = $procedure;
+                $dispatch->($callContext);
+        }
+}
+
+# completeBatchCall
+# stores the response of one call of a batch and writes all responses after the last one
+sub completeBatchCall {
+        my $context = shift;
+        my $response = shift;
+
+        # a call which failed after answering must not be counted twice
+        return if $context->{'batchCompleted'};
+        $context->{'batchCompleted'} = 1;
+
+        my $batch = $context->{'batch'};
+        $batch->{'responses'}->[$context->{'batchIndex'}] = $response;
+        if (--$batch->{'pending'} > 0) {
+                return;
+        }
+
+        my @responses = grep { defined($_) } @{$batch->{'responses'}};
+        if (scalar(@responses)) {
+                my $encoded = encodeResponse(\@responses, 4);
+                if (defined($encoded)) {
+                        writeEncodedResponse($batch->{'context'}, $encoded);
+                } else {
+                        Slim::Web::JSONRPC::writeResponse($batch->{'context'}, \@responses);
+                }
+        } else {
+                # a batch of notifications isn't answered at all
+                Slim::Web::HTTP::closeHTTPSocket($batch->{'context'}->{'httpClient'});
+        }
+}
+
 
 # requestWrite( $request $httpClient, $context)
 # Writes a request downstream. $httpClient and $context are retrieved if not
@@ -0,0 +1,256 @@
+# Copyright (c) 2014, ickStream GmbH
+# All rights reserved.
+# 
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#     * Redistributions of source code must retain the above copyright
+#       notice, this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright
+#       notice, this list of conditions and the following disclaimer in the
+#       documentation and/or other materials provided with the distribution.
+#     * Neither the name of ickStream nor the
+#       names of its contributors may be used to endorse or promote products
+#       derived from this software without specific prior written permission.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL LOGITECH, INC BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+package Plugins::IckStreamPlugin::LibraryIndex;
+
+# Small tables precomputed from the LMS library after each scan, so the browse
+# roots and the by-genre browsing of ContentAccessService don't have to
+# aggregate over genre_track, tracks and contributor_track on each request.
+# The tables are versioned with the time of the scan they were built from,
+# until they are built the find* methods use their own SQL.
+#
+# The search columns of tracks, albums and contributors are also indexed for
+# full-text search with prefix matching, with FTS5 if the SQLite of LMS has it
+# and FTS4 otherwise. Only FTS5 can rank the matches.
+
+use strict;
+use Slim::Utils::Log;
+use Slim::Utils::Prefs;
+use Slim::Utils::Scheduler;
+use Slim::Utils::Text;
+
+my $log = logger('plugin.ickstream.content');
+
+# Version of the tables, the lastScanTime of LMS they were built from
+my $builtVersion = undef;
+# Statements left of the build in progress
+my @pendingStatements = ();
+my $buildingVersion = undef;
+# Full-text module used by the search indexes, undef if SQLite has none
+my $searchModule = undef;
+
+# Supported full-text modules in order of preference, with prefix indexes for search as you type
+my @searchModules = (
+	['fts5', "fts5(text, prefix='2 3')"],
+	['fts4', 'fts4(text, prefix="2,3")'],
+);
+
+# Search indexes and the rows they contain, the search columns are normalized by LMS
+my %searchIndexes = (
+	'tracks' => 'SELECT id,titlesearch FROM tracks',
+	'albums' => 'SELECT id,titlesearch FROM albums',
+	'contributors' => 'SELECT id,namesearch FROM contributors',
+);
+
+my @buildStatements = (
+	# A wiping rescan drops the tables
+	'CREATE TABLE IF NOT EXISTS ickstream_library_version (version INTEGER)',
+	'DELETE FROM ickstream_library_version',
+
+	'CREATE TABLE IF NOT EXISTS ickstream_genres (id INTEGER PRIMARY KEY, name TEXT, namesort TEXT, tracks INTEGER, albums INTEGER, artwork TEXT)',
+	'CREATE TABLE IF NOT EXISTS ickstream_years (id INTEGER PRIMARY KEY, tracks INTEGER, albums INTEGER, artwork TEXT)',
+	'CREATE TABLE IF NOT EXISTS ickstream_decades (id INTEGER PRIMARY KEY, tracks INTEGER, albums INTEGER, artwork TEXT)',
+	'CREATE TABLE IF NOT EXISTS ickstream_genre_contributors (genre TEXT, contributor INTEGER)',
+	'CREATE INDEX IF NOT EXISTS ickstream_genre_contributors_genre ON ickstream_genre_contributors (genre, contributor)',
+	'CREATE TABLE IF NOT EXISTS ickstream_genre_albums (genre TEXT, album INTEGER)',
+	'CREATE INDEX IF NOT EXISTS ickstream_genre_albums_genre ON ickstream_genre_albums (genre, album)',
+
+	'DELETE FROM ickstream_genres',
+	'INSERT INTO ickstream_genres (id,name,namesort,tracks,albums,artwork) SELECT genres.id,genres.name,genres.namesort,COUNT(tracks.id),COUNT(DISTINCT tracks.album),MIN(tracks.coverid) FROM genres JOIN genre_track ON genre_track.genre=genres.id JOIN tracks ON tracks.id=genre_track.track GROUP BY genres.id',
+	'DELETE FROM ickstream_years',
+	'INSERT INTO ickstream_years (id,tracks,albums,artwork) SELECT years.id,COUNT(tracks.id),COUNT(DISTINCT tracks.album),MIN(tracks.coverid) FROM years LEFT JOIN tracks ON tracks.year=years.id GROUP BY years.id',
+	'DELETE FROM ickstream_decades',
+	'INSERT INTO ickstream_decades (id,tracks,albums,artwork) SELECT (ickstream_years.id/10)*10,SUM(ickstream_years.tracks),SUM(ickstream_years.albums),MIN(ickstream_years.artwork) FROM ickstream_years GROUP BY (ickstream_years.id/10)*10',
+	'DELETE FROM ickstream_genre_contributors',
+	'INSERT INTO ickstream_genre_contributors (genre,contributor) SELECT DISTINCT genres.name,contributor_track.contributor FROM genres JOIN genre_track ON genre_track.genre=genres.id JOIN contributor_track ON contributor_track.track=genre_track.track',
+	'DELETE FROM ickstream_genre_albums',
+	'INSERT INTO ickstream_genre_albums (genre,album) SELECT DISTINCT genres.name,tracks.album FROM genres JOIN genre_track ON genre_track.genre=genres.id JOIN tracks ON tracks.id=genre_track.track',
+);
+
+sub init {
+	my $dbh = Slim::Schema->dbh;
+	my $searchTable = undef;
+	eval {
+		$dbh->do('CREATE TABLE IF NOT EXISTS ickstream_library_version (version INTEGER)');
+		($builtVersion) = $dbh->selectrow_array('SELECT version FROM ickstream_library_version');
+		($searchTable) = $dbh->selectrow_array("SELECT sql FROM sqlite_master WHERE name='ickstream_search_tracks'");
+		if(defined($searchTable) && $searchTable =~ /USING\s+(fts\d)/i) {
+			$searchModule = lc($1);
+		}
+	};
+	if($@) {
+		$log->error("Unable to read library index version: $@");
+	}
+	Slim::Control::Request::subscribe(\&scanDone,[['rescan'],['done']]);
+	# Tables built by older versions of the plugin don't have the search indexes
+	if(!isCurrent() || !defined($searchTable)) {
+		build();
+	}
+}
+
+sub stop {
+	Slim::Control::Request::unsubscribe(\&scanDone);
+	Slim::Utils::Scheduler::remove_task(\&buildStep);
+	@pendingStatements = ();
+	$buildingVersion = undef;
+}
+
+# True if the tables match the library, ContentAccessService falls back to its own SQL otherwise
+sub isCurrent {
+	return defined($builtVersion) && !Slim::Music::Import->stillScanning() && $builtVersion == (Slim::Music::Import->lastScanTime || 0);
+}
+
+sub scanDone {
+	my $request = shift;
+
+	$log->debug("Library scan done, rebuilding library index");
+	build();
+}
+
+# Starts building the tables in the background, one statement each time the scheduler runs the task.
+# A build already in progress is restarted with the new version.
+sub build {
+	my $version = Slim::Music::Import->lastScanTime;
+	if(!$version || Slim::Music::Import->stillScanning()) {
+		return;
+	}
+	if(!defined($buildingVersion)) {
+		Slim::Utils::Scheduler::add_task(\&buildStep);
+	}
+	$builtVersion = undef;
+	$buildingVersion = $version;
+	@pendingStatements = @buildStatements;
+	push @pendingStatements,searchStatements();
+}
+
+# The statements building the search indexes with the best full-text module SQLite supports
+sub searchStatements {
+	my $dbh = Slim::Schema->dbh;
+
+	$searchModule = undef;
+	my $definition = undef;
+	for my $module (@searchModules) {
+		eval {
+			$dbh->do('CREATE VIRTUAL TABLE temp.ickstream_search_probe USING '.$module->[1]);
+			$dbh->do('DROP TABLE temp.ickstream_search_probe');
+		};
+		if(!$@) {
+			($searchModule,$definition) = @$module;
+			last;
+		}
+	}
+	my @statements = ();
+	for my $index (sort keys %searchIndexes) {
+		push @statements,"DROP TABLE IF EXISTS ickstream_search_$index";
+		if(defined($searchModule)) {
+			push @statements,"CREATE VIRTUAL TABLE ickstream_search_$index USING $definition";
+			push @statements,"INSERT INTO ickstream_search_$index (rowid,text) ".$searchIndexes{$index};
+		}
+	}
+	if(!defined($searchModule)) {
+		$log->warn("SQLite has no full-text search, searching without index");
+	}
+	return @statements;
+}
+
+# Returns how a find* query gets the rows of a search index matching the search string of a controller,
+# or undef if it has to use LIKE instead. The query selects FROM 'from', which contains the ids of the
+# matching rows as search.id and needs 'match' as value for its placeholder. If the matches can be
+# ranked 'order_by' sorts them by relevance.
+sub search {
+	my $index = shift;
+	my $search = shift;
+
+	if(!defined($searchModule) || !exists($searchIndexes{$index}) || !isCurrent()) {
+		return undef;
+	}
+
+	# Every word of the search has to be the prefix of a word in the indexed column,
+	# words are quoted as they could be operators like OR
+	my @terms = ();
+	for my $word (split(/\W+/,Slim::Utils::Text::ignoreCaseArticles($search,1))) {
+		if($word ne '') {
+			push @terms,($searchModule eq 'fts5' ? '"'.$word.'"*' : '"'.$word.'*"');
+		}
+	}
+	if(scalar(@terms)==0) {
+		return undef;
+	}
+
+	my $table = "ickstream_search_$index";
+	if($searchModule eq 'fts5') {
+		return {
+			'from' => "(SELECT rowid AS id,rank FROM $table WHERE $table MATCH ?) AS search ",
+			'match' => join(' ',@terms),
+			'order_by' => 'search.rank'
+		};
+	}
+	return {
+		'from' => "(SELECT docid AS id FROM $table WHERE $table MATCH ?) AS search ",
+		'match' => join(' ',@terms)
+	};
+}
+
+sub buildStep {
+	if(!defined($buildingVersion)) {
+		return 0;
+	}
+	if(Slim::Music::Import->stillScanning()) {
+		# Started again when the scan is done
+		$log->debug("Library scan started, aborting library index build");
+		@pendingStatements = ();
+		$buildingVersion = undef;
+		return 0;
+	}
+
+	my $dbh = Slim::Schema->dbh;
+	if(scalar(@pendingStatements)>0) {
+		my $sql = shift @pendingStatements;
+		eval {
+			$dbh->do($sql);
+		};
+		if($@) {
+			$log->error("Unable to build library index, failed on $sql: $@");
+			@pendingStatements = ();
+			$buildingVersion = undef;
+			return 0;
+		}
+		return 1;
+	}
+
+	eval {
+		$dbh->do('INSERT INTO ickstream_library_version (version) VALUES (?)',undef,$buildingVersion);
+	};
+	if($@) {
+		$log->error("Unable to store library index version: $@");
+	}else {
+		$builtVersion = $buildingVersion;
+		$log->info("Library index built for scan at $builtVersion");
+	}
+	$buildingVersion = undef;
+	return 0;
+}
+
+1;
@@ -28,10 +28,12 @@ package Plugins::IckStreamPlugin::LocalServiceManager;
 use strict;
 use Scalar::Util qw(blessed);
 use Plugins::IckStreamPlugin::Plugin;
+use Plugins::IckStreamPlugin::PlayerDaemonChannel;
 use Slim::Utils::Prefs;
 use Slim::Utils::Log;
 use Slim::Utils::Misc;
 use JSON::XS::VersionOneAndTwo;
+use HTTP::Status qw(RC_OK);
 
 my $log   = logger('plugin.ickstream');
 my $prefs = preferences('plugin.ickstream');
@@ -128,9 +130,11 @@ sub getService {
 		
 			my $playerConfiguration = $prefs->client($player)->get('playerConfiguration') || {};
 			
-		    my $serverIP = Slim::Utils::IPDetect::IP();
-			my $params = { timeout => 35 };
-			Slim::Networking::SimpleAsyncHTTP->new(
+			Plugins::IckStreamPlugin::PlayerDaemonChannel::sendMessage($playerConfiguration->{'id'}, $serviceId, 2, to_json({
+				'jsonrpc' => "2.0",
+				'id' => $localRequestedServices->{$serviceId},
+				'method' => 'getServiceInformation'
+				}),
 				sub {
 					$log->warn("Successfully sent getServiceInformation request");
 				},
@@ -139,13 +143,7 @@ sub getService {
 					my $requestId = $localRequestedServices->{$serviceId};
 					$localRequestedServices->{$serviceId} = undef;
 					$localServiceRequestIds->{$requestId} = undef;
-				},
-				$params
-			)->post("http://".$serverIP.":".$prefs->get('daemonPort')."/sendMessage/".$serviceId."/2",'Content-Type' => 'application/json','Authorization'=>$playerConfiguration->{'id'},to_json({
-				'jsonrpc' => "2.0",
-				'id' => $localRequestedServices->{$serviceId},
-				'method' => 'getServiceInformation'
-				}));
+				});
 		}
 	}
 }
@@ -180,7 +178,7 @@ sub handleDiscoveryJSON {
 
         # create a hash to store our context
         my $uri = $httpResponse->request()->uri();
-        my $query = $uri->query();
+        my $query = $uri->query() || '';
 
 		my $httpParams = {};
 		foreach my $param (split /\&/, $query) {
@@ -193,33 +191,53 @@ sub handleDiscoveryJSON {
 		}
 		$log->is_debug && $log->debug( "Device information: " . Data::Dump::dump($httpParams) );
   
-		# Get player for uuid
-		my $players = $prefs->get('players');
-		my $player = undef;
-		if(defined($httpParams->{'toDeviceId'}) && $players->{$httpParams->{'toDeviceId'}}) {
-			$player = Slim::Player::Client::getClient($players->{$httpParams->{'toDeviceId'}});
-		}
-
 		my $procedure = from_json($input);
 
                 if ( main::DEBUGLOG && $log->is_debug ) {
                 $log->debug( "JSON parsed procedure: " . Data::Dump::dump($procedure) );
         }
 
-		my $service = $httpParams->{'fromService'};
-		$log->debug("GOT: ".$procedure->{'status'}." from ".$httpParams->{'fromDeviceId'}."(".$service.")");		
-		if($service & 4) {
-			if($procedure->{'status'} eq 'CONNECTED') {
-				getService($player, $httpParams->{'fromDeviceId'}, \&Plugins::IckStreamPlugin::Plugin::getNextRequestId);
-			}elsif($procedure->{'status'} eq 'DISCONNECTED') {
-				removeService($httpParams->{'fromDeviceId'});
+		if(ref($procedure) eq 'ARRAY') {
+			# Batch of collapsed events from the daemon, each event carries its own device information
+			for my $event (@$procedure) {
+				_handleDiscoveryEvent($event->{'toDeviceId'}, $event->{'fromDeviceId'}, $event->{'fromService'}, $event->{'status'});
 			}
+		}else {
+			_handleDiscoveryEvent($httpParams->{'toDeviceId'}, $httpParams->{'fromDeviceId'}, $httpParams->{'fromService'}, $procedure->{'status'});
 		}
-		
+
+		# The daemon treats a connection closed without a response as a failed request and posts the events again
+	    $httpResponse->code(RC_OK);
+	    $httpResponse->header('Content-Length' => 0);
+	    $httpResponse->header('Connection' => 'close');
+		$httpClient->send_response($httpResponse);
 	    Slim::Web::HTTP::closeHTTPSocket($httpClient);
 	    return;
 }
 
+sub _handleDiscoveryEvent {
+	my $toDeviceId = shift;
+	my $fromDeviceId = shift;
+	my $service = shift;
+	my $status = shift;
+
+	# Get player for uuid
+	my $players = $prefs->get('players');
+	my $player = undef;
+	if(defined($toDeviceId) && $players->{$toDeviceId}) {
+		$player = Slim::Player::Client::getClient($players->{$toDeviceId});
+	}
+
+	$log->debug("GOT: ".$status." from ".$fromDeviceId."(".$service.")");
+	if($service & 4) {
+		if($status eq 'CONNECTED') {
+			getService($player, $fromDeviceId, \&Plugins::IckStreamPlugin::Plugin::getNextRequestId);
+		}elsif($status eq 'DISCONNECTED') {
+			removeService($fromDeviceId);
+		}
+	}
+}
+
 
 1;
 
@@ -31,9 +31,11 @@ use warnings;
 use Slim::Utils::Log;
 use Slim::Utils::Misc;
 use Slim::Utils::Prefs;
+use Time::HiRes;
 use JSON::XS::VersionOneAndTwo;
 use Data::Dumper;
 use Plugins::IckStreamPlugin::ItemCache;
+use Plugins::IckStreamPlugin::IndexedQueue;
 
 my $log   = logger('plugin.ickstream.player');
 my $prefs = preferences('plugin.ickstream');
@@ -43,6 +45,15 @@ my $playbackQueuesLastChanged = {};
 my $originalPlaybackQueues = {};
 my $playbackQueues = {};
 
+# Every change of a playback queue increases its version, the latest changes are kept so
+# controllers can catch up from the version they know instead of getting the whole queue.
+# The versions of each process start at its start time in milliseconds, so a version a controller
+# got before LMS was restarted is never mistaken for one of the current queue.
+my $INITIAL_PLAYBACK_QUEUE_VERSION = int(Time::HiRes::time() * 1000);
+my $playbackQueueVersions = {};
+my $playbackQueueChanges = {};
+my $MAX_PLAYBACK_QUEUE_CHANGES = 100;
+
 sub getLastChanged {
 	my $player = shift;
 	
@@ -53,46 +64,197 @@ sub getLastChanged {
 	}
 }
 
-sub getPlaybackQueue {
+sub _getQueue {
+	my $queues = shift;
 	my $player = shift;
-	
-	my $playbackQueue = $playbackQueues->{$player->id};
-	my @emptyPlaybackQueue = ();
-	$playbackQueue = \@emptyPlaybackQueue if(!defined($playbackQueue));
-	
-	return $playbackQueue;
+
+	if(!defined($queues->{$player->id})) {
+		$queues->{$player->id} = Plugins::IckStreamPlugin::IndexedQueue->new();
+	}
+	return $queues->{$player->id};
 }
 
-sub getOriginalPlaybackQueue {
+# Records a change of the playback queue, without $change the whole queue has been replaced
+sub _changed {
 	my $player = shift;
-	
-	my $playbackQueue = $originalPlaybackQueues->{$player->id};
-	my @emptyPlaybackQueue = ();
-	$playbackQueue = \@emptyPlaybackQueue if(!defined($playbackQueue));
-	
-	return $playbackQueue;
+	my $change = shift;
+
+	my $timestamp = int(Time::HiRes::time() * 1000);
+	$playbackQueuesLastChanged->{$player->id} = $timestamp;
+
+	my $version = defined($playbackQueueVersions->{$player->id}) ? $playbackQueueVersions->{$player->id} : $INITIAL_PLAYBACK_QUEUE_VERSION;
+	$playbackQueueVersions->{$player->id} = $version + 1;
+	if(!defined($change)) {
+		$playbackQueueChanges->{$player->id} = [];
+		return;
+	}
+	my $changes = $playbackQueueChanges->{$player->id} || [];
+	my $last = (scalar(@{$changes})>0 && !$changes->[-1]->{'sealed'}) ? $changes->[-1]->{'change'} : undef;
+	if(defined($last) && $last->{'type'} eq 'REMOVE' && $change->{'type'} eq 'REMOVE' &&
+		($last->{'playbackQueuePos'} == $change->{'playbackQueuePos'} || $last->{'playbackQueuePos'} == $change->{'playbackQueuePos'} + 1)) {
+
+		# Adjacent removals are combined into one range, unless the version in between has been seen
+		$last->{'playbackQueuePos'} = $change->{'playbackQueuePos'};
+		$last->{'count'} += $change->{'count'};
+		$changes->[-1]->{'version'} = $version + 1;
+	}else {
+		push @{$changes}, {
+			'fromVersion' => $version,
+			'version' => $version + 1,
+			'change' => $change
+		};
+		shift @{$changes} if(scalar(@{$changes}) > $MAX_PLAYBACK_QUEUE_CHANGES);
+	}
+	$playbackQueueChanges->{$player->id} = $changes;
+}
+
+sub getPlaybackQueueVersion {
+	my $player = shift;
+
+	_seal($player);
+	return defined($playbackQueueVersions->{$player->id}) ? $playbackQueueVersions->{$player->id} : $INITIAL_PLAYBACK_QUEUE_VERSION;
+}
+
+# Once a version has been handed out, later changes must not be combined with the ones before it
+sub _seal {
+	my $player = shift;
+
+	my $changes = $playbackQueueChanges->{$player->id};
+	$changes->[-1]->{'sealed'} = 1 if(defined($changes) && scalar(@{$changes})>0);
+}
+
+# Returns the changes which turn the playback queue at $sinceVersion into the current one,
+# undef if they are no longer known and the whole queue has to be fetched
+sub getPlaybackQueueChanges {
+	my $player = shift;
+	my $sinceVersion = shift;
+
+	return undef if(!defined($sinceVersion));
+	my @result = ();
+	return \@result if($sinceVersion == getPlaybackQueueVersion($player));
+
+	my $found = 0;
+	for my $change (@{$playbackQueueChanges->{$player->id} || []}) {
+		$found = 1 if($change->{'fromVersion'} == $sinceVersion);
+		push @result, $change->{'change'} if($found);
+	}
+	return $found ? \@result : undef;
+}
+
+sub getPlaybackQueueCount {
+	my $player = shift;
+
+	return _getQueue($playbackQueues,$player)->count();
+}
+
+sub getPlaybackQueueItem {
+	my $player = shift;
+	my $pos = shift;
+
+	return _getQueue($playbackQueues,$player)->get($pos);
+}
+
+# Returns up to $count items starting at $offset, all remaining items if $count is undefined
+sub getPlaybackQueueItems {
+	my $player = shift;
+	my $offset = shift;
+	my $count = shift;
+
+	return _getQueue($playbackQueues,$player)->items($offset,$count);
+}
+
+sub getOriginalPlaybackQueueItems {
+	my $player = shift;
+	my $offset = shift;
+	my $count = shift;
+
+	return _getQueue($originalPlaybackQueues,$player)->items($offset,$count);
+}
+
+# Returns the position of the item with the same instanceId in the playback queue
+sub getPlaybackQueuePos {
+	my $player = shift;
+	my $item = shift;
+
+	return _getQueue($playbackQueues,$player)->position($item);
 }
 
 sub setPlaybackQueue {
 	my $player = shift;
 	my $playbackQueue = shift;
 	
-	$playbackQueues->{$player->id} = $playbackQueue;
-	
-	my $timestamp = int(Time::HiRes::time() * 1000);
-	$playbackQueuesLastChanged->{$player->id} = $timestamp;
-
+	$playbackQueues->{$player->id} = Plugins::IckStreamPlugin::IndexedQueue->new($playbackQueue);
+	_changed($player);
 }
 
 sub setOriginalPlaybackQueue {
 	my $player = shift;
 	my $playbackQueue = shift;
 	
-	$originalPlaybackQueues->{$player->id} = $playbackQueue;
-	
+	$originalPlaybackQueues->{$player->id} = Plugins::IckStreamPlugin::IndexedQueue->new($playbackQueue);
+
 	my $timestamp = int(Time::HiRes::time() * 1000);
 	$playbackQueuesLastChanged->{$player->id} = $timestamp;
+}
+
+# Inserts the items at $pos in the playback queue and at $originalPos in the original order,
+# an undefined position appends them
+sub insertPlaybackQueueItems {
+	my $player = shift;
+	my $pos = shift;
+	my $originalPos = shift;
+	my $items = shift;
+
+	my $playbackQueue = _getQueue($playbackQueues,$player);
+	$pos = $playbackQueue->count() if(!defined($pos) || $pos > $playbackQueue->count());
+	$playbackQueue->insert($pos,$items);
+	_getQueue($originalPlaybackQueues,$player)->insert($originalPos,$items);
+	_changed($player, {
+		'type' => 'INSERT',
+		'playbackQueuePos' => $pos,
+		'items' => [@{$items}]
+	});
+}
 
+# Removes the item at $pos from the playback queue and the original order
+sub removePlaybackQueueItem {
+	my $player = shift;
+	my $pos = shift;
+
+	my $item = _getQueue($playbackQueues,$player)->remove($pos);
+	if(defined($item)) {
+		_getQueue($originalPlaybackQueues,$player)->removeItem($item);
+		_changed($player, {
+			'type' => 'REMOVE',
+			'playbackQueuePos' => $pos,
+			'count' => 1
+		});
+	}
+	return $item;
+}
+
+# Moves the item at $from to $to, the original order is only changed if $moveOriginal is set,
+# which is only correct as long as it's the same as the playback queue
+sub movePlaybackQueueItem {
+	my $player = shift;
+	my $from = shift;
+	my $to = shift;
+	my $moveOriginal = shift;
+
+	my $playbackQueue = _getQueue($playbackQueues,$player);
+	$to = $playbackQueue->count() - 1 if(!defined($to) || $to >= $playbackQueue->count());
+	$to = 0 if($to < 0);
+	my $item = $playbackQueue->move($from,$to);
+	if(defined($item)) {
+		_getQueue($originalPlaybackQueues,$player)->move($from,$to) if($moveOriginal);
+		_changed($player, {
+			'type' => 'MOVE',
+			'playbackQueuePos' => $from,
+			'count' => 1,
+			'toPlaybackQueuePos' => $to
+		});
+	}
+	return $item;
 }
 
 1;
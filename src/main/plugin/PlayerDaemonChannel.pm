@@ -0,0 +1,325 @@
+# Copyright (c) 2013, ickStream GmbH
+# All rights reserved.
+# 
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#     * Redistributions of source code must retain the above copyright
+#       notice, this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright
+#       notice, this list of conditions and the following disclaimer in the
+#       documentation and/or other materials provided with the distribution.
+#     * Neither the name of ickStream nor the
+#       names of its contributors may be used to endorse or promote products
+#       derived from this software without specific prior written permission.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL LOGITECH, INC BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+package Plugins::IckStreamPlugin::PlayerDaemonChannel;
+
+# Persistent control channel to ickHttpSqueezeboxPlayerDaemon. Commands are
+# written as frames on a unix domain socket and acknowledged by the daemon,
+# when the channel can't be used they are posted over HTTP as before.
+
+use strict;
+use warnings;
+
+use IO::Socket::UNIX;
+use Socket qw(SOCK_STREAM);
+use Errno qw(EAGAIN EWOULDBLOCK EINTR);
+
+use Slim::Utils::Log;
+use Slim::Utils::Prefs;
+use Slim::Networking::Select;
+use Slim::Networking::SimpleAsyncHTTP;
+use Slim::Utils::Timers;
+use Time::HiRes;
+
+my $log = logger('plugin.ickstream');
+my $prefs  = preferences('plugin.ickstream');
+
+my $socketPath = undef;
+my $socket = undef;
+my $readBuffer = '';
+my $writeBuffer = '';
+my $nextSequence = 1;
+my $pendingRequests = {};
+
+# Seconds after which a request the daemon hasn't acknowledged fails, as over HTTP
+my $REQUEST_TIMEOUT = 35;
+
+sub setSocketPath {
+	$socketPath = shift;
+	disconnect();
+}
+
+sub start {
+	my $playerId = shift;
+	my $playerName = shift;
+	my $successCb = shift;
+	my $errorCb = shift;
+
+	_request('start', $playerId, undef, undef, $playerName, $successCb, $errorCb);
+}
+
+sub stop {
+	my $playerId = shift;
+	my $playerName = shift;
+	my $successCb = shift;
+	my $errorCb = shift;
+
+	_request('stop', $playerId, undef, undef, $playerName, $successCb, $errorCb);
+}
+
+# Send a message from the player to a device, to all devices if $toDeviceId is undefined
+sub sendMessage {
+	my $playerId = shift;
+	my $toDeviceId = shift;
+	my $toService = shift;
+	my $message = shift;
+	my $successCb = shift;
+	my $errorCb = shift;
+
+	_request('sendMessage', $playerId, $toDeviceId, $toService, $message, $successCb, $errorCb);
+}
+
+# Send several messages, each message is a hash with playerId, toDeviceId, toService and message.
+# The success callback gets the status codes of the messages in the same order. The messages are
+# sent in one request per player, so the daemon keeps them in order with the other messages of the player.
+sub sendMessages {
+	my $messages = shift;
+	my $successCb = shift;
+	my $errorCb = shift;
+
+	my @playerIds = ();
+	my $batches = {};
+	my $index = 0;
+	for my $message (@$messages) {
+		my $body = $message->{'message'};
+		utf8::encode($body) if utf8::is_utf8($body);
+		my $playerId = $message->{'playerId'};
+		if(!exists($batches->{$playerId})) {
+			push @playerIds, $playerId;
+			$batches->{$playerId} = {
+				'body' => '',
+				'indexes' => []
+			};
+		}
+		$batches->{$playerId}->{'body'} .= join(' ', $playerId, defined($message->{'toDeviceId'}) ? $message->{'toDeviceId'} : '-', defined($message->{'toService'}) ? $message->{'toService'} : '-', length($body))."\n".$body;
+		push @{$batches->{$playerId}->{'indexes'}}, $index++;
+	}
+
+	my @statuses = ();
+	my $pending = scalar(@playerIds);
+	if($pending == 0) {
+		&{$successCb}(\@statuses) if defined($successCb);
+		return;
+	}
+	my $failed = 0;
+	for my $playerId (@playerIds) {
+		my $batch = $batches->{$playerId};
+		my $batchCb = sub {
+			my $batchStatuses = shift;
+			my @values = split(/,/, defined($batchStatuses) ? $batchStatuses : '');
+			for my $i (@{$batch->{'indexes'}}) {
+				$statuses[$i] = shift @values;
+			}
+			if(--$pending == 0 && !$failed) {
+				&{$successCb}(\@statuses) if defined($successCb);
+			}
+		};
+		my $batchErrorCb = sub {
+			$pending--;
+			# Reported once for the whole batch
+			if(!$failed++) {
+				&{$errorCb}(@_) if defined($errorCb);
+			}
+		};
+		_request('sendMessages', $playerId, undef, undef, $batch->{'body'}, $batchCb, $batchErrorCb);
+	}
+}
+
+sub disconnect {
+	if(defined($socket)) {
+		Slim::Networking::Select::removeRead($socket);
+		Slim::Networking::Select::removeWrite($socket);
+		$socket->close();
+		$socket = undef;
+	}
+	$readBuffer = '';
+	$writeBuffer = '';
+	my $requests = $pendingRequests;
+	$pendingRequests = {};
+	for my $sequence (sort { $a <=> $b } keys %$requests) {
+		Slim::Utils::Timers::killTimers($requests->{$sequence}, \&_requestTimeout);
+		my $errorCb = $requests->{$sequence}->{'errorCb'};
+		if(defined($errorCb)) {
+			&{$errorCb}(undef, "Control channel closed");
+		}
+	}
+}
+
+sub _connect {
+	if(defined($socket)) {
+		return 1;
+	}
+	if(!defined($socketPath) || !-S $socketPath) {
+		return 0;
+	}
+	$socket = IO::Socket::UNIX->new(
+		Peer => $socketPath,
+		Type => SOCK_STREAM,
+	);
+	if(!defined($socket)) {
+		$log->warn("Unable to connect to control channel at $socketPath: $!");
+		return 0;
+	}
+	$socket->blocking(0);
+	Slim::Networking::Select::addRead($socket, \&_read);
+	$log->info("Connected to control channel at $socketPath");
+	return 1;
+}
+
+sub _request {
+	my $command = shift;
+	my $playerId = shift;
+	my $toDeviceId = shift;
+	my $toService = shift;
+	my $body = shift;
+	my $successCb = shift;
+	my $errorCb = shift;
+
+	if(!defined($body)) {
+		$body = '';
+	}
+	utf8::encode($body) if utf8::is_utf8($body);
+
+	if(!_connect()) {
+		_post($command, $playerId, $toDeviceId, $toService, $body, $successCb, $errorCb);
+		return;
+	}
+	my $sequence = $nextSequence++;
+	my $request = {
+		'successCb' => $successCb,
+		'errorCb' => $errorCb
+	};
+	$pendingRequests->{$sequence} = $request;
+	Slim::Utils::Timers::setTimer($request, Time::HiRes::time()+$REQUEST_TIMEOUT, \&_requestTimeout, $sequence);
+	$writeBuffer .= join(' ', $command, $sequence, $playerId, defined($toDeviceId) ? $toDeviceId : '-', defined($toService) ? $toService : '-', length($body))."\n".$body;
+	_write($socket);
+}
+
+sub _write {
+	my $sock = shift;
+
+	while(length($writeBuffer) > 0) {
+		my $written = syswrite($socket, $writeBuffer);
+		if(!defined($written)) {
+			if($! == EINTR) {
+				next;
+			}
+			if($! == EAGAIN || $! == EWOULDBLOCK) {
+				Slim::Networking::Select::addWrite($socket, \&_write);
+				return;
+			}
+			$log->warn("Error writing to control channel: $!");
+			disconnect();
+			return;
+		}
+		substr($writeBuffer, 0, $written, '');
+	}
+	Slim::Networking::Select::removeWrite($socket);
+}
+
+sub _read {
+	my $sock = shift;
+
+	my $data;
+	my $read = sysread($socket, $data, 4096);
+	if(!defined($read)) {
+		if($! == EAGAIN || $! == EWOULDBLOCK || $! == EINTR) {
+			return;
+		}
+		$log->warn("Error reading from control channel: $!");
+		disconnect();
+		return;
+	}elsif($read == 0) {
+		$log->warn("Control channel closed by daemon");
+		disconnect();
+		return;
+	}
+	$readBuffer .= $data;
+	while($readBuffer =~ s/^(\d+) (\d+)([^\t\n]*)(?:\t([^\n]*))?\n//) {
+		my $sequence = $1;
+		my $status = $2;
+		my $statusText = $3;
+		my $details = $4;
+		my $request = delete $pendingRequests->{$sequence};
+		next unless defined($request);
+		Slim::Utils::Timers::killTimers($request, \&_requestTimeout);
+		if($status == 200) {
+			&{$request->{'successCb'}}($details) if defined($request->{'successCb'});
+		}else {
+			&{$request->{'errorCb'}}(undef, "$status$statusText") if defined($request->{'errorCb'});
+		}
+	}
+}
+
+# The daemon stalled, a late acknowledgement is ignored
+sub _requestTimeout {
+	my $request = shift;
+	my $sequence = shift;
+
+	if(!defined(delete $pendingRequests->{$sequence})) {
+		return;
+	}
+	$log->warn("Request $sequence to control channel timed out");
+	&{$request->{'errorCb'}}(undef, "Timeout") if defined($request->{'errorCb'});
+}
+
+# Fallback when the daemon doesn't offer a control channel
+sub _post {
+	my $command = shift;
+	my $playerId = shift;
+	my $toDeviceId = shift;
+	my $toService = shift;
+	my $body = shift;
+	my $successCb = shift;
+	my $errorCb = shift;
+
+	my $path = $command;
+	if(defined($toDeviceId)) {
+		$path .= "/".$toDeviceId;
+		if(defined($toService)) {
+			$path .= "/".$toService;
+		}
+	}
+	my $contentType = $command eq 'sendMessage' ? 'application/json' : 'plain/text';
+	if($command eq 'sendMessages') {
+		$contentType = 'application/octet-stream';
+	}
+	my $serverIP = Slim::Utils::IPDetect::IP();
+	my $params = { timeout => 35 };
+	Slim::Networking::SimpleAsyncHTTP->new(
+		sub {
+			my $http = shift;
+			&{$successCb}($command eq 'sendMessages' ? $http->content : undef) if defined($successCb);
+		},
+		sub {
+			my $http = shift;
+			my $error = shift;
+			&{$errorCb}($http, $error) if defined($errorCb);
+		},
+		$params
+	)->post("http://".$serverIP.":".$prefs->get('daemonPort')."/".$path,'Content-Type' => $contentType,'Authorization'=>$playerId,$body);
+}
+
+1;
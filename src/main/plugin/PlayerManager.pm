@@ -34,6 +34,7 @@ use Slim::Utils::Prefs;
 use JSON::XS::VersionOneAndTwo;
 use Plugins::IckStreamPlugin::LicenseManager;
 use Plugins::IckStreamPlugin::Configuration;
+use Plugins::IckStreamPlugin::PlayerDaemonChannel;
 use Slim::Utils::Unicode;
 
 my $log = logger('plugin.ickstream');
@@ -131,26 +132,23 @@ sub uninitializePlayer {
 	my $player = shift;
 	
 	if(defined($initializedPlayers->{$player->id})) {
-		my $params = { timeout => 35 };
-	    my $serverIP = Slim::Utils::IPDetect::IP();
 	    my $playerConfiguration = $prefs->client($player)->get('playerConfiguration') || {};
 	    my $uuid = $playerConfiguration->{'id'};
 		if(!main::ISWINDOWS) {
 			my $playerName = Slim::Utils::Unicode::utf8encode($player->name());
 			$log->debug("Got player name: ".$playerName);
-			Slim::Networking::SimpleAsyncHTTP->new(
+			Plugins::IckStreamPlugin::PlayerDaemonChannel::stop($uuid, $playerName,
 				sub {
 					$initializedPlayers->{$player->id()} = undef;
 					$log->info("Successfully removed ".$player->name());
 				},
 				sub {
 					my $http = shift;
+					my $error = shift;
 					$initializedPlayers->{$player->id()} = undef;
 					use Data::Dumper;
-					$log->warn("Error when removing ".$player->name()." ".Dumper($http));
-				},
-				$params
-			)->post("http://".$serverIP.":".$prefs->get('daemonPort')."/stop",'Content-Type' => 'plain/text','Authorization'=>$uuid,$playerName);
+					$log->warn("Error when removing ".$player->name()." ".(defined($http) ? Dumper($http) : $error));
+				});
 		}
 	}
 }
@@ -325,7 +323,6 @@ sub _performPlayerInitialization {
 		if ( !defined($initializedPlayers->{$player->id}) ) {
 
 			$log->info("Initializing player: ".$player->name());
-			my $params = { timeout => 35 };
 			my $uuid = undef;
 			my $playerConfiguration = $prefs->client($player)->get('playerConfiguration') || {};
 			if(defined($playerConfiguration->{'id'})) {
@@ -340,10 +337,9 @@ sub _performPlayerInitialization {
 			$playerConfiguration->{'id'} = $uuid;
 			$prefs->client($player)->set('playerConfiguration', $playerConfiguration);
 			if(!main::ISWINDOWS) {
-			    my $serverIP = Slim::Utils::IPDetect::IP();
 				my $playerName = Slim::Utils::Unicode::utf8encode($player->name());
 				$log->debug("Got player name: ".$playerName);
-				Slim::Networking::SimpleAsyncHTTP->new(
+				Plugins::IckStreamPlugin::PlayerDaemonChannel::start($uuid, $playerName,
 					sub {
 						$initializedPlayers->{$player->id()} = 1;
 						$log->info("Successfully initialized ".$player->name());
@@ -353,9 +349,7 @@ sub _performPlayerInitialization {
 						$initializedPlayers->{$player->id()} = undef;
 						$log->warn("Error when initializing ".$player->name());
 						updateAddressOrRegisterPlayer($player, $callback,1);
-					},
-					$params
-				)->post("http://".$serverIP.":".$prefs->get('daemonPort')."/start",'Content-Type' => 'plain/text','Authorization'=>$uuid,$playerName);
+					});
 			}else {
 				updateAddressOrRegisterPlayer($player, $callback);
 			}
@@ -38,6 +38,8 @@ use Slim::Utils::Log;
 use Slim::Utils::Prefs;
 
 use Plugins::IckStreamPlugin::PlayerManager;
+use Plugins::IckStreamPlugin::ContentAccessServer;
+use Plugins::IckStreamPlugin::PlayerDaemonChannel;
 
 my $log = logger('plugin.ickstream');
 my $prefs  = preferences('plugin.ickstream');
@@ -154,7 +156,29 @@ sub start {
 	
 	$log->debug("Using port $daemonPort for background daemon");
 
-	my @cmd = ($serverPath, $serverIP, $daemonPort, $endpoint, "/plugins/IckStreamPlugin/discovery", $serverLog);
+	my @cmd = ($serverPath);
+	if($prefs->get('singleDaemon')) {
+		# Host the content server in the same process instead of a separate ickHttpWrapperDaemon
+		my ($serverUUID, $serverName) = Plugins::IckStreamPlugin::ContentAccessServer->identity();
+		$log->debug("Hosting content server $serverName($serverUUID) in background daemon");
+		push @cmd, ("-s", $serverUUID, "-n", $serverName, "-c", "/plugins/IckStreamPlugin/ContentAccessService/jsonrpc");
+		push @cmd, Plugins::IckStreamPlugin::ContentAccessServer->cacheArguments();
+	}
+	my $controlSocket = catfile($sprefs->get('cachedir'), 'ickstream-player.sock');
+	$log->debug("Using control channel at $controlSocket");
+	Plugins::IckStreamPlugin::PlayerDaemonChannel::setSocketPath($controlSocket);
+	push @cmd, ("-u", $controlSocket);
+	my $coalescingWindow = $prefs->get('notificationCoalescingWindow');
+	if($coalescingWindow) {
+		$log->debug("Coalescing notifications within $coalescingWindow ms");
+		push @cmd, ("-N", $coalescingWindow);
+		if($prefs->get('notificationCoalescingMethods')) {
+			push @cmd, ("-M", $prefs->get('notificationCoalescingMethods'));
+		}
+	}
+	# Without debug logging the output is discarded anyway, only errors are formatted
+	push @cmd, ("-L", ($log->is_debug() ? "debug" : "error"));
+	push @cmd, ($serverIP, $daemonPort, $endpoint, "/plugins/IckStreamPlugin/discovery", $serverLog);
 	$log->info("Starting server");
 
 	$log->debug("cmdline: ", join(' ', @cmd));
@@ -35,6 +35,7 @@ use JSON::XS::VersionOneAndTwo;
 use Data::Dumper;
 use Storable qw(dclone);
 use Plugins::IckStreamPlugin::Configuration;
+use Plugins::IckStreamPlugin::PlayerDaemonChannel;
 
 use Plugins::IckStreamPlugin::ItemCache;
 use Plugins::IckStreamPlugin::PlaybackQueueManager;
@@ -50,6 +51,8 @@ my $serverPrefs = preferences('server');
 my $inProcessOfChangingPlaylist = {};
 my $currentPlaylistWindowOffset = {};
 my $nextTrackInstance = 1;
+# Playback queue version of the last playbackQueueChanged notification of each player
+my $notifiedPlaybackQueueVersions = {};
 
 # this array provides a function for each supported JSON method
 my %methods = (
@@ -273,11 +276,9 @@ sub getPlayerStatus {
 		
 		my $playerStatus = $prefs->client($client)->get('playerStatus') || getDefaultPlayerStatus();
 		if(defined($playerStatus->{'playbackQueuePos'})) {
-	       	my $playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueue($client);
-	       	
-	       	if(scalar(@{$playbackQueue})>$playerStatus->{'playbackQueuePos'}) {
+	       	if(Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueCount($client)>$playerStatus->{'playbackQueuePos'}) {
 				$result->{'playbackQueuePos'} = $playerStatus->{'playbackQueuePos'};
-				$result->{'track'} = @{$playbackQueue}[$playerStatus->{'playbackQueuePos'}];
+				$result->{'track'} = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItem($client,$playerStatus->{'playbackQueuePos'});
 				$result->{'seekPos'} = Slim::Player::Source::songTime($client);
 	       	}
 		}
@@ -348,20 +349,20 @@ sub refreshCurrentPlaylist {
 	
 	my $notification = 1;
 	my $playerStatus = $prefs->client($client)->get('playerStatus') || getDefaultPlayerStatus();
-	my $playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueue($client);
+	my $playbackQueueCount = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueCount($client);
    	my $playbackQueuePos = $wantedPlaybackQueuePos || $playerStatus->{'playbackQueuePos'} || 0;
    	
-   	if($playbackQueuePos<scalar(@{$playbackQueue})) {
+   	if($playbackQueuePos<$playbackQueueCount) {
 		my $songIndex = Slim::Player::Source::playingSongIndex($client);
 
 		my $actualTrack = undef;
 		if($fromIckStream) {
-			if(!defined($wantedPlaybackQueuePos) && scalar(@{$playbackQueue})>$playbackQueuePos) {
-				$actualTrack = @{$playbackQueue}[$playbackQueuePos];
+			if(!defined($wantedPlaybackQueuePos) && $playbackQueueCount>$playbackQueuePos) {
+				$actualTrack = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItem($client,$playbackQueuePos);
 			}
 		}else {
-			if(!defined($wantedPlaybackQueuePos) && defined($currentPlaylistWindowOffset->{$client->id}) && scalar(@{$playbackQueue})>$currentPlaylistWindowOffset->{$client->id}+$songIndex) {
-				$actualTrack = @{$playbackQueue}[$currentPlaylistWindowOffset->{$client->id}+$songIndex];
+			if(!defined($wantedPlaybackQueuePos) && defined($currentPlaylistWindowOffset->{$client->id}) && $playbackQueueCount>$currentPlaylistWindowOffset->{$client->id}+$songIndex) {
+				$actualTrack = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItem($client,$currentPlaylistWindowOffset->{$client->id}+$songIndex);
 			}
 		}
 		#$log->debug(Dumper($actualTrack));
@@ -378,7 +379,7 @@ sub refreshCurrentPlaylist {
 			my $track = undef;
 			my $songIndex = 0;
 			if($playbackQueuePos>0) {
-				$track = @{$playbackQueue}[$playbackQueuePos-1];
+				$track = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItem($client,$playbackQueuePos-1);
 				$log->info("Inserting ".$track->{'id'}."(".$track->{'text'}.") "." before current position");
 				$request = Slim::Control::Request::executeRequest($client,['playlist','add',_getProtocolHandler($track->{'id'}).'://'.$track->{'id'}]);
 	        	$request->source('PLUGIN_ICKSTREAM');
@@ -388,8 +389,8 @@ sub refreshCurrentPlaylist {
 				$currentPlaylistWindowOffset->{$client->id} = $playbackQueuePos;
 			}
 			for(my $i=0;$i<10;$i++) {
-				if(scalar(@{$playbackQueue})>($playbackQueuePos+$i)) {
-					$track = @{$playbackQueue}[$playbackQueuePos+$i];
+				if($playbackQueueCount>($playbackQueuePos+$i)) {
+					$track = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItem($client,$playbackQueuePos+$i);
 					
 					$log->info("Adding ".$track->{'id'}."(".$track->{'text'}.") "." to playlist");
 					$request = Slim::Control::Request::executeRequest($client,['playlist','add',_getProtocolHandler($track->{'id'}).'://'.$track->{'id'}]);
@@ -420,7 +421,7 @@ sub refreshCurrentPlaylist {
 				$songIndex = 1;
 				my $previousSong = Slim::Player::Playlist::song($client,0);
 				if($playbackQueuePos>0) {
-					my $previousTrack = @{$playbackQueue}[$playbackQueuePos-1];
+					my $previousTrack = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItem($client,$playbackQueuePos-1);
 					if(!defined($previousSong) || $previousSong->url ne _getProtocolHandler($previousTrack->{'id'}).'://'.$previousTrack->{'id'}) {
 						$log->info("Deleting song before current position");
 						my $request = Slim::Control::Request::executeRequest($client,['playlist','delete',0]);
@@ -439,7 +440,7 @@ sub refreshCurrentPlaylist {
 				}
 					
 			}elsif($songIndex == 0 && $playbackQueuePos>0) {
-				my $track = @{$playbackQueue}[$playbackQueuePos-1];
+				my $track = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItem($client,$playbackQueuePos-1);
 				
 				$log->info("Inserting ".$track->{'id'}."(".$track->{'text'}.") "." before current position");
 				my $request = Slim::Control::Request::executeRequest($client,['playlist','insert',_getProtocolHandler($track->{'id'}).'://'.$track->{'id'}]);
@@ -449,7 +450,7 @@ sub refreshCurrentPlaylist {
 				$songIndex = 1;
 			}elsif($songIndex == 1 && $playbackQueuePos>0) {
 				my $previousSong = Slim::Player::Playlist::song($client,0);
-				my $previousTrack = @{$playbackQueue}[$playbackQueuePos-1];
+				my $previousTrack = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItem($client,$playbackQueuePos-1);
 				if(!defined($previousSong) || $previousSong->url ne _getProtocolHandler($previousTrack->{'id'}).'://'.$previousTrack->{'id'}) {
 					$log->info("Deleting song before current position");
 					my $request = Slim::Control::Request::executeRequest($client,['playlist','delete',0]);
@@ -464,8 +465,8 @@ sub refreshCurrentPlaylist {
 				
 			$currentPlaylistWindowOffset->{$client->id} = $playbackQueuePos - $songIndex;
 			for(my $i=1;$i<10;$i++) {
-				if(scalar(@{$playbackQueue})>($playbackQueuePos+$i)) {
-					my $track = @{$playbackQueue}[$playbackQueuePos+$i];
+				if($playbackQueueCount>($playbackQueuePos+$i)) {
+					my $track = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItem($client,$playbackQueuePos+$i);
 					my $song = undef;
 					do {
 						$song = Slim::Player::Playlist::song($client, $songIndex+$i);
@@ -494,6 +495,7 @@ sub refreshCurrentPlaylist {
 	        	$request->source('PLUGIN_ICKSTREAM');
 			}
 		}
+		Plugins::IckStreamPlugin::ProtocolHandler::prefetchStreamingRefs($client, $playbackQueuePos);
    	}
    	return $notification;
 }		   	
@@ -563,10 +565,6 @@ sub getTrack {
         }
         my $playerStatus = $prefs->client($client)->get('playerStatus') || getDefaultPlayerStatus();
 
-       	my $playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueue($client);
-       	my @emptyPlaybackQueue = ();
-       	$playbackQueue = \@emptyPlaybackQueue if(!defined($playbackQueue));
-
         my $result = {
         };
 		if(defined($playerStatus->{'playlistId'})) {
@@ -575,12 +573,12 @@ sub getTrack {
 		if(defined($playerStatus->{'playlistName'})) {
 			$result->{'playlistName'} = $playerStatus->{'playlistName'}
 		}
-		if(defined($reqParams->{'playbackQueuePos'}) && $reqParams->{'playbackQueuePos'}<scalar(@{$playbackQueue})) {
+		if(defined($reqParams->{'playbackQueuePos'}) && $reqParams->{'playbackQueuePos'}<Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueCount($client)) {
 			$result->{'playbackQueuePos'} = $reqParams->{'playbackQueuePos'};
-			$result->{'track'} = @{$playbackQueue}[$reqParams->{'playbackQueuePos'}];
+			$result->{'track'} = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItem($client,$reqParams->{'playbackQueuePos'});
 		}elsif(!defined($reqParams->{'playbackQueuePos'}) && defined($playerStatus->{'playbackQueuePos'})) {
 			$result->{'playbackQueuePos'} = $playerStatus->{'playbackQueuePos'};
-			$result->{'track'} = @{$playbackQueue}[$playerStatus->{'playbackQueuePos'}];
+			$result->{'track'} = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItem($client,$playerStatus->{'playbackQueuePos'});
 		}
         # the request was successful and is not async, send results back to caller!
         &{$responseCallback}($result);
@@ -598,11 +596,8 @@ sub setTrack {
         }
         
         my $playerStatus = $prefs->client($client)->get('playerStatus') || getDefaultPlayerStatus();
-       	my $playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueue($client);
-       	my @emptyPlaybackQueue = ();
-       	$playbackQueue = \@emptyPlaybackQueue if(!defined($playbackQueue));
 
-        if(defined($reqParams->{'playbackQueuePos'}) && $reqParams->{'playbackQueuePos'} < scalar(@{$playbackQueue})) {
+        if(defined($reqParams->{'playbackQueuePos'}) && $reqParams->{'playbackQueuePos'} < Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueCount($client)) {
         	$playerStatus->{'playbackQueuePos'} = $reqParams->{'playbackQueuePos'};
         	$playerStatus->{'seekPos'} = 0;
         	$prefs->client($client)->set('playerStatus',$playerStatus);
@@ -730,31 +725,16 @@ sub setPlaybackQueueMode {
         		
         	$log->debug("Restoring playlist to original order");
 
-        	my $playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueue($client);
-        	my @emptyPlaybackQueue = ();
-        	$playbackQueue = \@emptyPlaybackQueue if(!defined($playbackQueue));
-
         	my $currentPos = $playerStatus->{'playbackQueuePos'};
         	my $currentTrack = undef;
         	if(defined($currentPos)) {
-        		$currentTrack = @{$playbackQueue}[$currentPos];
+        		$currentTrack = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItem($client,$currentPos);
         	}
 
-        	my $originalPlaybackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getOriginalPlaybackQueue($client);
-        	
-        	$playbackQueue = \@emptyPlaybackQueue;
-        	push @{$playbackQueue},@{$originalPlaybackQueue};
-        	Plugins::IckStreamPlugin::PlaybackQueueManager::setPlaybackQueue($client, $playbackQueue);
+        	Plugins::IckStreamPlugin::PlaybackQueueManager::setPlaybackQueue($client, Plugins::IckStreamPlugin::PlaybackQueueManager::getOriginalPlaybackQueueItems($client));
         	
         	if(defined($currentTrack)) {
-        		my $i = 0;
-        		for my $item (@{$playbackQueue}) {
-        			if($currentTrack->{'instanceId'} == $item->{'instanceId'}) {
-        				last;
-        			}
-        			$i++;
-        		}
-        		$playerStatus->{'playbackQueuePos'} = $i;
+        		$playerStatus->{'playbackQueuePos'} = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueuePos($client,$currentTrack);
         	}
         	$sendPlaybackQueueChanged = 1;
         }elsif(($reqParams->{'playbackQueueMode'} eq 'QUEUE_SHUFFLE' && $playerStatus->{'playbackQueueMode'} ne 'QUEUE_REPEAT_SHUFFLE') ||
@@ -766,9 +746,7 @@ sub setPlaybackQueueMode {
         $prefs->client($client)->set('playerStatus',$playerStatus);
         if($shuffle) {
         	$log->debug("Shuffling playlist");
-	       	my $playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueue($client);
-        	my @emptyPlaybackQueue = ();
-        	$playbackQueue = \@emptyPlaybackQueue if(!defined($playbackQueue));
+	       	my $playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItems($client);
         	
         	my $currentItem = undef;
         	if(defined($playerStatus->{'playbackQueuePos'}) && $playerStatus->{'playbackQueuePos'}<scalar(@{$playbackQueue})) {
@@ -854,40 +832,30 @@ sub getPlaybackQueue {
 		}else {
 			$result->{'order'} = 'CURRENT';
 		}
-		my $items = undef;
-		if($result->{'order'} eq 'ORIGINAL') {
-			$items = Plugins::IckStreamPlugin::PlaybackQueueManager::getOriginalPlaybackQueue($client);
-		}else {
-			$items = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueue($client);
+		# Both orders always contain the same items
+		$result->{'countAll'} = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueCount($client);
+		$result->{'version'} = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueVersion($client);
+
+		# Only the changes of the current order are known, anything else falls back to the whole queue
+		my $changes = undef;
+		if(defined($reqParams->{'sinceVersion'}) && $result->{'order'} eq 'CURRENT') {
+			$changes = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueChanges($client,$reqParams->{'sinceVersion'});
 		}
-		
-		my $offset = $reqParams->{'offset'} || 0;
-		my $count = $reqParams->{'count'} || scalar(@{$items});
-		$result->{'offset'} = $offset;
-		$result->{'countAll'} = scalar(@{$items});
-		
-		if($offset < scalar(@{$items})) {
-			if(($offset + $count) > scalar(@{$items})) {
-				my @array = ();
-				if($offset < scalar(@{$items})) {
-					@array = @{$items}[$offset..(scalar(@{$items})-1)];
-				}
-				$result->{'items'} = \@array;
-			}else {
-				my @array = ();
-				if($offset < ($offset+$count)) {
-					@array = @{$items}[$offset..($offset+$count-1)];
-				}
-				$result->{'items'} = \@array;
-			}
+		if(defined($changes)) {
+			$result->{'sinceVersion'} = $reqParams->{'sinceVersion'};
+			$result->{'changes'} = $changes;
 		}else {
-			my @array = ();
-			if($offset < scalar(@{$items})) {
-				@array = @{$items}[$offset..(scalar(@{$items})-1)];
+			# A missing or zero count returns all remaining items
+			my $offset = $reqParams->{'offset'} || 0;
+			my $count = $reqParams->{'count'} || undef;
+			$result->{'offset'} = $offset;
+			if($result->{'order'} eq 'ORIGINAL') {
+				$result->{'items'} = Plugins::IckStreamPlugin::PlaybackQueueManager::getOriginalPlaybackQueueItems($client,$offset,$count);
+			}else {
+				$result->{'items'} = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItems($client,$offset,$count);
 			}
-			$result->{'items'} = \@array;
+			$result->{'count'} = scalar(@{$result->{'items'}});
 		}
-		$result->{'count'} = scalar(@{$result->{'items'}});
 		if(Plugins::IckStreamPlugin::PlaybackQueueManager::getLastChanged($client)) {
 			$result->{'lastChanged'} = Plugins::IckStreamPlugin::PlaybackQueueManager::getLastChanged($client);
 		}
@@ -911,12 +879,8 @@ sub setPlaylistName {
         $playerStatus->{'playlistName'} = $reqParams->{'playlistName'};
         $prefs->client($client)->set('playerStatus',$playerStatus);
         
-        my $playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueue($client);
-       	my @emptyPlaybackQueue = ();
-       	$playbackQueue = \@emptyPlaybackQueue if(!defined($playbackQueue));
-        
         my $result = {
-        	'countAll' => scalar(@{$playbackQueue})
+        	'countAll' => Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueCount($client)
         };
         if(defined($reqParams->{'playlistId'})) {
         	$result->{'playlistId'} = $reqParams->{'playlistId'};
@@ -944,19 +908,14 @@ sub addTracks {
         	my $instanceId = $nextTrackInstance;
         	$item->{'instanceId'} = $instanceId;
         	$nextTrackInstance++;
-        	Plugins::IckStreamPlugin::ItemCache::setItemInCache($item->{'id'},$item);
         }
+        my $missingItemIds = Plugins::IckStreamPlugin::ItemCache::setItemsInCache($items);
+        Plugins::IckStreamPlugin::ProtocolHandler::prefetchItems($client,$missingItemIds);
 
         if(defined($reqParams->{'playbackQueuePos'})) {
        		$log->debug("Inserting tracks at position: ".$reqParams->{'playbackQueuePos'});
         	# Insert tracks in middle
-        	my $playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueue($client);
-        	splice @{$playbackQueue},$reqParams->{'playbackQueuePos'},0,@{$items};
-       		Plugins::IckStreamPlugin::PlaybackQueueManager::setPlaybackQueue($client, $playbackQueue);
-       		
-        	my $originalPlaybackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getOriginalPlaybackQueue($client);
-        	splice @{$originalPlaybackQueue},$reqParams->{'playbackQueuePos'},0,@{$items};
-       		Plugins::IckStreamPlugin::PlaybackQueueManager::setOriginalPlaybackQueue($client, $originalPlaybackQueue);
+        	Plugins::IckStreamPlugin::PlaybackQueueManager::insertPlaybackQueueItems($client, $reqParams->{'playbackQueuePos'}, $reqParams->{'playbackQueuePos'}, $items);
         	
         	if(defined($playerStatus->{'playbackQueuePos'}) && $playerStatus->{'playbackQueuePos'}>=$reqParams->{'playbackQueuePos'}) {
         		$playerStatus->{'playbackQueuePos'} += scalar(@{$reqParams->{'items'}});
@@ -969,31 +928,18 @@ sub addTracks {
         		if(defined($playerStatus->{'playbackQueuePos'})) {
         			$currentPlaybackQueuePos = $playerStatus->{'playbackQueuePos'};
         		}
-        		my $playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueue($client);
-        		my $rangeLength = scalar(@{$playbackQueue}) - $currentPlaybackQueuePos - 1;
+        		my $playbackQueueCount = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueCount($client);
+        		my $rangeLength = $playbackQueueCount - $currentPlaybackQueuePos - 1;
+        		# Tracks are appended when there is no random position
+        		my $randomPosition = undef;
         		if($rangeLength > 0) {
-        			my $randomPosition = $currentPlaybackQueuePos + int(rand($rangeLength)) + 1;
-        			if($randomPosition < (scalar(@{$playbackQueue}) - 1)) {
-        				splice @{$playbackQueue},$randomPosition,0,@{$items};
-        			}else {
-        				push @{$playbackQueue},@{$reqParams->{'items'}};
-        			}
-        		}else {
-        			push @{$playbackQueue},@{$reqParams->{'items'}};
+        			$randomPosition = $currentPlaybackQueuePos + int(rand($rangeLength)) + 1;
+        			$randomPosition = undef if($randomPosition >= ($playbackQueueCount - 1));
         		}
-        		Plugins::IckStreamPlugin::PlaybackQueueManager::setPlaybackQueue($client, $playbackQueue);
-        		my $originalPlaybackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getOriginalPlaybackQueue($client);
-        		push @{$originalPlaybackQueue},@{$items};
-        		Plugins::IckStreamPlugin::PlaybackQueueManager::setOriginalPlaybackQueue($client, $originalPlaybackQueue);
+        		Plugins::IckStreamPlugin::PlaybackQueueManager::insertPlaybackQueueItems($client, $randomPosition, undef, $items);
         	}else {
         		$log->debug("Adding tracks to the end");
-        		my $playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueue($client);
-        		push @{$playbackQueue},@{$items};
-        		Plugins::IckStreamPlugin::PlaybackQueueManager::setPlaybackQueue($client, $playbackQueue);
-        		
-        		my $originalPlaybackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getOriginalPlaybackQueue($client);
-        		push @{$originalPlaybackQueue},@{$items};
-        		Plugins::IckStreamPlugin::PlaybackQueueManager::setOriginalPlaybackQueue($client, $originalPlaybackQueue);
+        		Plugins::IckStreamPlugin::PlaybackQueueManager::insertPlaybackQueueItems($client, undef, undef, $items);
         	}
         }
         if(!defined($playerStatus->{'playbackQueuePos'})) {
@@ -1023,58 +969,43 @@ sub removeTracks {
         }
         my $playerStatus = $prefs->client($client)->get('playerStatus') || getDefaultPlayerStatus();
         
-       	my $playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueue($client);
-
-       	my $originalPlaybackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getOriginalPlaybackQueue($client);
-
-        my @emptyModifiedPlaybackQueue = ();
-        my $modifiedPlaybackQueue = \@emptyModifiedPlaybackQueue;
-        if(scalar(@{$playbackQueue})>0) {
-	        push @{$modifiedPlaybackQueue},@{$playbackQueue};
-        }        
-        my $modifiedPlaybackQueuePos = $playerStatus->{'playbackQueuePos'};
-        my $affectsPlayback = 0;
+        # All references refer to the playback queue as it was before any track was removed
+        my %removedPositions = ();
+        my $playbackQueue = undef;
         for my $itemReference (@{$reqParams->{'items'}}) {
         	if(defined($itemReference->{'playbackQueuePos'})) {
-        		my $item = @{$playbackQueue}[$itemReference->{'playbackQueuePos'}];
-        		if($item->{'id'} eq $itemReference->{'id'}) {
-        			if($itemReference->{'playbackQueuePos'} < $playerStatus->{'playbackQueuePos'}) {
-        				$modifiedPlaybackQueuePos--;
-        			}elsif($itemReference->{'playbackQueuePos'} == $playerStatus->{'playbackQueuePos'}) {
-        				$affectsPlayback = 1;
-        			}
-        			my $removedItem = splice @{$modifiedPlaybackQueue},$itemReference->{'playbackQueuePos'},1;
-        			@{$originalPlaybackQueue} = grep { $_->{'instanceId'} ne $removedItem->{'instanceId'}} @{$originalPlaybackQueue};
+        		my $item = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItem($client,$itemReference->{'playbackQueuePos'});
+        		if(defined($item) && $item->{'id'} eq $itemReference->{'id'}) {
+        			$removedPositions{$itemReference->{'playbackQueuePos'}} = 1;
         		}else {
         			# TODO: Handle error non matching playbackQueuePos and id
         		}
         	}else {
-        		my @itemsToDelete = ();
+        		$playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItems($client) if(!defined($playbackQueue));
         		my $i = 0;
-        		for my $item (@{$modifiedPlaybackQueue}) {
+        		for my $item (@{$playbackQueue}) {
         			if($item->{'id'} eq $itemReference->{'id'}) {
-        				if($i<$modifiedPlaybackQueuePos) {
-        					$modifiedPlaybackQueuePos--;
-        				}elsif($i==$modifiedPlaybackQueuePos) {
-        					$affectsPlayback = 1;
-        				}
-        				push @itemsToDelete,$i;
+        				$removedPositions{$i} = 1;
         			}
         			$i++;
         		}
-        		my $deleteOffset = 0;
-        		for my $i (@itemsToDelete) {
-        			my $removedItem = splice @{$modifiedPlaybackQueue},($i-$deleteOffset),1;
-        			$deleteOffset++;
-        			@{$originalPlaybackQueue} = grep { $_->{'instanceId'} ne $removedItem->{'instanceId'}} @{$originalPlaybackQueue};
-        		}
         	}
         }
-        $playbackQueue = $modifiedPlaybackQueue;
-        Plugins::IckStreamPlugin::PlaybackQueueManager::setPlaybackQueue($client, $playbackQueue);
-        Plugins::IckStreamPlugin::PlaybackQueueManager::setOriginalPlaybackQueue($client, $originalPlaybackQueue);
 
-        if($modifiedPlaybackQueuePos >= scalar(@{$modifiedPlaybackQueue})) {
+        my $modifiedPlaybackQueuePos = $playerStatus->{'playbackQueuePos'};
+        my $affectsPlayback = 0;
+        # Removed from the end, so the positions of the remaining ones stay valid
+        for my $pos (sort { $b <=> $a } keys %removedPositions) {
+        	if($pos < $playerStatus->{'playbackQueuePos'}) {
+        		$modifiedPlaybackQueuePos--;
+        	}elsif($pos == $playerStatus->{'playbackQueuePos'}) {
+        		$affectsPlayback = 1;
+        	}
+        	Plugins::IckStreamPlugin::PlaybackQueueManager::removePlaybackQueueItem($client,$pos);
+        }
+        my $playbackQueueCount = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueCount($client);
+
+        if($modifiedPlaybackQueuePos >= $playbackQueueCount) {
         	if($modifiedPlaybackQueuePos>0) {
         		$modifiedPlaybackQueuePos--;
         	}
@@ -1089,7 +1020,7 @@ sub removeTracks {
         
         # TODO: if playing
         if(0 && $affectsPlayback) {
-        	if(scalar(@{$modifiedPlaybackQueue})>0) {
+        	if($playbackQueueCount>0) {
         		# TODO: Play
         	}else {
         		$playerStatus->{'playbackQueuePos'} = undef;
@@ -1125,22 +1056,13 @@ sub moveTracks {
         
         my $playerStatus = $prefs->client($client)->get('playerStatus') || getDefaultPlayerStatus();
         my $modifiedPlaybackQueuePos = $playerStatus->{'playbackQueuePos'};
-
-       	my $playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueue($client);
-
-       	my $originalPlaybackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getOriginalPlaybackQueue($client);
-       	my @emptyOriginalPlaybackQueue = ();
-       	$originalPlaybackQueue = \@emptyOriginalPlaybackQueue if(!defined($originalPlaybackQueue));
-
-        my @emptyModifiedPlaybackQueue = ();
-        my $modifiedPlaybackQueue = \@emptyModifiedPlaybackQueue;
-        if(scalar(@{$playbackQueue})>0) {
-	        push @{$modifiedPlaybackQueue},@{$playbackQueue};
-        }        
+        my $playbackQueueCount = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueCount($client);
+        # The original order only follows the moves as long as it's the same as the playback queue
+        my $moveOriginal = ($playerStatus->{'playbackQueueMode'} ne 'QUEUE_SHUFFLE' && $playerStatus->{'playbackQueueMode'} ne 'QUEUE_REPEAT_SHUFFLE');
 
 		my $items = $reqParams->{'items'};
 		
-		my $wantedPlaybackQueuePos = scalar(@{$playbackQueue});
+		my $wantedPlaybackQueuePos = $playbackQueueCount;
 		if(defined($reqParams->{'playbackQueuePos'})) {
 			$wantedPlaybackQueuePos = $reqParams->{'playbackQueuePos'};
 		}
@@ -1152,26 +1074,25 @@ sub moveTracks {
 			if(!defined($itemReference->{'id'})) {
 				# TODO: return error
 			}
+			my $item = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItem($client,$itemReference->{'playbackQueuePos'});
+			if(!defined($item)) {
+				# TODO: return error
+				next;
+			}
+			if($item->{'id'} ne $itemReference->{'id'}) {
+				# TODO: return error
+			}
 			
 			# Move that doesn't affect playback queue position
 			if(($wantedPlaybackQueuePos <= $modifiedPlaybackQueuePos && $itemReference->{'playbackQueuePos'} < $modifiedPlaybackQueuePos) ||
 				$wantedPlaybackQueuePos > $modifiedPlaybackQueuePos && $itemReference->{'playbackQueuePos'} > $modifiedPlaybackQueuePos) {
 					
 				$log->debug("Move that doesn't affect playback queue position: ".$itemReference->{'playbackQueuePos'});
-				my $item = splice @{$modifiedPlaybackQueue},$itemReference->{'playbackQueuePos'},1;
-				if($item->{'id'} ne $itemReference->{'id'}) {
-					# TODO: return error
-				}
-				
 				my $offset = 0;
 				if($wantedPlaybackQueuePos >= $itemReference->{'playbackQueuePos'}) {
 					$offset = -1;
 				}
-				if(($wantedPlaybackQueuePos + $offset) < scalar(@{$modifiedPlaybackQueue})) {
-					splice @{$modifiedPlaybackQueue},$wantedPlaybackQueuePos+$offset,0,$item;
-				}else {
-					push @{$modifiedPlaybackQueue},$item;
-				}
+				Plugins::IckStreamPlugin::PlaybackQueueManager::movePlaybackQueueItem($client,$itemReference->{'playbackQueuePos'},$wantedPlaybackQueuePos+$offset,$moveOriginal);
 				if($wantedPlaybackQueuePos < $itemReference->{'playbackQueuePos'}) {
 					$wantedPlaybackQueuePos++;
 				}
@@ -1179,50 +1100,33 @@ sub moveTracks {
 			# Move that increase playback queue position
 			}elsif($wantedPlaybackQueuePos <= $modifiedPlaybackQueuePos && $itemReference->{'playbackQueuePos'} > $modifiedPlaybackQueuePos) {
 				$log->debug("Move that increase playback queue position: ".$itemReference->{'playbackQueuePos'});
-				my $item = splice @{$modifiedPlaybackQueue},$itemReference->{'playbackQueuePos'},1;
-				if($item->{'id'} ne $itemReference->{'id'}) {
-					# TODO: return error
-				}
-				splice @{$modifiedPlaybackQueue},$wantedPlaybackQueuePos,0,$item;
+				Plugins::IckStreamPlugin::PlaybackQueueManager::movePlaybackQueueItem($client,$itemReference->{'playbackQueuePos'},$wantedPlaybackQueuePos,$moveOriginal);
 				$modifiedPlaybackQueuePos++;
 				$wantedPlaybackQueuePos++;
 			
 			# Move that decrease playback queue position
 			}elsif($wantedPlaybackQueuePos > $modifiedPlaybackQueuePos && $itemReference->{'playbackQueuePos'} < $modifiedPlaybackQueuePos) {
 				$log->debug("Move that decrease playback queue position: ".$itemReference->{'playbackQueuePos'});
-				my $item = splice @{$modifiedPlaybackQueue},$itemReference->{'playbackQueuePos'},1;
-				if($item->{'id'} ne $itemReference->{'id'}) {
-					# TODO: return error
-				}
 				my $offset = 0;
 				if($wantedPlaybackQueuePos >= $itemReference->{'playbackQueuePos'}) {
 					$offset = -1;
 				}
-				if(($wantedPlaybackQueuePos + $offset) < scalar(@{$modifiedPlaybackQueue})) {
-					splice @{$modifiedPlaybackQueue},$wantedPlaybackQueuePos+$offset,0,$item;
-				}else {
-					push @{$modifiedPlaybackQueue},$item;
-				}
+				Plugins::IckStreamPlugin::PlaybackQueueManager::movePlaybackQueueItem($client,$itemReference->{'playbackQueuePos'},$wantedPlaybackQueuePos+$offset,$moveOriginal);
 				$modifiedPlaybackQueuePos--;
 				
 			# Move of currently playing track
 			}elsif($itemReference->{'playbackQueuePos'} == $modifiedPlaybackQueuePos) {
 				$log->debug("Move of currently playing track: ".$itemReference->{'playbackQueuePos'});
-				my $item = splice @{$modifiedPlaybackQueue},$itemReference->{'playbackQueuePos'},1;
-				if($item->{'id'} ne $itemReference->{'id'}) {
-					# TODO: return error
-				}
-				
-				if($wantedPlaybackQueuePos < (scalar(@{$modifiedPlaybackQueue})+1)) {
+				if($wantedPlaybackQueuePos < $playbackQueueCount) {
 					if($wantedPlaybackQueuePos > $itemReference->{'playbackQueuePos'}) {
-						splice @{$modifiedPlaybackQueue},$wantedPlaybackQueuePos - 1,0,$item;
+						Plugins::IckStreamPlugin::PlaybackQueueManager::movePlaybackQueueItem($client,$itemReference->{'playbackQueuePos'},$wantedPlaybackQueuePos - 1,$moveOriginal);
 						$modifiedPlaybackQueuePos = $wantedPlaybackQueuePos - 1;
 					} else {
-						splice @{$modifiedPlaybackQueue},$wantedPlaybackQueuePos,0,$item;
+						Plugins::IckStreamPlugin::PlaybackQueueManager::movePlaybackQueueItem($client,$itemReference->{'playbackQueuePos'},$wantedPlaybackQueuePos,$moveOriginal);
 						$modifiedPlaybackQueuePos = $wantedPlaybackQueuePos;
 					}
 				}else {
-					push @{$modifiedPlaybackQueue},$item;
+					Plugins::IckStreamPlugin::PlaybackQueueManager::movePlaybackQueueItem($client,$itemReference->{'playbackQueuePos'},undef,$moveOriginal);
 					$modifiedPlaybackQueuePos = $wantedPlaybackQueuePos - 1;
 				}
 				if($wantedPlaybackQueuePos < $itemReference->{'playbackQueuePos'}) {
@@ -1231,18 +1135,6 @@ sub moveTracks {
 			}
 		
 		}
-		#$log->debug("New playback queue is: ".Dumper($modifiedPlaybackQueue));
-		
-		if($playerStatus->{'playbackQueueMode'} ne 'QUEUE_SHUFFLE' || $playerStatus->{'playbackQueueMode'} ne 'QUEUE_REPEAT_SHUFFLE') {
-			my @empty = ();
-			$originalPlaybackQueue = \@empty;
-			push @{$originalPlaybackQueue},@{$modifiedPlaybackQueue};
-			Plugins::IckStreamPlugin::PlaybackQueueManager::setOriginalPlaybackQueue($client, $originalPlaybackQueue);
-		}
-		my @empty = ();
-		$playbackQueue = \@empty;
-		push @{$playbackQueue},@{$modifiedPlaybackQueue};
-		Plugins::IckStreamPlugin::PlaybackQueueManager::setPlaybackQueue($client, $playbackQueue);
 		
 		my $sendPlayerStatusChanged = 0;
 		if($playerStatus->{'playbackQueuePos'} != $modifiedPlaybackQueuePos) {
@@ -1284,10 +1176,11 @@ sub setTracks {
         	my $instanceId = $nextTrackInstance;
         	$item->{'instanceId'} = $instanceId;
         	$nextTrackInstance++;
-        	Plugins::IckStreamPlugin::ItemCache::setItemInCache($item->{'id'},$item);
         }
         my @empty = ();
         $items = \@empty if(!defined($items));
+        my $missingItemIds = Plugins::IckStreamPlugin::ItemCache::setItemsInCache($items);
+        Plugins::IckStreamPlugin::ProtocolHandler::prefetchItems($client,$missingItemIds);
         my @emptyPlaybackQueue = ();
         my $playbackQueue = \@emptyPlaybackQueue;
         if(scalar(@{$items})>0) {
@@ -1350,7 +1243,7 @@ sub shuffleTracks {
         
         my $playerStatus = $prefs->client($client)->get('playerStatus') || getDefaultPlayerStatus();
         
-       	my $playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueue($client);
+       	my $playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItems($client);
        	
        	if(scalar(@{$playbackQueue})>0) {
 	       	my $currentItem = undef;
@@ -1369,14 +1262,10 @@ sub shuffleTracks {
         	$prefs->client($client)->set('playerStatus',$playerStatus);
 	       	
 	       	if($playerStatus->{'playbackQueueMode'} ne 'QUEUE_SHUFFLE' && $playerStatus->{'playbackQueueMode'} ne 'QUEUE_REPEAT_SHUFFLE') {
-			       	my @emptyOriginalPlaybackQueue = ();
-			       	my $originalPlaybackQueue = \@emptyOriginalPlaybackQueue;
-			       	push @{$originalPlaybackQueue},@{$playbackQueue};
-			       	Plugins::IckStreamPlugin::PlaybackQueueManager::setOriginalPlaybackQueue($client, $originalPlaybackQueue);
+			       	Plugins::IckStreamPlugin::PlaybackQueueManager::setOriginalPlaybackQueue($client, $playbackQueue);
 	       	}
 
-			sendPlaybackQueueChangedNotification($client);
-			sendPlayerStatusChangedNotification($client);
+			sendPlaybackQueueAndPlayerStatusChangedNotifications($client);
        	}
 
         my $result = {
@@ -1394,6 +1283,51 @@ sub sendPlaybackQueueChangedNotification {
 	my $client = shift;
 	
 	my $playerConfiguration = $prefs->client($client)->get('playerConfiguration') || {};
+	my $notification = _createPlaybackQueueChangedNotification($client);
+
+	if(!main::ISWINDOWS) {
+		Plugins::IckStreamPlugin::PlayerDaemonChannel::sendMessage($playerConfiguration->{'id'}, undef, undef, to_json($notification),
+			sub {
+				$log->info("Successfully sent playbackQueueChanged for ".$client->name());
+			},
+			sub {
+				$log->warn("Error when sending playbackQueueChanged for ".$client->name());
+			});
+	}
+}
+
+# Sends both notifications in one request to the daemon
+sub sendPlaybackQueueAndPlayerStatusChangedNotifications {
+	my $client = shift;
+
+	my $playerConfiguration = $prefs->client($client)->get('playerConfiguration') || {};
+	my @messages = ();
+	for my $notification (_createPlaybackQueueChangedNotification($client), _createPlayerStatusChangedNotification($client)) {
+		push @messages, {
+			'playerId' => $playerConfiguration->{'id'},
+			'message' => to_json($notification)
+		};
+	}
+
+	if(!main::ISWINDOWS) {
+		Plugins::IckStreamPlugin::PlayerDaemonChannel::sendMessages(\@messages,
+			sub {
+				my $statuses = shift;
+				if(grep { $_ != 200 } @$statuses) {
+					$log->warn("Error when sending playbackQueueChanged/playerStatusChanged for ".$client->name().": ".join(',',@$statuses));
+				}else {
+					$log->info("Successfully sent playbackQueueChanged and playerStatusChanged for ".$client->name());
+				}
+			},
+			sub {
+				$log->warn("Error when sending playbackQueueChanged and playerStatusChanged for ".$client->name());
+			});
+	}
+}
+
+sub _createPlaybackQueueChangedNotification {
+	my $client = shift;
+
 	my $playerStatus = $prefs->client($client)->get('playerStatus');
 	my $notification = {
 		'jsonrpc' => '2.0',
@@ -1406,31 +1340,45 @@ sub sendPlaybackQueueChangedNotification {
 	if(defined($playerStatus->{'playlistName'})) {
 		$notification->{'params'}->{'playlistName'} = $playerStatus->{'playlistName'}
 	}
-	my $playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueue($client);
-	$notification->{'params'}->{'countAll'} = scalar(@{$playbackQueue});
+	$notification->{'params'}->{'countAll'} = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueCount($client);
+
+	# Controllers which know the previous version can apply the changes instead of fetching the whole queue
+	my $version = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueVersion($client);
+	my $changes = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueChanges($client,$notifiedPlaybackQueueVersions->{$client->id});
+	$notification->{'params'}->{'version'} = $version;
+	if(defined($changes)) {
+		$notification->{'params'}->{'sinceVersion'} = $notifiedPlaybackQueueVersions->{$client->id};
+		$notification->{'params'}->{'changes'} = $changes;
+	}
+	$notifiedPlaybackQueueVersions->{$client->id} = $version;
 	
 	if(Plugins::IckStreamPlugin::PlaybackQueueManager::getLastChanged($client)) {
 		$notification->{'params'}->{'lastChanged'} = Plugins::IckStreamPlugin::PlaybackQueueManager::getLastChanged($client);
 	}
 	
     if($log->is_debug) { my $val = dclone($notification);$log->debug("notification: ".Data::Dump::dump($val)); }
+	return $notification;
+}
+
+sub sendPlayerStatusChangedNotification {
+	my $client = shift;
+	my $seekPos = shift;
+
+	my $playerConfiguration = $prefs->client($client)->get('playerConfiguration') || {};
+	my $notification = _createPlayerStatusChangedNotification($client, $seekPos);
 
 	if(!main::ISWINDOWS) {
-	    my $serverIP = Slim::Utils::IPDetect::IP();
-		my $params = { timeout => 35 };
-		Slim::Networking::SimpleAsyncHTTP->new(
+		Plugins::IckStreamPlugin::PlayerDaemonChannel::sendMessage($playerConfiguration->{'id'}, undef, undef, to_json($notification),
 			sub {
-				$log->info("Successfully sent playbackQueueChanged for ".$client->name());
+				$log->info("Successfully sent playerStatusChanged for ".$client->name());
 			},
 			sub {
-				$log->warn("Error when sending playbackQueueChanged for ".$client->name());
-			},
-			$params
-		)->post("http://".$serverIP.":".$prefs->get('daemonPort')."/sendMessage",'Content-Type' => 'application/json','Authorization'=>$playerConfiguration->{'id'},to_json($notification));
+				$log->warn("Error when sending playerStatusChanged for ".$client->name());
+			});
 	}
 }
 
-sub sendPlayerStatusChangedNotification {
+sub _createPlayerStatusChangedNotification {
 	my $client = shift;
 	my $seekPos = shift;
 	if(!defined($seekPos)) {
@@ -1456,11 +1404,9 @@ sub sendPlayerStatusChangedNotification {
 	
 	my $playerStatus = $prefs->client($client)->get('playerStatus');
 	if(defined($playerStatus->{'playbackQueuePos'})) {
-       	my $playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueue($client);
-       	
 		$notification->{'params'}->{'seekPos'} = $seekPos;
 		$notification->{'params'}->{'playbackQueuePos'} = $playerStatus->{'playbackQueuePos'};
-		$notification->{'params'}->{'track'} = @{$playbackQueue}[$playerStatus->{'playbackQueuePos'}];
+		$notification->{'params'}->{'track'} = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItem($client,$playerStatus->{'playbackQueuePos'});
 	}
 	$notification->{'params'}->{'playbackQueueMode'} = $playerStatus->{'playbackQueueMode'};
 
@@ -1483,20 +1429,7 @@ sub sendPlayerStatusChangedNotification {
 	$notification->{'params'}->{'playing'} = $playing;
 
     if($log->is_info) { my $val = dclone($notification);$log->info("notification: ".Data::Dump::dump($val)); }
-
-	if(!main::ISWINDOWS) {
-	    my $serverIP = Slim::Utils::IPDetect::IP();
-		my $params = { timeout => 35 };
-		Slim::Networking::SimpleAsyncHTTP->new(
-			sub {
-				$log->info("Successfully sent playerStatusChanged for ".$client->name());
-			},
-			sub {
-				$log->warn("Error when sending playerStatusChanged for ".$client->name());
-			},
-			$params
-		)->post("http://".$serverIP.":".$prefs->get('daemonPort')."/sendMessage",'Content-Type' => 'application/json','Authorization'=>$playerConfiguration->{'id'},to_json($notification));
-	}
+	return $notification;
 }
 
 sub getDefaultPlayerStatus() {
@@ -1511,15 +1444,14 @@ sub moveToNextTrack {
 	if(!$inProcessOfChangingPlaylist->{$player->id}) {
 		my $playerStatus = $prefs->client($player)->get('playerStatus') || getDefaultPlayerStatus();
 		if(defined($playerStatus->{'playbackQueuePos'})) {
-	       	my $playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueue($player);
-	       	
 			my $playbackQueuePos = $playerStatus->{'playbackQueuePos'};
 			my $playing = 0;
-			if(scalar(@{$playbackQueue})>($playbackQueuePos + 1)) {
+			if(Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueCount($player)>($playbackQueuePos + 1)) {
 				$playerStatus->{'playbackQueuePos'} += 1;
 				$playing = 1;
 			}else {
 				if($playerStatus->{'playbackQueueMode'} eq 'QUEUE_REPEAT_SHUFFLE') {
+		        	my $playbackQueue = Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItems($player);
 		        	fisher_yates_shuffle($playbackQueue);
 		        	Plugins::IckStreamPlugin::PlaybackQueueManager::setPlaybackQueue($player, $playbackQueue);
 
@@ -1601,12 +1533,12 @@ sub handleJSONRPC {
 			}
 		}
 		$log->is_debug && $log->debug( "Device information: " . Data::Dump::dump($httpParams) );
+		$context->{'httpParams'} = $httpParams;
   
 		my $procedure = undef;
 		eval {
 	        # Parse the input
 	        # Convert JSON to Perl
-	        # FIXME: JSON 2.0 accepts multiple requests ? How do we parse that efficiently?
 	        $procedure = from_json($input);
 		};
         if ($@) {
@@ -1617,6 +1549,12 @@ sub handleJSONRPC {
 				return;
         }
 
+        # A JSON-RPC 2.0 batch, all calls are answered in one array
+        if (ref($procedure) eq 'ARRAY') {
+                Plugins::IckStreamPlugin::JsonHandler::handleBatch($context, $procedure, \&dispatchProcedure);
+                return;
+        }
+
         # Validate the procedure
         # We must get a JSON object, i.e. a hash
         if (ref($procedure) ne 'HASH') {
@@ -1632,18 +1570,26 @@ sub handleJSONRPC {
         }
 
         $context->{'procedure'} = $procedure;
+        dispatchProcedure($context);
+}
+
+# Validates and runs a single procedure, also used for each call of a batch
+sub dispatchProcedure {
+        my $context = shift;
+        my $procedure = $context->{'procedure'};
 		
 		# ignore notifications (which don't have an id)
 		if (!defined($procedure->{'id'})) {
 				$log->debug("Ignoring notification: ".Data::Dump::dump($procedure));
-                Slim::Web::HTTP::closeHTTPSocket($httpClient);
+                Plugins::IckStreamPlugin::JsonHandler::finishWithoutResponse($context);
                 return;
 		}
 
-		# ignore errors, just log them
+		# log errors, the requester is told if it's waiting for the response
 		if (defined($procedure->{'error'})) {
 				$log->warn("JSON error on id=".$procedure->{'id'}.": ".$procedure->{'error'}->{'code'}.":".$procedure->{'error'}->{'code'}.(defined($procedure->{'error'}->{'data'})?"(".$procedure->{'error'}->{'data'}.")":""));
-                Slim::Web::HTTP::closeHTTPSocket($httpClient);
+				Plugins::IckStreamPlugin::ProtocolHandler::responseCallback($procedure);
+                Plugins::IckStreamPlugin::JsonHandler::finishWithoutResponse($context);
                 return;
 		}
 
@@ -1655,7 +1601,7 @@ sub handleJSONRPC {
 					if(!Plugins::IckStreamPlugin::LocalServiceManager::responseCallback($procedure)) {
 						Plugins::IckStreamPlugin::ProtocolHandler::responseCallback($procedure);
 					}
-	                Slim::Web::HTTP::closeHTTPSocket($httpClient);
+	                Plugins::IckStreamPlugin::JsonHandler::finishWithoutResponse($context);
 					return;
 				}
 				Plugins::IckStreamPlugin::JsonHandler::generateJSONResponse($context, undef, {
@@ -1682,7 +1628,7 @@ sub handleJSONRPC {
                 # return internal server error
                 $log->error("Procedure $method refers to non CODE ??? => closing connection");
                 
-                Slim::Web::HTTP::closeHTTPSocket($httpClient);
+                Plugins::IckStreamPlugin::JsonHandler::finishWithoutResponse($context);
                 return;
         }
         
@@ -1694,39 +1640,17 @@ sub handleJSONRPC {
                 
                 # error, params is an array or an object
                 $log->warn("Procedure $method has params not HASH => closing connection");
-                Slim::Web::HTTP::closeHTTPSocket($httpClient);
+                Plugins::IckStreamPlugin::JsonHandler::finishWithoutResponse($context);
                 return;
         }        
 
-        # Detect the language the client wants content returned in
-        if ( my $lang = $httpResponse->request->header('Accept-Language') ) {
-                my @parts = split(/[,-]/, $lang);
-                $context->{lang} = uc $parts[0] if $parts[0];
-        }
-
-        if ( my $ua = ( $httpResponse->request->header('X-User-Agent') || $httpResponse->request->header('User-Agent') ) ) {
-                $context->{ua} = $ua;
-        }
-
-        # Check our operational mode using our X-Jive header
-        # We must be delaing with a 1.1 client because X-Jive uses chunked transfers
-        # We must not be closing the connection
-        if (defined(my $xjive = $httpResponse->request()->header('X-Jive')) &&
-                $httpClient->proto_ge('1.1') &&
-                $httpResponse->header('Connection') !~ /close/i) {
-        
-                main::INFOLOG && $log->info("Operating in x-jive mode for procedure $method and client $httpClient");
-                $context->{'x-jive'} = 1;
-                $httpResponse->header('X-Jive' => 'Jive')
+        # the context of a batch has been prepared once for all calls
+        if (!defined($context->{'batch'})) {
+                Plugins::IckStreamPlugin::JsonHandler::prepareContext($context, $method);
         }
-                
-        # remember we need to send headers. We'll reset this once sent.
-        $context->{'sendheaders'} = 1;
-        
-        # store our context. It'll get erased by the callback in HTTP.pm through handleClose
-        Plugins::IckStreamPlugin::JsonHandler::setContext($httpClient, $context);
 
 		# Get player for uuid
+		my $httpParams = $context->{'httpParams'};
 		my $players = $prefs->get('players');
 		my $player = undef;
 		if(defined($httpParams->{'toDeviceId'}) && $players->{$httpParams->{'toDeviceId'}}) {
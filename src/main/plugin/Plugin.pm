@@ -57,6 +57,8 @@ use Plugins::IckStreamPlugin::ProtocolHandler;
 use Plugins::IckStreamPlugin::LocalProtocolHandler;
 use Plugins::IckStreamPlugin::PlayerManager;
 use Plugins::IckStreamPlugin::LicenseManager;
+use Plugins::IckStreamPlugin::LibraryIndex;
+use Plugins::IckStreamPlugin::RandomTrackPool;
 
 my $log = Slim::Utils::Log->addLogCategory({
 	'category'     => 'plugin.ickstream',
@@ -221,6 +223,8 @@ sub initPlugin {
 	Slim::Control::Request::addDispatch(['ickstream','player','?'], [1, 1, 0, \&Plugins::IckStreamPlugin::PlayerManager::playerEnabledQuery]);
 	Plugins::IckStreamPlugin::PlayerServiceCLI::init();
 	Plugins::IckStreamPlugin::LicenseManager::init();
+	Plugins::IckStreamPlugin::LibraryIndex::init();
+	Plugins::IckStreamPlugin::RandomTrackPool::init();
 
 	Slim::Control::Request::subscribe(\&Plugins::IckStreamPlugin::PlayerManager::playerChange,[['client']]);
 	Slim::Control::Request::subscribe(\&Plugins::IckStreamPlugin::BrowseManager::playerChange,[['client']]);
@@ -236,7 +240,9 @@ sub startServers {
 	my $class = shift;
 	
 	if(!main::ISWINDOWS) {
-		Plugins::IckStreamPlugin::ContentAccessServer->start($class);
+		if(!$prefs->get('singleDaemon')) {
+			Plugins::IckStreamPlugin::ContentAccessServer->start($class);
+		}
 		Plugins::IckStreamPlugin::PlayerServer->start($class);
 	}else {
 		Plugins::IckStreamPlugin::PlayerManager::start($class);
@@ -244,6 +250,8 @@ sub startServers {
 }
 
 sub shutdownPlugin {
+	Plugins::IckStreamPlugin::LibraryIndex::stop();
+	Plugins::IckStreamPlugin::RandomTrackPool::stop();
 	if(!main::ISWINDOWS) {
 		Plugins::IckStreamPlugin::ContentAccessServer->stop;
 		Plugins::IckStreamPlugin::PlayerServer->stop;
@@ -289,13 +297,13 @@ sub otherPlaylist {
 		Plugins::IckStreamPlugin::PlaybackQueueManager::setPlaybackQueue($player,\@empty);
 		@empty = ();
 		Plugins::IckStreamPlugin::PlaybackQueueManager::setOriginalPlaybackQueue($player,\@empty);
+		Plugins::IckStreamPlugin::ProtocolHandler::prefetchStreamingRefs($player,0);
 		
 		my $playerStatus = $prefs->client($player)->get('playerStatus');
 		$playerStatus->{'playbackQueuePos'} = undef;
 		$playerStatus->{'track'} = undef;
 		$prefs->client($player)->set('playerStatus',$playerStatus);
-		Plugins::IckStreamPlugin::PlayerService::sendPlaybackQueueChangedNotification($player);
-		Plugins::IckStreamPlugin::PlayerService::sendPlayerStatusChangedNotification($player);
+		Plugins::IckStreamPlugin::PlayerService::sendPlaybackQueueAndPlayerStatusChangedNotifications($player);
 	}
 }
 
@@ -38,6 +38,8 @@ use Data::Dumper;
 use Plugins::IckStreamPlugin::ItemCache;
 use Plugins::IckStreamPlugin::Plugin;
 use Plugins::IckStreamPlugin::CloudServiceManager;
+use Plugins::IckStreamPlugin::PlayerDaemonChannel;
+use Plugins::IckStreamPlugin::PlaybackQueueManager;
 
 
 my $log = Slim::Utils::Log->addLogCategory({
@@ -50,6 +52,25 @@ my $serverPrefs = preferences('server');
 
 my $localServiceItemRequestIds = {};
 my $localServiceItemStreamingRefRequestIds = {};
+# Time each prefetch request was sent by request id
+my $localServicePrefetchRequestIds = {};
+
+# Items requested in one JSON-RPC batch when prefetching metadata
+my $PREFETCH_BATCH_SIZE = 100;
+
+# Streaming refs of the upcoming tracks of each player, resolved before LMS asks for them
+my $prefetchedStreamingRefs = {};
+# Callbacks and the time the request was sent by request id, unanswered requests are dropped after $REQUEST_TIMEOUT
+my $localServiceRequestCallbacks = {};
+
+# Upcoming tracks whose streaming refs are resolved ahead of time
+my $STREAMING_REF_PREFETCH_COUNT = 3;
+# The services don't tell how long a streaming url stays valid, so it's only used for this many seconds
+my $STREAMING_REF_VALIDITY = 600;
+# Streaming refs are refreshed this many seconds before they become invalid
+my $STREAMING_REF_REFRESH_MARGIN = 60;
+# Seconds after which an unanswered request is sent again
+my $REQUEST_TIMEOUT = 35;
 
 sub new {
 	my $class  = shift;
@@ -162,25 +183,21 @@ sub _getTrack {
 	}
 	
 	my $meta = Plugins::IckStreamPlugin::ItemCache::getItemFromCache( $trackId );
+	my $prefetched = _takePrefetchedStreamingRef($client, $trackId);
+	if(defined($prefetched) && (defined($prefetched->{'item'}) || $meta)) {
+		main::DEBUGLOG && $log->debug("Using prefetched stream for ".$trackId);
+		_gotTrack( $prefetched->{'item'}, $prefetched->{'streamingRef'}, $meta, $params );
+		return;
+	}
 	my $playerConfiguration = $prefs->client($client)->get('playerConfiguration') || {};
 	if($serviceId =~ /[0-9a-fA-F]{8}-[0-9a-fA-F]{4}-[0-9a-fA-F]{4}-[0-9a-fA-F]{4}-[0-9a-fA-F]{12}/) {
 		if(!$meta) {
 			$log->info("Getting metadata for ".$trackId." for ".$client->name());
 			
-		    my $serverIP = Slim::Utils::IPDetect::IP();
-			my $httpParams = { timeout => 35 };
 			my $requestId = Plugins::IckStreamPlugin::Plugin::getNextRequestId();
 			$localServiceItemRequestIds->{$requestId} = $params;
 			
-			Slim::Networking::SimpleAsyncHTTP->new(
-				sub {
-					$log->warn("Successfully sent getItem request");
-				},
-				sub {
-					$log->warn("Error when sending getItem request");
-				},
-				$httpParams
-			)->post("http://".$serverIP.":".$prefs->get('daemonPort')."/sendMessage/".$serviceId."/2",'Content-Type' => 'application/json','Authorization'=>$playerConfiguration->{'id'},to_json({
+			Plugins::IckStreamPlugin::PlayerDaemonChannel::sendMessage($playerConfiguration->{'id'}, $serviceId, 2, to_json({
 				'jsonrpc' => '2.0',
 				'id' => $requestId,
 				'method' => 'getItem',
@@ -188,24 +205,20 @@ sub _getTrack {
 					'contextId' => 'allMusic',
 					'itemId' => $trackId
 				}
-			}));
+			}),
+				sub {
+					$log->warn("Successfully sent getItem request");
+				},
+				sub {
+					$log->warn("Error when sending getItem request");
+				});
 
 		}elsif(!defined($meta->{'url'})) {
 			$params->{'meta'} = $meta;
 			my $requestId = Plugins::IckStreamPlugin::Plugin::getNextRequestId();
 			$localServiceItemStreamingRefRequestIds->{$requestId} = $params;
 			
-		    my $serverIP = Slim::Utils::IPDetect::IP();
-			my $httpParams = { timeout => 35 };
-			Slim::Networking::SimpleAsyncHTTP->new(
-				sub {
-					$log->warn("Successfully sent getItemStreamingRef request");
-				},
-				sub {
-					$log->warn("Error when sending getItemStreamingRef request");
-				},
-				$httpParams
-			)->post("http://".$serverIP.":".$prefs->get('daemonPort')."/sendMessage/".$serviceId."/2",'Content-Type' => 'application/json','Authorization'=>$playerConfiguration->{'id'},to_json({
+			Plugins::IckStreamPlugin::PlayerDaemonChannel::sendMessage($playerConfiguration->{'id'}, $serviceId, 2, to_json({
 				'jsonrpc' => '2.0',
 				'id' => $requestId,
 				'method' => 'getItemStreamingRef',
@@ -213,7 +226,13 @@ sub _getTrack {
 					'contextId' => 'allMusic',
 					'itemId' => $trackId
 				}
-			}));
+			}),
+				sub {
+					$log->warn("Successfully sent getItemStreamingRef request");
+				},
+				sub {
+					$log->warn("Error when sending getItemStreamingRef request");
+				});
 		}else {
 			_gotTrack( undef, undef, $meta, $params );
 		}
@@ -333,8 +352,293 @@ sub _getTrack {
 	}
 }
 
+# Requests the metadata of items not in the item cache, so it's there when the items are played.
+# The getItem requests to each service are sent as JSON-RPC batches.
+sub prefetchItems {
+	my $client = shift;
+	my $itemIds = shift;
+
+	my %itemIdsByService = ();
+	for my $itemId (@$itemIds) {
+		my ($trackId,$serviceId) = _getStreamParams('ickstream://'.$itemId);
+		if(defined($serviceId)) {
+			push @{$itemIdsByService{$serviceId}},$itemId;
+		}
+	}
+
+	my $playerConfiguration = $prefs->client($client)->get('playerConfiguration') || {};
+	for my $serviceId (keys %itemIdsByService) {
+		my @serviceItemIds = @{$itemIdsByService{$serviceId}};
+		while(scalar(@serviceItemIds)>0) {
+			my @requests = ();
+			for my $itemId (splice(@serviceItemIds,0,$PREFETCH_BATCH_SIZE)) {
+				push @requests,{
+					'jsonrpc' => '2.0',
+					'id' => Plugins::IckStreamPlugin::Plugin::getNextRequestId(),
+					'method' => 'getItem',
+					'params' => {
+						'contextId' => 'allMusic',
+						'itemId' => $itemId
+					}
+				};
+			}
+			$log->info("Prefetching metadata for ".scalar(@requests)." items from ".$serviceId." for ".$client->name());
+
+			if($serviceId =~ /[0-9a-fA-F]{8}-[0-9a-fA-F]{4}-[0-9a-fA-F]{4}-[0-9a-fA-F]{4}-[0-9a-fA-F]{12}/) {
+				_expireLocalServiceRequests();
+				# The responses are handled one by one in responseCallback
+				my $now = Time::HiRes::time();
+				for my $request (@requests) {
+					$localServicePrefetchRequestIds->{$request->{'id'}} = $now;
+				}
+				Plugins::IckStreamPlugin::PlayerDaemonChannel::sendMessage($playerConfiguration->{'id'}, $serviceId, 2, to_json(\@requests),
+					sub {
+						$log->debug("Successfully sent getItem batch request");
+					},
+					sub {
+						$log->warn("Error when sending getItem batch request");
+						for my $request (@requests) {
+							delete $localServicePrefetchRequestIds->{$request->{'id'}};
+						}
+					});
+			}else {
+				Plugins::IckStreamPlugin::CloudServiceManager::getService($client, $serviceId,
+					sub {
+						my $serviceUrl = Plugins::IckStreamPlugin::CloudServiceManager::getServiceUrl($client, $serviceId);
+						if(!defined($serviceUrl)) {
+							$log->warn("Unable to prefetch metadata, service ".$serviceId." not available for ".$client->name());
+							return;
+						}
+						Slim::Networking::SimpleAsyncHTTP->new(
+							sub {
+								my $http = shift;
+								my $jsonResponses = eval { from_json($http->content) };
+								if(ref($jsonResponses) ne 'ARRAY') {
+									$log->warn("Failed to prefetch metadata from ".$serviceId." for ".$client->name().": ".$http->content);
+									return;
+								}
+								for my $jsonResponse (@$jsonResponses) {
+									if(ref($jsonResponse) eq 'HASH' && $jsonResponse->{'result'}) {
+										Plugins::IckStreamPlugin::ItemCache::setItemInCache($jsonResponse->{'result'}->{'id'},$jsonResponse->{'result'});
+									}
+								}
+							},
+							sub {
+								my $http = shift;
+								my $error = shift;
+								$log->warn("Failed to prefetch metadata from ".$serviceId." for ".$client->name().": ".$error);
+							},
+							{ timeout => 35 }
+						)->post($serviceUrl,'Content-Type' => 'application/json','Authorization'=>'Bearer '.$playerConfiguration->{'accessToken'},to_json(\@requests));
+					});
+			}
+		}
+	}
+}
+
+# Resolves the streaming refs of the tracks following $playbackQueuePos in the background, so
+# getNextTrack doesn't have to wait for getItem and getItemStreamingRef when the track starts.
+sub prefetchStreamingRefs {
+	my $client = shift;
+	my $playbackQueuePos = shift;
+
+	my $entries = $prefetchedStreamingRefs->{$client->id} || {};
+	my $localServiceId = $prefs->get('uuid');
+	my %upcoming = ();
+	for my $item (@{Plugins::IckStreamPlugin::PlaybackQueueManager::getPlaybackQueueItems($client,$playbackQueuePos+1,$STREAMING_REF_PREFETCH_COUNT)}) {
+		my $trackId = $item->{'id'};
+		# Tracks of this LMS are played by LocalProtocolHandler
+		next if($trackId =~ /^\Q$localServiceId\E:lms:/);
+		my $meta = Plugins::IckStreamPlugin::ItemCache::getItemFromCache($trackId);
+		# Items which include their streaming url are played without asking the service
+		if(!defined($meta) || !defined($meta->{'url'})) {
+			$upcoming{$trackId} = $entries->{$trackId} || { 'nextRefresh' => 0 };
+		}
+	}
+	if(scalar(keys %upcoming)>0) {
+		$prefetchedStreamingRefs->{$client->id} = \%upcoming;
+	}else {
+		delete $prefetchedStreamingRefs->{$client->id};
+	}
+	_refreshStreamingRefs($client);
+}
+
+# Resolves the streaming refs which are missing or about to become invalid and schedules the next refresh
+sub _refreshStreamingRefs {
+	my $client = shift;
+
+	Slim::Utils::Timers::killTimers($client, \&_refreshStreamingRefs);
+	_expireLocalServiceRequests();
+	my $entries = $prefetchedStreamingRefs->{$client->id};
+	return if(!defined($entries));
+
+	my $now = Time::HiRes::time();
+	my $nextRefresh = undef;
+	for my $trackId (keys %{$entries}) {
+		my $entry = $entries->{$trackId};
+		if($entry->{'nextRefresh'} <= $now) {
+			$entry->{'nextRefresh'} = $now + $REQUEST_TIMEOUT;
+			_prefetchStreamingRef($client, $trackId, $entry);
+		}
+		if(!defined($nextRefresh) || $entry->{'nextRefresh'} < $nextRefresh) {
+			$nextRefresh = $entry->{'nextRefresh'};
+		}
+	}
+	Slim::Utils::Timers::setTimer($client, $nextRefresh, \&_refreshStreamingRefs);
+}
+
+sub _prefetchStreamingRef {
+	my $client = shift;
+	my $trackId = shift;
+	my $entry = shift;
+
+	my ($id,$serviceId) = _getStreamParams( 'ickstream://'.$trackId );
+	my $gotStreamingRef = sub {
+		my $item = shift;
+		my $streamingRef = shift;
+
+		my $now = Time::HiRes::time();
+		$entry->{'item'} = $item;
+		$entry->{'streamingRef'} = $streamingRef;
+		$entry->{'validUntil'} = $now + $STREAMING_REF_VALIDITY;
+		$entry->{'nextRefresh'} = $now + $STREAMING_REF_VALIDITY - $STREAMING_REF_REFRESH_MARGIN;
+		main::DEBUGLOG && $log->debug("Prefetched stream for ".$trackId." for ".$client->name());
+		# The entry might have been dropped from the upcoming tracks meanwhile
+		_refreshStreamingRefs($client) if(defined($prefetchedStreamingRefs->{$client->id}) && $prefetchedStreamingRefs->{$client->id}->{$trackId} == $entry);
+	};
+	my $failed = sub {
+		my $error = shift;
+		$log->warn("Failed to prefetch stream for ".$trackId." for ".$client->name().": ".$error);
+	};
+
+	if(Plugins::IckStreamPlugin::ItemCache::getItemFromCache($trackId)) {
+		_sendServiceRequest($client, $serviceId, 'getItemStreamingRef', $trackId,
+			sub {
+				$gotStreamingRef->(undef, shift);
+			}, $failed);
+	}else {
+		_sendServiceRequest($client, $serviceId, 'getItem', $trackId,
+			sub {
+				my $item = shift;
+				if(defined($item->{'streamingRefs'}) && $item->{'streamingRefs'}->[0]->{'url'}) {
+					$gotStreamingRef->($item, $item->{'streamingRefs'}->[0]);
+				}else {
+					_sendServiceRequest($client, $serviceId, 'getItemStreamingRef', $trackId,
+						sub {
+							$gotStreamingRef->($item, shift);
+						}, $failed);
+				}
+			}, $failed);
+	}
+}
+
+# Returns the prefetched streaming ref of a track if it's still valid, each one is only used once
+sub _takePrefetchedStreamingRef {
+	my $client = shift;
+	my $trackId = shift;
+
+	my $entries = $prefetchedStreamingRefs->{$client->id};
+	return undef if(!defined($entries) || !defined($entries->{$trackId}));
+
+	my $entry = $entries->{$trackId};
+	if(defined($entry->{'streamingRef'}) && $entry->{'validUntil'} > Time::HiRes::time()) {
+		delete $entries->{$trackId};
+		return $entry;
+	}
+	return undef;
+}
+
+# Sends a request about a single item to a local or cloud service, $successCb gets the result
+sub _sendServiceRequest {
+	my $client = shift;
+	my $serviceId = shift;
+	my $method = shift;
+	my $itemId = shift;
+	my $successCb = shift;
+	my $errorCb = shift;
+
+	my $playerConfiguration = $prefs->client($client)->get('playerConfiguration') || {};
+	my $request = {
+		'jsonrpc' => '2.0',
+		'id' => Plugins::IckStreamPlugin::Plugin::getNextRequestId(),
+		'method' => $method,
+		'params' => {
+			'contextId' => 'allMusic',
+			'itemId' => $itemId
+		}
+	};
+	if($serviceId =~ /[0-9a-fA-F]{8}-[0-9a-fA-F]{4}-[0-9a-fA-F]{4}-[0-9a-fA-F]{4}-[0-9a-fA-F]{12}/) {
+		$localServiceRequestCallbacks->{$request->{'id'}} = {
+			'successCb' => $successCb,
+			'errorCb' => $errorCb,
+			'sent' => Time::HiRes::time()
+		};
+		Plugins::IckStreamPlugin::PlayerDaemonChannel::sendMessage($playerConfiguration->{'id'}, $serviceId, 2, to_json($request),
+			sub {
+				main::DEBUGLOG && $log->debug("Successfully sent ".$method." request");
+			},
+			sub {
+				delete $localServiceRequestCallbacks->{$request->{'id'}};
+				$errorCb->("Error when sending ".$method." request");
+			});
+	}else {
+		Plugins::IckStreamPlugin::CloudServiceManager::getService($client, $serviceId,
+			sub {
+				my $serviceUrl = Plugins::IckStreamPlugin::CloudServiceManager::getServiceUrl($client, $serviceId);
+				if(!defined($serviceUrl)) {
+					$errorCb->("Service ".$serviceId." not available");
+					return;
+				}
+				Slim::Networking::SimpleAsyncHTTP->new(
+					sub {
+						my $http = shift;
+						my $jsonResponse = eval { from_json($http->content) };
+						if($jsonResponse && $jsonResponse->{'result'}) {
+							$successCb->($jsonResponse->{'result'});
+						}else {
+							$errorCb->($http->content);
+						}
+					},
+					sub {
+						my $http = shift;
+						my $error = shift;
+						$errorCb->($error);
+					},
+					{ timeout => $REQUEST_TIMEOUT }
+				)->post($serviceUrl,'Content-Type' => 'application/json','Authorization'=>'Bearer '.$playerConfiguration->{'accessToken'},to_json($request));
+			});
+	}
+}
+
+# Drops the requests to local services which haven't been answered in time, the response might
+# never come if the service or the daemon went away
+sub _expireLocalServiceRequests {
+	my $expired = Time::HiRes::time() - $REQUEST_TIMEOUT;
+	for my $requestId (grep { $localServicePrefetchRequestIds->{$_} < $expired } keys %{$localServicePrefetchRequestIds}) {
+		delete $localServicePrefetchRequestIds->{$requestId};
+	}
+	for my $requestId (grep { $localServiceRequestCallbacks->{$_}->{'sent'} < $expired } keys %{$localServiceRequestCallbacks}) {
+		my $callbacks = delete $localServiceRequestCallbacks->{$requestId};
+		$callbacks->{'errorCb'}->("No response to request ".$requestId);
+	}
+}
+
 sub responseCallback {
 	my $jsonResponse = shift;
+	if(my $callbacks = delete $localServiceRequestCallbacks->{$jsonResponse->{'id'}}) {
+		if($jsonResponse->{'result'}) {
+			$callbacks->{'successCb'}->($jsonResponse->{'result'});
+		}else {
+			$callbacks->{'errorCb'}->(Dumper($jsonResponse->{'error'}));
+		}
+		return 1;
+	}
+	if(delete $localServicePrefetchRequestIds->{$jsonResponse->{'id'}}) {
+		if($jsonResponse->{'result'}) {
+			Plugins::IckStreamPlugin::ItemCache::setItemInCache($jsonResponse->{'result'}->{'id'},$jsonResponse->{'result'});
+		}
+		return 1;
+	}
 	if(defined($localServiceItemRequestIds->{$jsonResponse->{'id'}})) {
 		my $params = $localServiceItemRequestIds->{$jsonResponse->{'id'}}; 
 		$localServiceItemRequestIds->{$jsonResponse->{'id'}} = undef;
@@ -354,19 +658,7 @@ sub responseCallback {
 				my $requestId = Plugins::IckStreamPlugin::Plugin::getNextRequestId();
 				$localServiceItemStreamingRefRequestIds->{$requestId} = $params;
 				
-			    my $serverIP = Slim::Utils::IPDetect::IP();
-				my $httpParams = { timeout => 35 };
-				Slim::Networking::SimpleAsyncHTTP->new(
-					sub {
-						$log->warn("Successfully sent getItemStreamingRef request");
-					},
-					sub {
-						my $http = shift;
-						my $error = shift;
-						$log->warn("Error when sending getItemStreamingRef request: ".$error);
-					},
-					$httpParams
-				)->post("http://".$serverIP.":".$prefs->get('daemonPort')."/sendMessage/".$serviceId."/2",'Content-Type' => 'application/json','Authorization'=>$playerConfiguration->{'id'},to_json({
+				Plugins::IckStreamPlugin::PlayerDaemonChannel::sendMessage($playerConfiguration->{'id'}, $serviceId, 2, to_json({
 					'jsonrpc' => '2.0',
 					'id' => $requestId,
 					'method' => 'getItemStreamingRef',
@@ -374,7 +666,15 @@ sub responseCallback {
 						'contextId' => 'allMusic',
 						'itemId' => $trackId
 					}
-				}));
+				}),
+					sub {
+						$log->warn("Successfully sent getItemStreamingRef request");
+					},
+					sub {
+						my $http = shift;
+						my $error = shift;
+						$log->warn("Error when sending getItemStreamingRef request: ".$error);
+					});
 			}
 		}else {
 			$log->warn("Failed to metadata stream for ".$trackId.": ".Dumper($jsonResponse));
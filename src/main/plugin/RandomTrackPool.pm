@@ -0,0 +1,239 @@
+# Copyright (c) 2014, ickStream GmbH
+# All rights reserved.
+# 
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#     * Redistributions of source code must retain the above copyright
+#       notice, this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright
+#       notice, this list of conditions and the following disclaimer in the
+#       documentation and/or other materials provided with the distribution.
+#     * Neither the name of ickStream nor the
+#       names of its contributors may be used to endorse or promote products
+#       derived from this software without specific prior written permission.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL LOGITECH, INC BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+package Plugins::IckStreamPlugin::RandomTrackPool;
+
+# Pools of randomly selected tracks for the dynamic playlist selections of
+# ContentAccessService, so getNextDynamicPlaylistTracks doesn't have to sort
+# the library randomly while a player waits for its next tracks. A pool is
+# created by the first request for a selection and topped up in the
+# background, a selection which hasn't been requested for a while is dropped.
+# Tracks aren't repeated within a pool and the ones served recently aren't
+# selected again as long as the selection has enough other tracks.
+
+use strict;
+use Slim::Utils::Log;
+use Slim::Utils::Scheduler;
+
+my $log = logger('plugin.ickstream.content');
+
+# Tracks selected by each background query
+my $POOL_SIZE = 100;
+# Pools with fewer tracks than this are topped up
+my $POOL_LOW_WATERMARK = 50;
+# Seconds after which a pool nobody requests tracks from is dropped
+my $POOL_IDLE_TIMEOUT = 3600;
+
+# Pools by selection key: {type, data, version, items, itemIds, recentIds, recentQueue, lastUsed, needsFilling, lowWatermark}
+my $pools = {};
+my $fillTaskRunning = 0;
+
+sub init {
+	Slim::Control::Request::subscribe(\&scanDone,[['rescan'],['done']]);
+}
+
+sub stop {
+	Slim::Control::Request::unsubscribe(\&scanDone);
+	Slim::Utils::Scheduler::remove_task(\&fillStep);
+	$fillTaskRunning = 0;
+	$pools = {};
+}
+
+# The pools were selected from the library before the scan, they are refilled for the selections still in use
+sub scanDone {
+	my $request = shift;
+
+	$log->debug("Library scan done, refilling random track pools");
+	for my $pool (values %$pools) {
+		_clear($pool);
+	}
+	_startFilling();
+}
+
+# Returns $count tracks of a selection from its pool, or undef if the pool can't serve them yet,
+# in which case the caller has to select them itself. Either way the pool is topped up afterwards.
+sub takeTracks {
+	my $type = shift;
+	my $data = shift;
+	my $count = shift;
+
+	my $key = _key($type,$data);
+	my $pool = $pools->{$key};
+	if(!defined($pool)) {
+		$pool = {
+			'type' => $type,
+			'data' => $data
+		};
+		_clear($pool);
+		$pools->{$key} = $pool;
+	}
+	$pool->{'lastUsed'} = time();
+
+	my $items = undef;
+	if(_isCurrent($pool) && scalar(@{$pool->{'items'}})>=$count) {
+		my @taken = splice(@{$pool->{'items'}},0,$count);
+		for my $item (@taken) {
+			delete $pool->{'itemIds'}->{$item->{'id'}};
+			_addRecent($pool,$item->{'id'});
+		}
+		$items = \@taken;
+		$log->debug("Served $count tracks for $key from pool, ".scalar(@{$pool->{'items'}})." left");
+	}
+	if(!_isCurrent($pool) || scalar(@{$pool->{'items'}})<$pool->{'lowWatermark'}) {
+		$pool->{'needsFilling'} = 1;
+		_startFilling();
+	}
+	return $items;
+}
+
+sub _key {
+	my $type = shift;
+	my $data = shift;
+
+	# Both select from the whole library
+	if($type eq 'RANDOM_MY_LIBRARY') {
+		$type = 'RANDOM_ALL';
+	}
+	my @parameters = ();
+	if(ref($data) eq 'HASH') {
+		for my $parameter (sort keys %$data) {
+			if(defined($data->{$parameter}) && !ref($data->{$parameter})) {
+				push @parameters,$parameter.'='.$data->{$parameter};
+			}
+		}
+	}
+	return join("\t",$type,@parameters);
+}
+
+sub _clear {
+	my $pool = shift;
+
+	$pool->{'version'} = undef;
+	$pool->{'needsFilling'} = 1;
+	$pool->{'lowWatermark'} = $POOL_LOW_WATERMARK;
+	$pool->{'items'} = [];
+	$pool->{'itemIds'} = {};
+	$pool->{'recentIds'} = {};
+	$pool->{'recentQueue'} = [];
+}
+
+sub _isCurrent {
+	my $pool = shift;
+
+	return defined($pool->{'version'}) && !Slim::Music::Import->stillScanning() && $pool->{'version'} eq Plugins::IckStreamPlugin::JsonFragmentCache::version();
+}
+
+# Remembers a served track, only the last $POOL_SIZE are kept
+sub _addRecent {
+	my $pool = shift;
+	my $id = shift;
+
+	$pool->{'recentIds'}->{$id} = 1;
+	push @{$pool->{'recentQueue'}},$id;
+	if(scalar(@{$pool->{'recentQueue'}})>$POOL_SIZE) {
+		delete $pool->{'recentIds'}->{shift @{$pool->{'recentQueue'}}};
+	}
+}
+
+sub _startFilling {
+	if(!$fillTaskRunning) {
+		$fillTaskRunning = 1;
+		Slim::Utils::Scheduler::add_task(\&fillStep);
+	}
+}
+
+# Tops up one pool each time the scheduler runs the task, which it does when the server is idle
+sub fillStep {
+	if(Slim::Music::Import->stillScanning()) {
+		# Started again by the next request after the scan
+		$fillTaskRunning = 0;
+		return 0;
+	}
+
+	my $now = time();
+	my $pool = undef;
+	my $key = undef;
+	for my $poolKey (keys %$pools) {
+		my $candidate = $pools->{$poolKey};
+		if($candidate->{'lastUsed'} < $now - $POOL_IDLE_TIMEOUT) {
+			$log->debug("Dropping unused random track pool for $poolKey");
+			delete $pools->{$poolKey};
+		}elsif(!defined($pool) && $candidate->{'needsFilling'}) {
+			$pool = $candidate;
+			$key = $poolKey;
+		}
+	}
+	if(!defined($pool)) {
+		$fillTaskRunning = 0;
+		return 0;
+	}
+
+	if(!_isCurrent($pool)) {
+		_clear($pool);
+		$pool->{'version'} = Plugins::IckStreamPlugin::JsonFragmentCache::version();
+	}
+
+	my $items = undef;
+	eval {
+		$items = Plugins::IckStreamPlugin::ContentAccessService::queryNextDynamicPlaylistTracksForSelection($POOL_SIZE,$pool->{'type'},$pool->{'data'});
+	};
+	if($@) {
+		$log->error("Unable to fill random track pool for $key: $@");
+		delete $pools->{$key};
+		return 1;
+	}
+	if(!defined($items) || scalar(@$items)==0) {
+		# Nothing to select from
+		$pool->{'needsFilling'} = 0;
+		return 1;
+	}
+
+	my $added = 0;
+	for my $item (@$items) {
+		my $id = $item->{'id'};
+		if(!exists($pool->{'itemIds'}->{$id}) && !exists($pool->{'recentIds'}->{$id})) {
+			$pool->{'itemIds'}->{$id} = 1;
+			push @{$pool->{'items'}},$item;
+			$added++;
+		}
+	}
+	if(scalar(@{$pool->{'items'}})>=$POOL_LOW_WATERMARK) {
+		$pool->{'needsFilling'} = 0;
+		$pool->{'lowWatermark'} = $POOL_LOW_WATERMARK;
+	}elsif($added==0 && scalar(@{$pool->{'items'}})==0) {
+		# Everything the selection has was served recently, it may be repeated now
+		$pool->{'recentIds'} = {};
+		$pool->{'recentQueue'} = [];
+	}elsif($added==0 || scalar(@$items)<$POOL_SIZE) {
+		# Everything the selection has which wasn't served recently is in the pool,
+		# it isn't topped up again before half of it has been served
+		$pool->{'needsFilling'} = 0;
+		$pool->{'lowWatermark'} = int(scalar(@{$pool->{'items'}})/2);
+	}
+	$log->debug("Added $added tracks to random track pool for $key, ".scalar(@{$pool->{'items'}})." available");
+	return 1;
+}
+
+1;
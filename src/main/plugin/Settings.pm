@@ -79,7 +79,7 @@ sub page {
 }
 
 sub prefs {
-	return ($prefs, 'orderAlbumsForArtist', 'daemonPort', 'disablePeerVerification', 'proxiedStreamingForHires');
+	return ($prefs, 'orderAlbumsForArtist', 'daemonPort', 'disablePeerVerification', 'proxiedStreamingForHires', 'singleDaemon', 'notificationCoalescingWindow', 'contentCacheSize');
 }
 
 sub handler {